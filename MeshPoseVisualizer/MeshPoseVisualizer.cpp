@@ -3,6 +3,8 @@
 
 #include "pch.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <algorithm> 
 
 // Include GLEW
@@ -16,8 +18,6 @@
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -25,13 +25,38 @@ using namespace glm;
 
 #include "shader.hpp"
 #include "controls.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+#include "rasterizer.hpp"
+#include "scheduler.hpp"
+#include "encoder.hpp"
+#include "facemap.hpp"
+#include "facemapcodec.hpp"
+#include "objparser.hpp"
+#include "glcontext.hpp"
+#include "visibility.hpp"
+#include "bvh.hpp"
+#include "scene.hpp"
+#include "renderstate.hpp"
+#include "poses.hpp"
+#include "faceattributes.hpp"
+#include "depthmap.hpp"
+#include "colorfusion.hpp"
+#include "facemaparchive.hpp"
+#include "benchmark.hpp"
+#include "trace.hpp"
 
 GLFWwindow* window = nullptr;
 
 #include <algorithm> 
+#include <atomic>
+#include <chrono>
 #include <functional> 
-#include <filesystem>
+#include <future>
+#include <experimental/filesystem>
+#include <memory>
 #include <math.h>  
+#include <string.h>
 
 void __inline swap(unsigned char& x, unsigned char& y) {
 	unsigned char temp = x;
@@ -58,26 +83,6 @@ static inline std::string &trim(std::string &s) {
 	return ltrim(rtrim(s));
 }
 
-static std::string GetBaseDir(const std::string& filepath) {
-	if (filepath.find_last_of("/\\") != std::string::npos)
-		return filepath.substr(0, filepath.find_last_of("/\\"));
-	return "";
-}
-
-static bool FileExists(const std::string& abs_filename) {
-	bool ret;
-	FILE* fp = fopen(abs_filename.c_str(), "rb");
-	if (fp) {
-		ret = true;
-		fclose(fp);
-	}
-	else {
-		ret = false;
-	}
-
-	return ret;
-}
-
 static void CheckErrors(std::string desc) {
 	GLenum e = glGetError();
 	if (e != GL_NO_ERROR) {
@@ -86,612 +91,1287 @@ static void CheckErrors(std::string desc) {
 	}
 }
 
-typedef struct {
-	std::vector<float> vertices;
-	std::vector<float> uvs;
-	std::vector<float> normals;
-	std::vector<float> colors;
-	std::vector<float> faces;
-	std::vector<float> faceAreas;
-	int numTriangles;
-	size_t material_id;
-} DrawObject;
 
-static void CalcNormal(float N[3], float v0[3], float v1[3], float v2[3]) {
-	float v10[3];
-	v10[0] = v1[0] - v0[0];
-	v10[1] = v1[1] - v0[1];
-	v10[2] = v1[2] - v0[2];
 
-	float v20[3];
-	v20[0] = v2[0] - v0[0];
-	v20[1] = v2[1] - v0[1];
-	v20[2] = v2[2] - v0[2];
+// Writes areas.txt and face_attributes.bin, depending on the face attribute format, and the
+// shapes of the mesh to shapes.txt. The areas come with the mesh, normals and centroids are only
+// computed for the binary file.
+static void writeFaceAttributeFiles(const ScenePaths& scene, const SceneMesh& mesh, const RunOptions& options) {
+	TRACE_SCOPE("write face attributes");
+	auto startTime = std::chrono::steady_clock::now();
+	const DrawObject& object = mesh.drawObjects[0];
+	writeShapesText(scene.shapesFile, mesh.shapes);
+	TaskPool pool(0);
+	if (options.faceAttributes != "binary") {
+		writeFaceAreasText(scene.faceAreasFile, object.faceAreas, pool);
+	}
+	if (options.faceAttributes != "text") {
+		FaceAttributes attributes;
+		computeFaceAttributes(object.vertices, object.indices, pool, attributes);
+		writeFaceAttributes(scene.faceAttributesFile, attributes);
+	}
+	printf("Wrote the attributes of %d faces in %.1f ms\n", int(object.faceAreas.size()),
+		1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+}
 
-	N[0] = v20[1] * v10[2] - v20[2] * v10[1];
-	N[1] = v20[2] * v10[0] - v20[0] * v10[2];
-	N[2] = v20[0] * v10[1] - v20[1] * v10[0];
+static void printRunStats(size_t numFrames, double seconds, const FrameScheduler& scheduler) {
+	printf("Rendered %d frames in %.2f s (%.1f frames/sec) on %d threads, %d steals\n", int(numFrames), seconds,
+		seconds > 0.0 ? numFrames / seconds : 0.0, scheduler.size(), int(scheduler.getStealCount()));
+}
 
-	float len2 = N[0] * N[0] + N[1] * N[1] + N[2] * N[2];
-	if (len2 > 0.0f) {
-		float len = sqrtf(len2);
+// Encoder pool writing the face maps, and the depth, normal and barycentric maps if requested. Every render
+// worker holds one buffer while it renders, every encoder thread one while it compresses and
+// one more can wait in the queue.
+// The paths of the scene are base paths, ".bin", ".png" or ".rle" are appended depending on the formats.
+// With an archive the face maps are encoded in memory and appended to it instead.
+// PNG face maps only get an alpha channel when the ids do not fit into 24 bits.
+// The encoder threads also count the pixels of every face for the visibility matrix and record
+// the finished frames in the render state. With fusion they decode the color frames and add
+// them to the face colors instead, no maps are written and no frames recorded.
+static std::unique_ptr<EncodePipeline> createFaceMapEncoder(const RunOptions& options, const ScenePaths& scene, size_t numFaces,
+	VisibilityCollector& visibility, SceneRenderState& state, ColorFusion* fusion, FaceMapArchiveWriter* archive) {
+	const bool writeRaw = hasIdFormat(options.idFormat, "raw");
+	const bool writePNG = hasIdFormat(options.idFormat, "png");
+	const bool writeRLE = hasIdFormat(options.idFormat, "rle");
+	const bool withAlpha = numFaces >= (1u << 24);
+	const std::string depthFormat = options.depthFormat;
+	const std::string normalFormat = options.normalFormat;
+	const std::string barycentricFormat = options.barycentricFormat;
+	return std::unique_ptr<EncodePipeline>(new EncodePipeline(options.encodeThreads, options.numThreads + 2 * options.encodeThreads, 960 * 540,
+		depthFormat != "none", normalFormat != "none", barycentricFormat != "none",
+		[&scene, &visibility, &state, fusion, archive, writeRaw, writePNG, writeRLE, withAlpha, depthFormat, normalFormat, barycentricFormat](const EncodeJob& job) {
+			visibility.addFrame(job.frame, &job.faceIds[0], job.faceIds.size());
+			if (fusion) {
+				fusion->addFrame(job.frame, &job.faceIds[0], 960, 540);
+				return;
+			}
+			bool written = true;
+			if (archive) {
+				const std::string& name = scene.frameNames[job.frame];
+				std::vector<unsigned char> data;
+				if (writeRaw) {
+					encodeFaceMapRaw(&job.faceIds[0], 960, 540, data);
+					written = archive->add(name, FACEMAP_CODEC_RAW, data) && written;
+				}
+				if (writePNG) {
+					written = encodeFaceMapPNG(&job.faceIds[0], 960, 540, withAlpha, data) && archive->add(name, FACEMAP_CODEC_PNG, data) && written;
+				}
+				if (writeRLE) {
+					encodeFaceMapRLE(&job.faceIds[0], 960, 540, data);
+					written = archive->add(name, FACEMAP_CODEC_RLE, data) && written;
+				}
+			}
+			else {
+				if (writeRaw) {
+					written = writeFaceMapRaw(scene.faceMapFiles[job.frame] + ".bin", &job.faceIds[0], 960, 540) && written;
+				}
+				if (writePNG) {
+					written = writeFaceMapPNG(scene.faceMapFiles[job.frame] + ".png", &job.faceIds[0], 960, 540, withAlpha) && written;
+				}
+				if (writeRLE) {
+					written = writeFaceMapRLE(scene.faceMapFiles[job.frame] + ".rle", &job.faceIds[0], 960, 540) && written;
+				}
+			}
+			if (depthFormat == "raw") {
+				written = writeDepthMapRaw(scene.depthMapFiles[job.frame] + ".bin", &job.depth[0], 960, 540) && written;
+			}
+			if (normalFormat == "raw") {
+				written = writeNormalMapRaw(scene.normalMapFiles[job.frame] + ".bin", &job.normals[0], 960, 540) && written;
+			}
+			else if (normalFormat == "png") {
+				written = writeNormalMapPNG(scene.normalMapFiles[job.frame] + ".png", &job.normals[0], 960, 540) && written;
+			}
+			if (barycentricFormat == "raw") {
+				written = writeBarycentricMapRaw(scene.barycentricMapFiles[job.frame] + ".bin", &job.barycentrics[0], 960, 540) && written;
+			}
+			if (written) {
+				state.frameDone(job.frame);
+			}
+		}));
+}
 
-		N[0] /= len;
-		N[1] /= len;
-		N[2] /= len;
+// Opens the face map archive of the scene if --archive was given.
+static bool openFaceMapArchive(const RunOptions& options, const ScenePaths& scene, std::unique_ptr<FaceMapArchiveWriter>& archive) {
+	if (!options.archive) {
+		return true;
 	}
+	archive.reset(new FaceMapArchiveWriter());
+	return archive->open(scene.faceMapArchiveFile, 960, 540);
 }
 
+// Writes visibility.bin and records it in the render state, and the fused colors and the index
+// of the archive if any.
+static bool finishScene(const ScenePaths& scene, VisibilityCollector& visibility, SceneRenderState& state, const ColorFusion* fusion = NULL,
+	FaceMapArchiveWriter* archive = NULL) {
+	if (archive && !archive->finish()) {
+		return false;
+	}
+	if (!visibility.write(scene.visibilityFile)) {
+		return false;
+	}
+	if (fusion && !fusion->writeColoredMesh(scene.coloredMeshFile)) {
+		return false;
+	}
+	return state.finish();
+}
 
-static bool LoadObjAndConvert(float bmin[3], float bmax[3], std::vector<DrawObject>* drawObjects, std::vector<tinyobj::material_t>& materials, std::map<std::string, GLuint>& textures, const char* filename) {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-
-	std::string base_dir = GetBaseDir(filename);
-	if (base_dir.empty()) {
-		base_dir = ".";
+// Scenes without frames to render only need visibility.bin rewritten when frames were removed.
+static bool updateUnchangedScene(const ScenePaths& scene, SceneRenderState& state) {
+	if (state.isUpToDate()) {
+		printf("All %d frames of %s are up to date\n", int(scene.cam2WorldMatrixFiles.size()), scene.rootDir.c_str());
+		return true;
 	}
-#ifdef _WIN32
-	base_dir += "\\";
-#else
-	base_dir += "/";
-#endif
+	VisibilityCollector& visibility = state.prepareVisibility(state.getNumFaces());
+	return state.begin() && finishScene(scene, visibility, state);
+}
 
-	std::string warn;
-	std::string err;
-	
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, base_dir.c_str());
-	if (!warn.empty()) {
-		std::cout << "WARN: " << warn << std::endl;
+// Renders the face maps of a scene with the software rasterizer, no OpenGL context is created.
+// Every worker owns a rasterizer with renderThreads threads, the mesh is shared read-only.
+static bool renderSceneOnCPU(const ScenePaths& scene, const SceneMesh& mesh, const PoseSet& poses, const RunOptions& options, SceneRenderState& state) {
+	const DrawObject& object = mesh.drawObjects[0];
+	if (state.needsFaceAttributes()) {
+		writeFaceAttributeFiles(scene, mesh, options);
 	}
-	if (!err.empty()) {
-		std::cerr << err << std::endl;
+	VisibilityCollector& visibility = state.prepareVisibility(object.faceAreas.size());
+	const std::vector<size_t>& frames = state.getRenderFrames();
+	std::unique_ptr<FaceMapArchiveWriter> archive;
+	if (!state.begin() || !openFaceMapArchive(options, scene, archive)) {
+		return false;
 	}
+	printMeshOrder(mesh);
 
-	if (!ret) {
-		std::cerr << "Failed to load " << filename << std::endl;
+	float camIntrinsicRowMajor[16];
+	if (!readMatrixFile(scene.camIntrinsicsFile, camIntrinsicRowMajor)) {
+		fprintf(stderr, "Unable to read the intrinsics %s\n", scene.camIntrinsicsFile.c_str());
 		return false;
 	}
+	const glm::mat4 ProjectionMatrix = computeProjectionMatrix(camIntrinsicRowMajor[0], camIntrinsicRowMajor[5], camIntrinsicRowMajor[2], camIntrinsicRowMajor[6], 960, 540);
 
-	printf("# of vertices  = %d\n", (int)(attrib.vertices.size()) / 3);
-	printf("# of normals   = %d\n", (int)(attrib.normals.size()) / 3);
-	printf("# of texcoords = %d\n", (int)(attrib.texcoords.size()) / 2);
-	printf("# of materials = %d\n", (int)materials.size());
-	printf("# of shapes    = %d\n", (int)shapes.size());
+	FrameScheduler scheduler(options.numThreads);
+	int renderThreads = options.renderThreads;
+	if (renderThreads <= 0) {
+		renderThreads = std::max(1, getHardwareThreadCount() / scheduler.size());
+	}
+	std::vector<std::unique_ptr<SoftwareRasterizer> > rasterizers(scheduler.size());
+	std::unique_ptr<ColorFusion> fusion(options.fuseColors ? new ColorFusion(object, poses, scene.colorFiles) : NULL);
+	std::unique_ptr<EncodePipeline> encoder = createFaceMapEncoder(options, scene, object.faceAreas.size(), visibility, state, fusion.get(), archive.get());
+
+	auto startTime = std::chrono::steady_clock::now();
+	scheduler.run(frames.size(),
+		[&](int worker) {
+			setTraceThreadName("render worker " + std::to_string(worker));
+			rasterizers[worker].reset(new SoftwareRasterizer(960, 540, renderThreads));
+		},
+		[&](size_t i, int worker) {
+			const size_t frame = frames[i];
+			const glm::mat4 ViewMatrix = computeViewMatrix(poses.get(frame));
+			glm::mat4 MVP = ProjectionMatrix * ViewMatrix;
+
+			std::unique_ptr<EncodeJob> job = encoder->acquire();
+			job->frame = frame;
+			if (mesh.reordered) {
+				rasterizers[worker]->render(mesh.orderedVertices, mesh.sortedIndices, &mesh.clusterFaceIds[0], MVP, &job->faceIds[0]);
+			}
+			else {
+				rasterizers[worker]->render(object, MVP, &job->faceIds[0]);
+			}
+			if (!job->depth.empty() || !job->normals.empty() || !job->barycentrics.empty()) {
+				computeFaceMapAttributes(object, ViewMatrix, camIntrinsicRowMajor[0], camIntrinsicRowMajor[5], camIntrinsicRowMajor[2], camIntrinsicRowMajor[6],
+					960, 540, &job->faceIds[0], job->depth.empty() ? NULL : &job->depth[0], job->normals.empty() ? NULL : &job->normals[0],
+					job->barycentrics.empty() ? NULL : &job->barycentrics[0]);
+			}
+			encoder->submit(std::move(job));
+		},
+		[&](int worker) {
+			rasterizers[worker].reset();
+		});
+	encoder->finish();
+	printRunStats(frames.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(), scheduler);
+	encoder->printStats();
+	return finishScene(scene, visibility, state, fusion.get(), archive.get());
+}
 
-	// Append `default` material
-	materials.push_back(tinyobj::material_t());
+// OpenGL state of one render worker. Each worker has its own context which shares the
+// vertex buffers with the main context. Framebuffers and vertex arrays can not be shared
+// between contexts, and uniform values are stored in the shared program object, so every
+// worker creates its own framebuffer, vertex array and program. They are created for the
+// first scene and kept for all further scenes of a batch.
+// The face ids are read back through a ring of pixel pack buffers: the copy of a frame is only
+// waited for after the next frame has been submitted, so transfer and drawing overlap.
+// With --depth, --normals and --barycentrics the same draw also writes them into more color
+// attachments, which are read back along with the face ids.
+const int NUM_PACK_BUFFERS = 2;
+
+struct GLWorker {
+	GLContext context;
+	bool ready;
+	GLuint programID;
+	GLuint MatrixID;
+	GLuint MVID;
+	GLuint PrimitiveOffsetID;
+	GLuint framebuffer;
+	GLuint renderedTexture;
+	GLuint depthTexture; // 0 without depth output
+	GLuint normalTexture; // 0 without normal output
+	GLuint barycentricTexture; // 0 without barycentric output
+	GLuint depthRenderbuffer;
+	GLuint vertexArray;
+	GLuint packBuffers[NUM_PACK_BUFFERS];
+	GLuint depthPackBuffers[NUM_PACK_BUFFERS];
+	GLuint normalPackBuffers[NUM_PACK_BUFFERS];
+	GLuint barycentricPackBuffers[NUM_PACK_BUFFERS];
+	GLsync packFences[NUM_PACK_BUFFERS]; // null if the pack buffer holds no frame
+	size_t packFrames[NUM_PACK_BUFFERS];
+	int nextPackBuffer;
+	// Face ranges of the clusters in view of the current frame, and the faces drawn in this scene.
+	std::vector<FaceRange> visibleRanges;
+	size_t drawnFaces;
+};
+
+// OpenGL contexts and workers, kept alive for all scenes of a run so contexts, programs and
+// framebuffers are only created once. The outputs besides the face ids are fixed for a run.
+struct GLRenderer {
+	GLContext mainContext;
+	std::vector<GLWorker> workers;
+	std::string vShader;
+	std::string gShader; // only loaded for barycentric output
+	std::string fShader;
+	bool frustumCulling;
+	bool depthOutput;
+	bool normalOutput;
+	bool barycentricOutput;
+	bool workerError;
+	// Texels of the face id buffer texture the driver supports, at least 65536 in OpenGL 3.3.
+	GLint maxTextureBufferSize;
+};
+
+// Creates a texture of the framebuffer size and attaches it to the bound framebuffer.
+static GLuint createAttachment(GLenum attachment, GLint internalFormat, GLenum format, GLenum type) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, 960, 540, 0, format, type, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glFramebufferTexture(GL_FRAMEBUFFER, attachment, texture, 0);
+	return texture;
+}
 
-	for (size_t i = 0; i < materials.size(); i++) {
-		printf("material[%d].diffuse_texname = %s\n", int(i),
-			materials[i].diffuse_texname.c_str());
+static void createPackBuffers(GLuint* buffers, size_t size) {
+	glGenBuffers(NUM_PACK_BUFFERS, buffers);
+	for (int b = 0; b < NUM_PACK_BUFFERS; b++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[b]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
 	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
 
-	// Load diffuse textures
-	{
-		for (size_t m = 0; m < materials.size(); m++) {
-			tinyobj::material_t* mp = &materials[m];
-
-			if (mp->diffuse_texname.length() > 0) {
-				// Only load the texture if it is not already loaded
-				if (textures.find(mp->diffuse_texname) == textures.end()) {
-					GLuint texture_id;
-					int w, h;
-					int comp;
-
-					std::string texture_filename = mp->diffuse_texname;
-					if (!FileExists(texture_filename)) {
-						// Append base dir.
-						texture_filename = base_dir + mp->diffuse_texname;
-						if (!FileExists(texture_filename)) {
-							std::cerr << "Unable to find file: " << mp->diffuse_texname << std::endl;
-							exit(1);
-						}
-					}
-
-					unsigned char* image = stbi_load(texture_filename.c_str(), &w, &h, &comp, STBI_default);
-					if (!image) {
-						std::cerr << "Unable to load texture: " << texture_filename << std::endl;
-						exit(1);
-					}
-					std::cout << "Loaded texture: " << texture_filename << ", w = " << w << ", h = " << h << ", comp = " << comp << std::endl;
-
-					glGenTextures(1, &texture_id);
-					glBindTexture(GL_TEXTURE_2D, texture_id);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-					if (comp == 3) {
-						glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-					}
-					else if (comp == 4) {
-						glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-					}
-					else {
-						assert(0);  // TODO
-					}
-					glBindTexture(GL_TEXTURE_2D, 0);
-					stbi_image_free(image);
-					textures.insert(std::make_pair(mp->diffuse_texname, texture_id));
-				}
-			}
-		}
+// Creates the framebuffer, vertex array and program of a worker, its context must be current.
+// The outputs of the renderer add the attachments for the depth, normal and barycentric maps.
+// Returns false if a shader can not be read or the framebuffer is incomplete.
+static bool setupGLWorker(GLWorker& worker, const GLRenderer& renderer) {
+	const bool withDepth = renderer.depthOutput;
+	const bool withNormals = renderer.normalOutput;
+	const bool withBarycentrics = renderer.barycentricOutput;
+	// Create and compile our GLSL program from the shaders
+	if (withBarycentrics) {
+		worker.programID = LoadShaders(renderer.vShader.c_str(), renderer.gShader.c_str(), renderer.fShader.c_str(), "#define WITH_BARYCENTRICS");
+	}
+	else {
+		worker.programID = LoadShaders(renderer.vShader.c_str(), renderer.fShader.c_str());
+	}
+	if (worker.programID == 0) {
+		return false;
 	}
 
-	bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<float>::max();
-	bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<float>::max();
-
-	{
-		for (size_t s = 0; s < shapes.size(); s++) {
-			DrawObject o;
+	// Get a handle for our "MVP" uniform
+	worker.MatrixID = glGetUniformLocation(worker.programID, "MVP");
+	worker.MVID = glGetUniformLocation(worker.programID, "MV");
+	worker.PrimitiveOffsetID = glGetUniformLocation(worker.programID, "primitiveOffset");
+	// The face ids of the sorted triangles are bound to texture unit 0.
+	glUseProgram(worker.programID);
+	glUniform1i(glGetUniformLocation(worker.programID, "faceIds"), 0);
 
-			for (size_t f = 0; f < shapes[s].mesh.indices.size() / 3; f++) {
-				tinyobj::index_t idx0 = shapes[s].mesh.indices[3 * f + 0];
-				tinyobj::index_t idx1 = shapes[s].mesh.indices[3 * f + 1];
-				tinyobj::index_t idx2 = shapes[s].mesh.indices[3 * f + 2];
+	// The framebuffer, which regroups 0, 1, or more textures, and 0 or 1 depth buffer.
+	glGenFramebuffers(1, &worker.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, worker.framebuffer);
+	assert(glGetError() == GL_NO_ERROR);
+	// The texture we're going to render to
+	glGenTextures(1, &worker.renderedTexture);
 
-				int current_material_id = shapes[s].mesh.material_ids[f];
+	// "Bind" the newly created texture : all future texture functions will modify this texture
+	glBindTexture(GL_TEXTURE_2D, worker.renderedTexture);
 
-				if ((current_material_id < 0) || (current_material_id >= static_cast<int>(materials.size()))) {
-					// Invaid material ID. Use default material.
-					current_material_id = materials.size() - 1;  // Default material is added to the last item in `materials`.
-				}
+	// Give an empty image to OpenGL ( the last "0" ), one unsigned 32-bit face id per pixel
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, 960, 540, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
 
-				float diffuse[3];
-				for (size_t i = 0; i < 3; i++) {
-					diffuse[i] = materials[current_material_id].diffuse[i];
-				}
+	// Poor filtering. Needed !
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
-				float tc[3][2];
-				
-				if (attrib.texcoords.size() > 0) {
-					if ((idx0.texcoord_index < 0) || (idx1.texcoord_index < 0) || (idx2.texcoord_index < 0)) {
-						// face does not contain valid uv index.
-						tc[0][0] = 0.0f;
-						tc[0][1] = 0.0f;
-						tc[1][0] = 0.0f;
-						tc[1][1] = 0.0f;
-						tc[2][0] = 0.0f;
-						tc[2][1] = 0.0f;
-					}
-					else {
-						assert(attrib.texcoords.size() >
-							size_t(2 * idx0.texcoord_index + 1));
-						assert(attrib.texcoords.size() >
-							size_t(2 * idx1.texcoord_index + 1));
-						assert(attrib.texcoords.size() >
-							size_t(2 * idx2.texcoord_index + 1));
-
-						// Flip Y coord.
-						tc[0][0] = attrib.texcoords[2 * idx0.texcoord_index];
-						tc[0][1] = 1.0f - attrib.texcoords[2 * idx0.texcoord_index + 1];
-						tc[1][0] = attrib.texcoords[2 * idx1.texcoord_index];
-						tc[1][1] = 1.0f - attrib.texcoords[2 * idx1.texcoord_index + 1];
-						tc[2][0] = attrib.texcoords[2 * idx2.texcoord_index];
-						tc[2][1] = 1.0f - attrib.texcoords[2 * idx2.texcoord_index + 1];
-					}
-				}
-				else {
-					tc[0][0] = 0.0f;
-					tc[0][1] = 0.0f;
-					tc[1][0] = 0.0f;
-					tc[1][1] = 0.0f;
-					tc[2][0] = 0.0f;
-					tc[2][1] = 0.0f;
-				}
+	// The depth buffer
+	glGenRenderbuffers(1, &worker.depthRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, worker.depthRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, 960, 540);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, worker.depthRenderbuffer);
+	assert(glGetError() == GL_NO_ERROR);
+	// Set "renderedTexture" as our colour attachement #0
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, worker.renderedTexture, 0);
 
-				float v[3][3];
-				for (int k = 0; k < 3; k++) {
-					int f0 = idx0.vertex_index;
-					int f1 = idx1.vertex_index;
-					int f2 = idx2.vertex_index;
-					assert(f0 >= 0);
-					assert(f1 >= 0);
-					assert(f2 >= 0);
-
-					v[0][k] = attrib.vertices[3 * f0 + k];
-					v[1][k] = attrib.vertices[3 * f1 + k];
-					v[2][k] = attrib.vertices[3 * f2 + k];
-					bmin[k] = std::min(v[0][k], bmin[k]);
-					bmin[k] = std::min(v[1][k], bmin[k]);
-					bmin[k] = std::min(v[2][k], bmin[k]);
-					bmax[k] = std::max(v[0][k], bmax[k]);
-					bmax[k] = std::max(v[1][k], bmax[k]);
-					bmax[k] = std::max(v[2][k], bmax[k]);
-				}
+	// Depth, normals and barycentrics go to outputs 1 to 3 of the fragment shader, which are
+	// dropped when they are not needed. Normals are RGBA, RGB float formats need not be
+	// renderable. The barycentrics are quantized to 16 bits by the normalized format.
+	worker.depthTexture = withDepth ? createAttachment(GL_COLOR_ATTACHMENT1, GL_R32F, GL_RED, GL_FLOAT) : 0;
+	worker.normalTexture = withNormals ? createAttachment(GL_COLOR_ATTACHMENT2, GL_RGBA32F, GL_RGBA, GL_FLOAT) : 0;
+	worker.barycentricTexture = withBarycentrics ? createAttachment(GL_COLOR_ATTACHMENT3, GL_RG16, GL_RG, GL_UNSIGNED_SHORT) : 0;
 
-				float n[3][3];
-				{
-					bool invalid_normal_index = false;
-					if (attrib.normals.size() > 0) {
-						int nf0 = idx0.normal_index;
-						int nf1 = idx1.normal_index;
-						int nf2 = idx2.normal_index;
-
-						if ((nf0 < 0) || (nf1 < 0) || (nf2 < 0)) {
-							// normal index is missing from this face.
-							invalid_normal_index = true;
-						}
-						else {
-							for (int k = 0; k < 3; k++) {
-								assert(size_t(3 * nf0 + k) < attrib.normals.size());
-								assert(size_t(3 * nf1 + k) < attrib.normals.size());
-								assert(size_t(3 * nf2 + k) < attrib.normals.size());
-								n[0][k] = attrib.normals[3 * nf0 + k];
-								n[1][k] = attrib.normals[3 * nf1 + k];
-								n[2][k] = attrib.normals[3 * nf2 + k];
-							}
-						}
-					}
-					else {
-						invalid_normal_index = true;
-					}
-
-					if (invalid_normal_index) {
-						// compute geometric normal
-						CalcNormal(n[0], v[0], v[1], v[2]);
-						n[1][0] = n[0][0];
-						n[1][1] = n[0][1];
-						n[1][2] = n[0][2];
-						n[2][0] = n[0][0];
-						n[2][1] = n[0][1];
-						n[2][2] = n[0][2];
-					}
-				}
+	// Set the list of draw buffers.
+	GLenum DrawBuffers[4] = { GL_COLOR_ATTACHMENT0,
+		GLenum(withDepth ? GL_COLOR_ATTACHMENT1 : GL_NONE),
+		GLenum(withNormals ? GL_COLOR_ATTACHMENT2 : GL_NONE),
+		GLenum(withBarycentrics ? GL_COLOR_ATTACHMENT3 : GL_NONE) };
+	glDrawBuffers(4, DrawBuffers); // "4" is the size of DrawBuffers
 
-				int fr = (1 + f) % 256;
-				int fg = ((1 + f) / 256) % 256;
-				int fb = ((1 + f) / 256 / 256) % 256;
-
-				for (int k = 0; k < 3; k++) {
-					o.vertices.push_back(v[k][0]);
-					o.vertices.push_back(v[k][1]);
-					o.vertices.push_back(v[k][2]);
-					o.normals.push_back(n[k][0]);
-					o.normals.push_back(n[k][1]);
-					o.normals.push_back(n[k][2]);
-					// Combine normal and diffuse to get color.
-					float normal_factor = 0.2;
-					float diffuse_factor = 1 - normal_factor;
-					float c[3] = { n[k][0] * normal_factor + diffuse[0] * diffuse_factor,
-								  n[k][1] * normal_factor + diffuse[1] * diffuse_factor,
-								  n[k][2] * normal_factor + diffuse[2] * diffuse_factor };
-					float len2 = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
-					if (len2 > 0.0f) {
-						float len = sqrtf(len2);
-
-						c[0] /= len;
-						c[1] /= len;
-						c[2] /= len;
-					}
-					o.colors.push_back(c[0] * 0.5 + 0.5);
-					o.colors.push_back(c[1] * 0.5 + 0.5);
-					o.colors.push_back(c[2] * 0.5 + 0.5);
-
-					o.faces.push_back(fr / 256.0);
-					o.faces.push_back(fg / 256.0);
-					o.faces.push_back(fb / 256.0);
-
-					o.uvs.push_back(tc[k][0]);
-					o.uvs.push_back(tc[k][1]);
-				}
+	// Always check that our framebuffer is ok
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		return false;
 
-				// area of triangle 
-				// s = 0.5 * sqrt ( (x2 * y3 - x3 * y2) ^ 2  + (x3 * y1 - x1 * y3) ^ 2 + (x1 * y2 - x2 * y1)  )
-				// A = v[0], B = v[1], C = v[2]
-				// v10 = v[1] - v[0]
-				// v20 = v[2] - v[0]
-				// s = 0.5 * sqrt ( (v10[1] * v20[2] - v10[2] * v20[1]) ^ 2  + (v10[2] * v20[0] - v10[0] * v20[2]) ^ 2 + (v10[0] * v20[1] - v10[1] * v20[0]) )
-				float v10[3], v20[3];
-				v10[0] = v[1][0] - v[0][0];
-				v10[1] = v[1][1] - v[0][1];
-				v10[2] = v[1][2] - v[0][2];
-				v20[0] = v[2][0] - v[0][0];
-				v20[1] = v[2][1] - v[0][1];
-				v20[2] = v[2][2] - v[0][2];
-				;
-				float area = 0.5 * sqrt(pow((v10[1] * v20[2] - v10[2] * v20[1]), 2.f) + pow(v10[2] * v20[0] - v10[0] * v20[2], 2.f) + pow(v10[0] * v20[1] - v10[1] * v20[0], 2.f));
-				o.faceAreas.push_back(area);
-			}
+	glViewport(0, 0, 960, 540); // Render on the whole framebuffer, complete from the lower left corner to the upper right
+	assert(glGetError() == GL_NO_ERROR);
 
-			o.numTriangles = 0;
+	// Enable depth test
+	glEnable(GL_DEPTH_TEST);
+	// Accept fragment if it closer to the camera than the former one
+	glDepthFunc(GL_LESS);
 
-			// OpenGL viewer does not support texturing with per-face material.
-			if (shapes[s].mesh.material_ids.size() > 0 && shapes[s].mesh.material_ids.size() > s) {
-				o.material_id = shapes[s].mesh.material_ids[0];  // use the material ID
-																 // of the first face.
-			}
-			else {
-				o.material_id = materials.size() - 1;  // = ID for default material.
-			}
-			printf("shape[%d] material_id %d\n", int(s), int(o.material_id));
+	// Cull triangles which normal is not towards the camera. The projection renders the image
+	// upside down, which turns the front faces clockwise.
+	glEnable(GL_CULL_FACE);
+	glFrontFace(GL_CW);
+
+	glGenVertexArrays(1, &worker.vertexArray);
+	glBindVertexArray(worker.vertexArray);
+	// first attribute buffer : vertices
+	glEnableVertexAttribArray(0);
+
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	createPackBuffers(worker.packBuffers, sizeof(unsigned int) * 960 * 540);
+	for (int b = 0; b < NUM_PACK_BUFFERS; b++) {
+		worker.depthPackBuffers[b] = 0;
+		worker.normalPackBuffers[b] = 0;
+		worker.barycentricPackBuffers[b] = 0;
+		worker.packFences[b] = 0;
+	}
+	if (withDepth) {
+		createPackBuffers(worker.depthPackBuffers, sizeof(float) * 960 * 540);
+	}
+	if (withNormals) {
+		createPackBuffers(worker.normalPackBuffers, 4 * sizeof(float) * 960 * 540);
+	}
+	if (withBarycentrics) {
+		createPackBuffers(worker.barycentricPackBuffers, 2 * sizeof(unsigned short) * 960 * 540);
+	}
+	worker.nextPackBuffer = 0;
+	assert(glGetError() == GL_NO_ERROR);
+	return true;
+}
 
-			if (o.vertices.size() > 0) {
-				o.numTriangles = o.vertices.size() / 3 ;  // 3:vtx, 3:normal, 3:col, 2:texcoord
-				printf("shape[%d] # of triangles = %d\n", static_cast<int>(s), o.numTriangles);
-			}
+// Points the vertex array and the face id texture of a worker at the buffers of a scene.
+// Texture bindings are not shared between contexts, so every worker binds them itself.
+// Binding 0 releases the buffers of the previous scene.
+static void bindSceneBuffers(GLWorker& worker, GLuint vertexbuffer, GLuint elementbuffer, GLuint faceIdTexture) {
+	glBindVertexArray(worker.vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+	glVertexAttribPointer(
+		0,                  // attribute
+		3,                  // size
+		GL_FLOAT,           // type
+		GL_FALSE,           // normalized?
+		0,                  // stride
+		(void*)0            // array buffer offset
+	);
+	// 3 vertex indices per face, the element buffer binding is stored in the vertex array
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, faceIdTexture);
+	assert(glGetError() == GL_NO_ERROR);
+}
+// Waits for the readback in pack buffer b and hands its face ids to the encoder.
+static void finishReadback(GLWorker& worker, int b, EncodePipeline& encoder) {
+	if (!worker.packFences[b]) {
+		return;
+	}
+	{
+		TRACE_SCOPE("wait for readback");
+		glClientWaitSync(worker.packFences[b], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(worker.packFences[b]);
+		worker.packFences[b] = 0;
+	}
 
-			drawObjects->push_back(o);
+	std::unique_ptr<EncodeJob> job = encoder.acquire();
+	job->frame = worker.packFrames[b];
+	TRACE_SCOPE("copy readback");
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, worker.packBuffers[b]);
+	const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(unsigned int) * 960 * 540, GL_MAP_READ_BIT);
+	// The rows are already top to bottom, see the flipped projection.
+	memcpy(&job->faceIds[0], pixels, sizeof(unsigned int) * 960 * 540);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	if (!job->depth.empty()) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, worker.depthPackBuffers[b]);
+		pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(float) * 960 * 540, GL_MAP_READ_BIT);
+		memcpy(&job->depth[0], pixels, sizeof(float) * 960 * 540);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	if (!job->normals.empty()) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, worker.normalPackBuffers[b]);
+		const float* rgba = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * sizeof(float) * 960 * 540, GL_MAP_READ_BIT);
+		for (size_t p = 0; p < 960 * 540; p++) {
+			job->normals[3 * p] = rgba[4 * p];
+			job->normals[3 * p + 1] = rgba[4 * p + 1];
+			job->normals[3 * p + 2] = rgba[4 * p + 2];
 		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
 	}
+	if (!job->barycentrics.empty()) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, worker.barycentricPackBuffers[b]);
+		pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 2 * sizeof(unsigned short) * 960 * 540, GL_MAP_READ_BIT);
+		memcpy(&job->barycentrics[0], pixels, 2 * sizeof(unsigned short) * 960 * 540);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	encoder.submit(std::move(job));
+}
 
-	printf("bmin = %f, %f, %f\n", bmin[0], bmin[1], bmin[2]);
-	printf("bmax = %f, %f, %f\n", bmax[0], bmax[1], bmax[2]);
-
-	return true;
+// Starts copying one color attachment into a pack buffer.
+static void readAttachment(GLenum attachment, GLuint packBuffer, GLenum format, GLenum type) {
+	glReadBuffer(attachment);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffer);
+	glReadPixels(0, 0, 960, 540, format, type, 0);
 }
 
-void readMatrixFile(const std::string& filePath, float* arrayRef) {
-	std::ifstream infile(filePath);
-	std::string line, strtoken;
-	int arrInd = 0;
-	while (std::getline(infile, line)) {
-		if (line.length() > 0) {
-			std::stringstream linestream(line);
-			for (int i = 0; i < 4; i++) {
-				std::getline(linestream, strtoken, ' ');
-				arrayRef[arrInd++] = std::stof(ltrim(rtrim(strtoken)));
-			}
-		}
+// Starts copying the face ids of the frame just drawn into the next pack buffer, then
+// finishes the readback of the previous frame, which had this frame's draw to complete.
+static void readbackFrame(GLWorker& worker, size_t frame, EncodePipeline& encoder) {
+	const int b = worker.nextPackBuffer;
+	finishReadback(worker, b, encoder);
+	if (worker.depthTexture) {
+		readAttachment(GL_COLOR_ATTACHMENT1, worker.depthPackBuffers[b], GL_RED, GL_FLOAT);
 	}
-	infile.close();
-}
-std::string getBasename(std::string filename) {
-	const size_t last_slash_idx = filename.find_last_of("\\/");
-	if (std::string::npos != last_slash_idx)
-	{
-		filename.erase(0, last_slash_idx + 1);
+	if (worker.normalTexture) {
+		readAttachment(GL_COLOR_ATTACHMENT2, worker.normalPackBuffers[b], GL_RGBA, GL_FLOAT);
 	}
-	const size_t period_idx = filename.find('.');
-	if (std::string::npos != period_idx)
-	{
-		filename.erase(period_idx);
+	if (worker.barycentricTexture) {
+		readAttachment(GL_COLOR_ATTACHMENT3, worker.barycentricPackBuffers[b], GL_RG, GL_UNSIGNED_SHORT);
 	}
-	return filename;
+	readAttachment(GL_COLOR_ATTACHMENT0, worker.packBuffers[b], GL_RED_INTEGER, GL_UNSIGNED_INT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	worker.packFences[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	worker.packFrames[b] = frame;
+	worker.nextPackBuffer = (b + 1) % NUM_PACK_BUFFERS;
+	finishReadback(worker, (b + NUM_PACK_BUFFERS - 1) % NUM_PACK_BUFFERS, encoder);
 }
 
-int main(int argc, char** argv) {
-	//std::string objFile = "D:\\nihalsid\\Label23D\\server\\static\\test\\cube.obj";
-	std::string rootDir = argv[1];
-	std::string shaderDir = argv[2];
-	std::string vShader = shaderDir + "\\TransformVertexShader.vertexshader";
-	std::string fShader = shaderDir + "\\TextureFragmentShader.fragmentshader";
-	std::string objFile = rootDir + "\\mesh\\mesh.refined.obj";
-	std::vector<std::string> cam2WorldMatrixFiles; 
-	std::vector<std::string> faceMapFiles;
-	std::string faceAreasFile = rootDir + "\\face_maps\\areas.txt";
-	for (const auto & entry : std::experimental::filesystem::directory_iterator(rootDir + "\\color\\")) {
-		std::string basename = getBasename(entry.path().string());
-		cam2WorldMatrixFiles.push_back(rootDir + "\\pose\\" + basename + ".pose.txt");
-		faceMapFiles.push_back(rootDir + "\\face_maps\\" + basename + ".facemap.png");
-	}
-	std::string camIntrinsicsFile = rootDir + "\\camera\\intrinsic_color.txt";
-
-
-	// Initialise GLFW
-	if (!glfwInit())
-	{
-		fprintf(stderr, "Failed to initialize GLFW\n");
-		getchar();
-		return -1;
+// Hands the frames still in the pack buffers to the encoder, oldest first.
+static void flushReadbacks(GLWorker& worker, EncodePipeline& encoder) {
+	for (int k = 0; k < NUM_PACK_BUFFERS; k++) {
+		finishReadback(worker, (worker.nextPackBuffer + k) % NUM_PACK_BUFFERS, encoder);
 	}
+}
 
-	glfwWindowHint(GLFW_SAMPLES, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_VISIBLE, 0);
+static void destroyGLWorker(GLWorker& worker) {
+	glDeleteProgram(worker.programID);
+	glDeleteBuffers(NUM_PACK_BUFFERS, worker.packBuffers);
+	glDeleteBuffers(NUM_PACK_BUFFERS, worker.depthPackBuffers);
+	glDeleteBuffers(NUM_PACK_BUFFERS, worker.normalPackBuffers);
+	glDeleteBuffers(NUM_PACK_BUFFERS, worker.barycentricPackBuffers);
+	glDeleteVertexArrays(1, &worker.vertexArray);
+	glDeleteRenderbuffers(1, &worker.depthRenderbuffer);
+	glDeleteTextures(1, &worker.renderedTexture);
+	glDeleteTextures(1, &worker.depthTexture);
+	glDeleteTextures(1, &worker.normalTexture);
+	glDeleteTextures(1, &worker.barycentricTexture);
+	glDeleteFramebuffers(1, &worker.framebuffer);
 	assert(glGetError() == GL_NO_ERROR);
+}
 
-	// Open a window and create its OpenGL context
-	window = glfwCreateWindow(960, 540, "MeshPoseVisualization", NULL, NULL);
-	if (window == NULL) {
-		fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
-		getchar();
-		glfwTerminate();
-		return -1;
+
+// Creates the main context, it uploads the meshes that the worker contexts share. Without
+// --context the headless backends are tried before GLFW, which needs a window system.
+static bool createGLRenderer(GLRenderer& renderer, const std::string& contextName, GLContextBackend requestedContext, int numThreads) {
+	auto contextStartTime = std::chrono::steady_clock::now();
+	std::vector<GLContextBackend> contextBackends;
+	if (contextName == "auto") {
+		contextBackends = getAvailableGLContextBackends();
 	}
-	glfwMakeContextCurrent(window);
+	else {
+		contextBackends.push_back(requestedContext);
+	}
+	GLContext& mainContext = renderer.mainContext;
+	bool haveContext = false;
+	for (size_t b = 0; b < contextBackends.size() && !haveContext; b++) {
+		if (!initGLContextBackend(contextBackends[b])) {
+			continue;
+		}
+		haveContext = mainContext.create(contextBackends[b], NULL) && mainContext.makeCurrent();
+		if (!haveContext) {
+			fprintf(stderr, "Failed to create an OpenGL 3.3 core context with %s\n", getGLContextBackendName(contextBackends[b]));
+			mainContext.destroy();
+			terminateGLContextBackend(contextBackends[b]);
+		}
+	}
+	if (!haveContext) {
+		fprintf(stderr, "No OpenGL context could be created. If you have an Intel GPU, they are not 3.3 compatible.\n");
+		return false;
+	}
+	const GLContextBackend contextBackend = mainContext.getBackend();
 
 	// Initialize GLEW
 	glewExperimental = true; // Needed for core profile
-	if (glewInit() != GLEW_OK) {
+	GLenum glewError = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// The functions are loaded before GLEW looks for GLX extensions, which headless contexts do not have.
+	if (glewError == GLEW_ERROR_NO_GLX_DISPLAY && contextBackend != GLContextBackend::GLFW) {
+		glewError = GLEW_OK;
+	}
+#endif
+	if (glewError != GLEW_OK) {
 		fprintf(stderr, "Failed to initialize GLEW\n");
-		getchar();
-		glfwTerminate();
-		return -1;
+		return false;
 	}
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &renderer.maxTextureBufferSize);
+
+	// One context per worker, sharing objects with the main context.
+	// GLFW only allows creating windows on the main thread.
+	renderer.workers = std::vector<GLWorker>(numThreads);
+	for (int w = 0; w < numThreads; w++) {
+		renderer.workers[w].ready = false;
+		if (!renderer.workers[w].context.create(contextBackend, &mainContext)) {
+			fprintf(stderr, "Failed to create the %s context of render worker %d\n", getGLContextBackendName(contextBackend), w);
+			return false;
+		}
+	}
+	renderer.workerError = false;
+	printf("Created %d %s contexts in %.1f ms\n", numThreads + 1, getGLContextBackendName(contextBackend),
+		1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - contextStartTime).count());
+	return true;
+}
 
-	// Ensure we can capture the escape key being pressed below
-	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
-	// Hide the mouse and enable unlimited mouvement
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+static void destroyGLRenderer(GLRenderer& renderer) {
+	if (!renderer.mainContext.makeCurrent()) {
+		return;
+	}
+	const GLContextBackend contextBackend = renderer.mainContext.getBackend();
+	for (size_t w = 0; w < renderer.workers.size(); w++) {
+		if (renderer.workers[w].ready && renderer.workers[w].context.makeCurrent()) {
+			destroyGLWorker(renderer.workers[w]);
+			renderer.workers[w].context.releaseCurrent();
+		}
+		renderer.workers[w].context.destroy();
+	}
+	renderer.workers.clear();
+	renderer.mainContext.destroy();
+	terminateGLContextBackend(contextBackend);
+}
 
-	// Set the mouse at the center of the screen
-	glfwPollEvents();
-	glfwSetCursorPos(window, 960 / 2, 540 / 2);
+// Buffers of the mesh of a scene, created in the main context and shared with the workers.
+struct SceneBuffers {
+	GLuint vertexbuffer;
+	GLuint elementbuffer;
+	GLuint faceIdBuffer;
+	GLuint faceIdTexture;
+};
+
+static void uploadSceneBuffers(const DrawObject& object, const SceneMesh& mesh, SceneBuffers& buffers) {
+	// Reordered triangles index the renumbered vertices.
+	const std::vector<float>& vertices = mesh.reordered ? mesh.orderedVertices : object.vertices;
+	glGenBuffers(1, &buffers.vertexbuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexbuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
+	assert(glGetError() == GL_NO_ERROR);
 
-	// The framebuffer, which regroups 0, 1, or more textures, and 0 or 1 depth buffer.
-	GLuint FramebufferName = 0;
-	glGenFramebuffers(1, &FramebufferName);
-	glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
+	// The element buffer holds the triangles sorted into clusters, the shader looks up their
+	// original face ids in a buffer texture.
+	glGenBuffers(1, &buffers.elementbuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.elementbuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.sortedIndices.size() * sizeof(unsigned int), mesh.sortedIndices.empty() ? NULL : &mesh.sortedIndices[0], GL_STATIC_DRAW);
 	assert(glGetError() == GL_NO_ERROR);
-	// The texture we're going to render to
-	GLuint renderedTexture;
-	glGenTextures(1, &renderedTexture);
 
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, renderedTexture);
+	glGenBuffers(1, &buffers.faceIdBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers.faceIdBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, mesh.clusterFaceIds.size() * sizeof(unsigned int), mesh.clusterFaceIds.empty() ? NULL : &mesh.clusterFaceIds[0], GL_STATIC_DRAW);
+	glGenTextures(1, &buffers.faceIdTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, buffers.faceIdTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, buffers.faceIdBuffer);
+	assert(glGetError() == GL_NO_ERROR);
+}
 
-	// Give an empty image to OpenGL ( the last "0" )
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 960, 540, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+static void deleteSceneBuffers(SceneBuffers& buffers) {
+	glDeleteBuffers(1, &buffers.vertexbuffer);
+	glDeleteBuffers(1, &buffers.elementbuffer);
+	glDeleteTextures(1, &buffers.faceIdTexture);
+	glDeleteBuffers(1, &buffers.faceIdBuffer);
+	assert(glGetError() == GL_NO_ERROR);
+}
 
-	// Poor filtering. Needed !
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+// Reads the intrinsics of a scene. OpenGL stores the bottom row first. Mirroring y in the
+// projection renders the image upside down, so the rows read back are already in the top to
+// bottom order of the face maps.
+static bool readGLProjection(const ScenePaths& scene, glm::mat4& ProjectionMatrix) {
+	float camIntrinsicRowMajor[16];
+	if (!readMatrixFile(scene.camIntrinsicsFile, camIntrinsicRowMajor)) {
+		fprintf(stderr, "Unable to read the intrinsics %s\n", scene.camIntrinsicsFile.c_str());
+		return false;
+	}
+	ProjectionMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f)) *
+		computeProjectionMatrix(camIntrinsicRowMajor[0], camIntrinsicRowMajor[5], camIntrinsicRowMajor[2], camIntrinsicRowMajor[6], 960, 540);
+	return true;
+}
 
-	// The depth buffer
-	GLuint depthrenderbuffer;
-	glGenRenderbuffers(1, &depthrenderbuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, 960, 540);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
+// Clears the framebuffer of a worker and draws the clusters of the mesh in view of MVP, or the
+// whole mesh without frustum culling. MV is the view matrix, for depth and normals.
+static void drawFrame(GLWorker& worker, const SceneMesh& mesh, bool frustumCulling, const glm::mat4& MVP, const glm::mat4& MV) {
+	TRACE_SCOPE("draw");
+	// Clear the screen, face id 0 is the background, and so are 0 in the other outputs
+	const GLuint clearFaceId[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, clearFaceId);
+	const GLfloat clearValue[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	if (worker.depthTexture) {
+		glClearBufferfv(GL_COLOR, 1, clearValue);
+	}
+	if (worker.normalTexture) {
+		glClearBufferfv(GL_COLOR, 2, clearValue);
+	}
+	if (worker.barycentricTexture) {
+		glClearBufferfv(GL_COLOR, 3, clearValue);
+	}
+	glClear(GL_DEPTH_BUFFER_BIT);
 	assert(glGetError() == GL_NO_ERROR);
-	// Set "renderedTexture" as our colour attachement #0
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
+	// Use our shader
+	glUseProgram(worker.programID);
+
+	// Send our transformation to the currently bound shader, 
+	// in the "MVP" uniform
+	glUniformMatrix4fv(worker.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+	glUniformMatrix4fv(worker.MVID, 1, GL_FALSE, &MV[0][0]);
+
+	// Draw the clusters in view. gl_PrimitiveID restarts at 0 in every draw call, the
+	// offset of the range makes it the index of the triangle in the element buffer.
+	worker.visibleRanges.clear();
+	if (frustumCulling) {
+		mesh.bvh.cullFrustum(MVP, worker.visibleRanges);
+	}
+	else {
+		FaceRange all = { 0, (unsigned int)mesh.drawObjects[0].numTriangles };
+		worker.visibleRanges.push_back(all);
+	}
+	for (size_t r = 0; r < worker.visibleRanges.size(); r++) {
+		const FaceRange& range = worker.visibleRanges[r];
+		glUniform1i(worker.PrimitiveOffsetID, range.first);
+		glDrawElements(GL_TRIANGLES, 3 * range.count, GL_UNSIGNED_INT, (void*)(size_t(range.first) * 3 * sizeof(unsigned int)));
+		worker.drawnFaces += range.count;
+	}
+	assert(glGetError() == GL_NO_ERROR);
+}
 
-	// Set the list of draw buffers.
-	GLenum DrawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
-	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
-	
-	// Always check that our framebuffer is ok
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+// Whether the face ids of the mesh fit into the buffer texture the shader looks them up in.
+// Beyond the limit of the driver texelFetch returns 0, so faces would turn into background.
+static bool fitsFaceIdTexture(const GLRenderer& renderer, const SceneMesh& mesh) {
+	return mesh.clusterFaceIds.size() <= size_t(renderer.maxTextureBufferSize);
+}
+
+// Uploads the mesh of a scene to the main context and renders its frames on the workers.
+static bool renderSceneOnGL(GLRenderer& renderer, const ScenePaths& scene, SceneMesh& mesh, const PoseSet& poses, const RunOptions& options, SceneRenderState& state) {
+	const DrawObject& object = mesh.drawObjects[0];
+	std::vector<GLWorker>& workers = renderer.workers;
+	if (state.needsFaceAttributes()) {
+		writeFaceAttributeFiles(scene, mesh, options);
+	}
+	VisibilityCollector& visibility = state.prepareVisibility(object.faceAreas.size());
+	const std::vector<size_t>& frames = state.getRenderFrames();
+	std::unique_ptr<FaceMapArchiveWriter> archive;
+	if (!state.begin() || !openFaceMapArchive(options, scene, archive)) {
 		return false;
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-	glViewport(0, 0, 960, 540); // Render on the whole framebuffer, complete from the lower left corner to the upper right
-	assert(glGetError() == GL_NO_ERROR);
-	// null background
-	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	}
+	glm::mat4 ProjectionMatrix;
+	if (!readGLProjection(scene, ProjectionMatrix)) {
+		return false;
+	}
+	renderer.mainContext.makeCurrent();
+	printf("Sorted %d faces into %d clusters in %.1f ms\n", object.numTriangles, int(mesh.bvh.getNumClusters()), 1000.0 * mesh.clusterSeconds);
+	printMeshOrder(mesh);
 
-	// Enable depth test
-	glEnable(GL_DEPTH_TEST);
-	// Accept fragment if it closer to the camera than the former one
-	glDepthFunc(GL_LESS);
+	SceneBuffers buffers;
+	{
+		TRACE_SCOPE("upload mesh");
+		uploadSceneBuffers(object, mesh, buffers);
+		// Make the uploads visible to the shared contexts before the workers take over.
+		glFinish();
+	}
+	std::vector<unsigned int>().swap(mesh.sortedIndices);
+	std::vector<unsigned int>().swap(mesh.clusterFaceIds);
+	std::vector<float>().swap(mesh.orderedVertices);
+	renderer.mainContext.releaseCurrent();
+
+	FrameScheduler scheduler(int(workers.size()));
+	std::unique_ptr<ColorFusion> fusion(options.fuseColors ? new ColorFusion(object, poses, scene.colorFiles) : NULL);
+	std::unique_ptr<EncodePipeline> encoder = createFaceMapEncoder(options, scene, object.faceAreas.size(), visibility, state, fusion.get(), archive.get());
+	std::atomic<bool> setupError(false);
+	auto startTime = std::chrono::steady_clock::now();
+	scheduler.run(frames.size(),
+		[&](int w) {
+			setTraceThreadName("render worker " + std::to_string(w));
+			GLWorker& worker = workers[w];
+			worker.context.makeCurrent();
+			if (!worker.ready) {
+				worker.ready = true;
+				if (!setupGLWorker(worker, renderer)) {
+					fprintf(stderr, "Unable to set up render worker %d\n", w);
+					setupError = true;
+				}
+			}
+			bindSceneBuffers(worker, buffers.vertexbuffer, buffers.elementbuffer, buffers.faceIdTexture);
+			worker.drawnFaces = 0;
+		},
+		[&](size_t i, int w) {
+			if (setupError) {
+				return;
+			}
+			GLWorker& worker = workers[w];
+			const size_t frame = frames[i];
+			glm::mat4 ViewMatrix = computeViewMatrix(poses.get(frame));
+			glm::mat4 ModelMatrix = glm::mat4(1.0);
+			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+			drawFrame(worker, mesh, renderer.frustumCulling, MVP, ViewMatrix * ModelMatrix);
+			readbackFrame(worker, frame, *encoder);
+		},
+		[&](int w) {
+			if (!setupError) {
+				flushReadbacks(workers[w], *encoder);
+			}
+			bindSceneBuffers(workers[w], 0, 0, 0);
+			workers[w].context.releaseCurrent();
+		});
+	encoder->finish();
+	printRunStats(frames.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count(), scheduler);
+	encoder->printStats();
+	size_t drawnFaces = 0;
+	for (size_t w = 0; w < workers.size(); w++) {
+		drawnFaces += workers[w].drawnFaces;
+	}
+	if (!frames.empty() && object.numTriangles > 0) {
+		printf("Drew %.1f%% of the faces per frame on average\n", 100.0 * drawnFaces / (double(frames.size()) * object.numTriangles));
+	}
+	const bool finished = !setupError && finishScene(scene, visibility, state, fusion.get(), archive.get());
 
-	// Cull triangles which normal is not towards the camera
-	glEnable(GL_CULL_FACE);
+	// Cleanup VBO
+	renderer.mainContext.makeCurrent();
+	deleteSceneBuffers(buffers);
+	if (setupError) {
+		renderer.workerError = true;
+	}
+	return finished;
+}
 
-	// Shade model flat for no interpolation
-	glShadeModel(GL_FLAT);
+// Writes the trace of the run and prints its summary, if --trace was given.
+static void finishTracing(const std::string& traceFile) {
+	if (traceFile.empty()) {
+		return;
+	}
+	if (writeTrace(traceFile)) {
+		printf("Wrote the trace to %s\n", traceFile.c_str());
+	}
+	printTraceSummary();
+}
 
-	GLuint VertexArrayID;
-	glGenVertexArrays(1, &VertexArrayID);
-	glBindVertexArray(VertexArrayID);
+// A scene whose poses, render state and mesh were prepared on the prefetch thread.
+struct PreparedScene {
+	PoseSet poses;
+	SceneRenderState state;
+	std::unique_ptr<SceneMesh> mesh; // null if no frame has to be rendered or loading failed
+};
+
+// Loads the poses, plans the frames to render and loads the mesh if it is needed. Only touches
+// the given scene, so it can run on a background thread. Returns null if the poses can not be read.
+static std::unique_ptr<PreparedScene> prepareScene(const ScenePaths& scene, const RunOptions& options) {
+	std::unique_ptr<PreparedScene> prepared(new PreparedScene());
+	if (!loadScenePoses(scene, prepared->poses)) {
+		prepared.reset();
+		return prepared;
+	}
+	prepared->state.plan(scene, prepared->poses, options);
+	if (prepared->state.needsMesh()) {
+		prepared->mesh.reset(new SceneMesh());
+		if (!loadSceneMesh(scene.meshFile, options.backend == "gl", options.reorderTriangles, *prepared->mesh)) {
+			prepared->mesh.reset();
+		}
+	}
+	return prepared;
+}
 
-	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders(vShader.c_str(), fShader.c_str());
+static std::unique_ptr<PreparedScene> prefetchScene(const ScenePaths& scene, const RunOptions& options) {
+	setTraceThreadName("scene prefetch");
+	return prepareScene(scene, options);
+}
 
-	// Get a handle for our "MVP" uniform
-	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
+// Renders the frames of a prepared scene with the backend of options.
+static bool renderPreparedScene(GLRenderer& renderer, const ScenePaths& scene, PreparedScene& prepared, const RunOptions& options) {
+	if (prepared.state.needsMesh() && !prepared.mesh) {
+		fprintf(stderr, "Unable to load the mesh %s\n", scene.meshFile.c_str());
+		return false;
+	}
+	if (!prepared.mesh) {
+		return updateUnchangedScene(scene, prepared.state);
+	}
+	if (options.backend == "gl" && !fitsFaceIdTexture(renderer, *prepared.mesh)) {
+		fprintf(stderr, "The mesh has %d faces, but the OpenGL driver looks up at most %d face ids, rendering %s with the CPU backend\n",
+			int(prepared.mesh->clusterFaceIds.size()), int(renderer.maxTextureBufferSize), scene.rootDir.c_str());
+		return renderSceneOnCPU(scene, *prepared.mesh, prepared.poses, options, prepared.state);
+	}
+	return options.backend == "cpu" ? renderSceneOnCPU(scene, *prepared.mesh, prepared.poses, options, prepared.state) :
+		renderSceneOnGL(renderer, scene, *prepared.mesh, prepared.poses, options, prepared.state);
+}
 
-	// Get a handle for our "myTextureSampler" uniform
-	GLuint TextureID = glGetUniformLocation(programID, "myTextureSampler");
+// Times the OpenGL stages of a scene on the first render worker, without the encoder: the upload
+// of the mesh, and per frame the draw and the readback into client memory. The draws are timed
+// again with reordered triangles (gl_draw_reordered). Every stage is waited for with glFinish,
+// so the GPU time is included.
+static bool benchmarkGLStages(GLRenderer& renderer, const ScenePaths& scene, int numRuns, BenchmarkReport& report) {
+	PoseSet poses;
+	glm::mat4 ProjectionMatrix;
+	if (!loadScenePoses(scene, poses) || !readGLProjection(scene, ProjectionMatrix)) {
+		return false;
+	}
+	GLWorker& worker = renderer.workers[0];
+	worker.context.makeCurrent();
+	if (!worker.ready) {
+		worker.ready = true;
+		if (!setupGLWorker(worker, renderer)) {
+			fprintf(stderr, "Unable to set up render worker 0\n");
+			renderer.workerError = true;
+			worker.context.releaseCurrent();
+			return false;
+		}
+	}
+	for (int reordered = 0; reordered < 2; reordered++) {
+		SceneMesh mesh;
+		if (!loadSceneMesh(scene.meshFile, true, reordered != 0, mesh)) {
+			worker.context.releaseCurrent();
+			return false;
+		}
+		printMeshOrder(mesh);
+		if (!fitsFaceIdTexture(renderer, mesh)) {
+			fprintf(stderr, "The mesh has %d faces, but the OpenGL driver looks up at most %d face ids\n",
+				int(mesh.clusterFaceIds.size()), int(renderer.maxTextureBufferSize));
+			worker.context.releaseCurrent();
+			return false;
+		}
+		const DrawObject& object = mesh.drawObjects[0];
+		const size_t numFaces = object.faceAreas.size();
+		SceneBuffers buffers;
+		const int numUploads = reordered ? 1 : numRuns;
+		for (int r = 0; r < numUploads; r++) {
+			auto start = std::chrono::steady_clock::now();
+			uploadSceneBuffers(object, mesh, buffers);
+			glFinish();
+			if (!reordered) {
+				report.add("gl_upload", numFaces, "faces", double(numFaces), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			}
+			if (r + 1 < numUploads) {
+				deleteSceneBuffers(buffers);
+			}
+		}
+		bindSceneBuffers(worker, buffers.vertexbuffer, buffers.elementbuffer, buffers.faceIdTexture);
+		worker.drawnFaces = 0;
+		std::vector<unsigned int> faceIds(960 * 540);
+		for (size_t f = 0; f < poses.size(); f++) {
+			if (!poses.isValid(f)) {
+				continue;
+			}
+			const glm::mat4 ViewMatrix = computeViewMatrix(poses.get(f));
+			const glm::mat4 MVP = ProjectionMatrix * ViewMatrix;
+			auto start = std::chrono::steady_clock::now();
+			drawFrame(worker, mesh, renderer.frustumCulling, MVP, ViewMatrix);
+			glFinish();
+			auto drawn = std::chrono::steady_clock::now();
+			glReadPixels(0, 0, 960, 540, GL_RED_INTEGER, GL_UNSIGNED_INT, &faceIds[0]);
+			report.add(reordered ? "gl_draw_reordered" : "gl_draw", numFaces, "frames", 1.0, std::chrono::duration<double>(drawn - start).count());
+			if (!reordered) {
+				report.add("gl_readback", numFaces, "frames", 1.0, std::chrono::duration<double>(std::chrono::steady_clock::now() - drawn).count());
+			}
+		}
+		bindSceneBuffers(worker, 0, 0, 0);
+		deleteSceneBuffers(buffers);
+	}
+	worker.context.releaseCurrent();
+	return true;
+}
 
-	std::vector<DrawObject> drawObjects;
-	std::map<std::string, GLuint> textures;
-	std::vector<tinyobj::material_t> materials;
-	float bmin[3], bmax[3];
-	LoadObjAndConvert(bmin, bmax, &drawObjects, materials, textures, objFile.c_str());
+// Settings of --benchmark-suite.
+struct BenchmarkOptions {
+	std::string workDir;
+	std::vector<size_t> meshFaces;
+	size_t numFrames;
+	int numRuns;
+};
+
+// Generates a synthetic scene for every mesh size in the work directory, times every stage in
+// isolation and the whole pipeline of each backend, and writes workDir\benchmark.json (see
+// BenchmarkReport). The OpenGL stages only run if a context can be created; with OSMesa they
+// run on the CPU as well.
+static bool runBenchmarkSuite(const BenchmarkOptions& benchmark, const RunOptions& options, const std::string& shaderDir,
+	const std::string& contextName, GLContextBackend requestedContext, bool frustumCulling) {
+	// The same defaults as for rendering, per backend.
+	RunOptions cpuOptions = options;
+	cpuOptions.backend = "cpu";
+	cpuOptions.incremental = false;
+	if (cpuOptions.numThreads <= 0) {
+		cpuOptions.numThreads = getHardwareThreadCount();
+	}
+	if (cpuOptions.encodeThreads <= 0) {
+		cpuOptions.encodeThreads = getHardwareThreadCount();
+	}
+	RunOptions glOptions = cpuOptions;
+	glOptions.backend = "gl";
+	glOptions.numThreads = options.numThreads > 0 ? options.numThreads : std::min(4, getHardwareThreadCount());
+
+	GLRenderer renderer;
+	bool haveGL = false;
+	if (!shaderDir.empty()) {
+		renderer.vShader = shaderDir + PATH_SEPARATOR "TransformVertexShader.vertexshader";
+		renderer.gShader = shaderDir + PATH_SEPARATOR "BarycentricGeometryShader.geometryshader";
+		renderer.fShader = shaderDir + PATH_SEPARATOR "TextureFragmentShader.fragmentshader";
+		renderer.frustumCulling = frustumCulling;
+		renderer.depthOutput = options.depthFormat != "none";
+		renderer.normalOutput = options.normalFormat != "none";
+		renderer.barycentricOutput = options.barycentricFormat != "none";
+		haveGL = createGLRenderer(renderer, contextName, requestedContext, glOptions.numThreads);
+		if (!haveGL) {
+			destroyGLRenderer(renderer);
+			fprintf(stderr, "Benchmarking the CPU backend only\n");
+		}
+	}
 
-	GLuint vertexbuffer;
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, drawObjects[0].vertices.size() * sizeof(float), &drawObjects[0].vertices[0], GL_STATIC_DRAW);
-	assert(glGetError() == GL_NO_ERROR);
-	/*
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, drawObjects[0].uvs.size() * sizeof(float), &drawObjects[0].uvs[0], GL_STATIC_DRAW);
-	*/
-
-	GLuint colorbuffer;
-	glGenBuffers(1, &colorbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-	glBufferData(GL_ARRAY_BUFFER, drawObjects[0].faces.size() * sizeof(float), &drawObjects[0].faces[0], GL_STATIC_DRAW);
-
-	std::ofstream areasStream(faceAreasFile);
-	for (int i = 0; i < drawObjects[0].faceAreas.size(); i++) {
-		areasStream << drawObjects[0].faceAreas[i] << "\n";
-	}
-	areasStream.close();
-
-	float cam2WorldRowMajor[16], camIntrinsicRowMajor[16];
-	readMatrixFile(camIntrinsicsFile, camIntrinsicRowMajor);
-	setProjectionMatrix(camIntrinsicRowMajor[0], camIntrinsicRowMajor[5], camIntrinsicRowMajor[2], camIntrinsicRowMajor[6], 960, 540);
-
-	for (int i = 0; i < cam2WorldMatrixFiles.size(); i++) {
-
-		readMatrixFile(cam2WorldMatrixFiles[i], cam2WorldRowMajor);
-		setViewMatrix(cam2WorldRowMajor);
-
-		// Clear the screen
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		assert(glGetError() == GL_NO_ERROR);
-		// Use our shader
-		glUseProgram(programID);
-
-		// Compute the MVP matrix from keyboard and mouse input
-		//computeMatricesFromInputs();
-		glm::mat4 ProjectionMatrix = getProjectionMatrix();
-		glm::mat4 ViewMatrix = getViewMatrix();
-		glm::mat4 ModelMatrix = glm::mat4(1.0);
-		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-		// Bind our texture in Texture Unit 0
-		// glActiveTexture(GL_TEXTURE0);
-		// glBindTexture(GL_TEXTURE_2D, textures[materials[drawObjects[0].material_id].diffuse_texname]);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		// glUniform1i(TextureID, 0);
-
-		// first attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-		assert(glGetError() == GL_NO_ERROR);
-		// 2nd attribute buffer : colors
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// Draw the triangle !
-		glDrawArrays(GL_TRIANGLES, 0, drawObjects[0].numTriangles);
-		assert(glGetError() == GL_NO_ERROR);
-		unsigned char* image = (unsigned char*)malloc(sizeof(unsigned char) * 960 * 540 * 3);
-		//glReadPixels(0, 0, 960, 540, GL_RGB, GL_UNSIGNED_BYTE, image);
-		glGetTextureImage(renderedTexture, 0, GL_RGB, GL_UNSIGNED_BYTE, sizeof(unsigned char) * 960 * 540 * 3, image);
-		for (int r_idx = 0; r_idx < 540 / 2; r_idx++) {
-			for (int c_idx = 0; c_idx < 960; c_idx++) {
-				swap(image[(r_idx * 960 + c_idx) * 3 + 0], image[((540 - r_idx - 1) * 960 + c_idx) * 3 + 0]);
-				swap(image[(r_idx * 960 + c_idx) * 3 + 1], image[((540 - r_idx - 1) * 960 + c_idx) * 3 + 1]);
-				swap(image[(r_idx * 960 + c_idx) * 3 + 2], image[((540 - r_idx - 1) * 960 + c_idx) * 3 + 2]);
+	BenchmarkReport report;
+	bool ok = true;
+	for (size_t m = 0; m < benchmark.meshFaces.size() && ok; m++) {
+		const std::string rootDir = benchmark.workDir + PATH_SEPARATOR "synthetic_" + std::to_string((unsigned long long)benchmark.meshFaces[m]);
+		auto startTime = std::chrono::steady_clock::now();
+		ScenePaths scene;
+		ok = generateSyntheticScene(rootDir, benchmark.meshFaces[m], benchmark.numFrames) && collectScenePaths(rootDir, "", scene);
+		if (!ok) {
+			break;
+		}
+		printf("Generated %s in %.2f s\n", rootDir.c_str(), std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+		ok = benchmarkSceneStages(scene, cpuOptions.numThreads, benchmark.numRuns, report);
+		if (ok && haveGL) {
+			ok = benchmarkGLStages(renderer, scene, benchmark.numRuns, report);
+		}
+
+		// End to end: poses, mesh from the cache, rendering, encoding and visibility.bin.
+		for (int b = 0; b < (haveGL ? 2 : 1) && ok; b++) {
+			const RunOptions& runOptions = b == 0 ? cpuOptions : glOptions;
+			for (int r = 0; r < benchmark.numRuns && ok; r++) {
+				auto start = std::chrono::steady_clock::now();
+				std::unique_ptr<PreparedScene> prepared = prepareScene(scene, runOptions);
+				ok = prepared && renderPreparedScene(renderer, scene, *prepared, runOptions);
+				if (ok) {
+					const size_t numFaces = prepared->state.getNumFaces();
+					report.add(runOptions.backend + "_end_to_end", numFaces, "frames", double(prepared->state.getRenderFrames().size()),
+						std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+				}
 			}
 		}
-		stbi_write_png(faceMapFiles[i].c_str(), 960, 540, 3, image, 960 * 3);
-		free(image);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		assert(glGetError() == GL_NO_ERROR);
-		// Swap buffers
-		glfwSwapBuffers(window);
-		glfwPollEvents();
-	} 
-	// Cleanup VBO and shader
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &colorbuffer);
-	glDeleteProgram(programID);
-	glDeleteTextures(1, &textures[materials[drawObjects[0].material_id].name]);
-	glDeleteVertexArrays(1, &VertexArrayID);
-	assert(glGetError() == GL_NO_ERROR);
+	}
+	if (haveGL) {
+		destroyGLRenderer(renderer);
+	}
+	report.print();
+	return report.write(benchmark.workDir + PATH_SEPARATOR "benchmark.json", cpuOptions.numThreads, benchmark.numFrames) && ok;
+}
+
+static void printUsage(const char* program) {
+	fprintf(stderr, "Usage: %s rootDir shaderDir [options]\n", program);
+	fprintf(stderr, "       %s --batch manifest shaderDir [options]\n", program);
+	fprintf(stderr, "       %s --benchmark-suite workDir [shaderDir] [options]\n", program);
+	fprintf(stderr, "The mesh is rootDir/mesh/mesh.refined.obj, or mesh.refined.ply if there is no OBJ file.\n"
+		"The shader directory is only needed by the OpenGL backend.\n"
+		"  --backend gl|cpu              render with OpenGL or the software rasterizer\n"
+		"  --threads N                   frames rendered in parallel\n"
+		"  --render-threads N            threads of each software rasterizer\n"
+		"  --encode-threads N            threads compressing and writing the maps\n"
+		"  --id-format raw|png|rle|both  face map formats, combinable as a list like png,rle\n"
+		"  --mesh file                   render another OBJ or binary PLY file\n"
+		"  --context auto|egl|osmesa|glfw  how OpenGL contexts are created, auto takes the first that works\n"
+		"  --no-culling                  draw the whole mesh for every frame\n"
+		"  --incremental                 only render frames whose pose or face maps changed\n"
+		"  --face-attributes text|binary|both  write areas.txt, face_attributes.bin or both\n"
+		"  --depth none|raw              write a depth map per frame\n"
+		"  --normals none|png|raw        write a normal map per frame\n"
+		"  --barycentrics none|raw       write the barycentric coordinates per frame\n"
+		"  --fuse-colors                 fuse the color frames into face_maps/mesh.colored.ply,\n"
+		"                                not combinable with the other maps\n"
+		"  --archive                     write the face maps of a scene to face_maps/facemaps.fmar\n"
+		"  --reorder-triangles           draw in vertex cache friendly order and print the ACMR\n"
+		"  --trace file.json             write a Chrome trace of all threads\n"
+		"  --benchmark-loader            time the OBJ loaders on the mesh of rootDir\n"
+		"  --batch manifest              render every scene directory listed in the manifest\n"
+		"  --benchmark-suite workDir     time every stage on synthetic scenes in workDir\n"
+		"  --benchmark-faces N,N,...     mesh sizes of the benchmark scenes\n"
+		"  --benchmark-frames N          frames per benchmark scene\n"
+		"  --benchmark-runs N            repetitions of the whole-mesh stages and end to end runs\n");
 }
 
+int main(int argc, char** argv) {
+	std::vector<std::string> positionalArgs;
+	RunOptions options;
+	options.backend = "gl";
+	options.numThreads = 0;
+	options.renderThreads = 0;
+	options.encodeThreads = 0;
+	options.idFormat = "raw";
+	options.incremental = false;
+	options.faceAttributes = "both";
+	options.depthFormat = "none";
+	options.normalFormat = "none";
+	options.barycentricFormat = "none";
+	options.fuseColors = false;
+	options.archive = false;
+	options.reorderTriangles = false;
+	bool benchmarkLoader = false;
+	BenchmarkOptions benchmark;
+	benchmark.numFrames = 60;
+	benchmark.numRuns = 3;
+	std::string benchmarkFaces = "10000,100000,1000000";
+	std::string traceFile;
+	std::string meshFile;
+	std::string manifestFile;
+	std::string contextName = "auto";
+	bool frustumCulling = true;
+	for (int a = 1; a < argc; a++) {
+		std::string arg = argv[a];
+		if (arg == "--backend" && a + 1 < argc) {
+			options.backend = argv[++a];
+		}
+		else if (arg == "--threads" && a + 1 < argc) {
+			options.numThreads = atoi(argv[++a]);
+		}
+		else if (arg == "--render-threads" && a + 1 < argc) {
+			options.renderThreads = atoi(argv[++a]);
+		}
+		else if (arg == "--encode-threads" && a + 1 < argc) {
+			options.encodeThreads = atoi(argv[++a]);
+		}
+		else if (arg == "--id-format" && a + 1 < argc) {
+			options.idFormat = argv[++a];
+		}
+		else if (arg == "--mesh" && a + 1 < argc) {
+			meshFile = argv[++a];
+		}
+		else if (arg == "--batch" && a + 1 < argc) {
+			manifestFile = argv[++a];
+		}
+		else if (arg == "--context" && a + 1 < argc) {
+			contextName = argv[++a];
+		}
+		else if (arg == "--no-culling") {
+			frustumCulling = false;
+		}
+		else if (arg == "--incremental") {
+			options.incremental = true;
+		}
+		else if (arg == "--face-attributes" && a + 1 < argc) {
+			options.faceAttributes = argv[++a];
+		}
+		else if (arg == "--depth" && a + 1 < argc) {
+			options.depthFormat = argv[++a];
+		}
+		else if (arg == "--normals" && a + 1 < argc) {
+			options.normalFormat = argv[++a];
+		}
+		else if (arg == "--barycentrics" && a + 1 < argc) {
+			options.barycentricFormat = argv[++a];
+		}
+		else if (arg == "--fuse-colors") {
+			options.fuseColors = true;
+		}
+		else if (arg == "--archive") {
+			options.archive = true;
+		}
+		else if (arg == "--reorder-triangles") {
+			options.reorderTriangles = true;
+		}
+		else if (arg == "--benchmark-loader") {
+			benchmarkLoader = true;
+		}
+		else if (arg == "--trace" && a + 1 < argc) {
+			traceFile = argv[++a];
+		}
+		else if (arg == "--benchmark-suite" && a + 1 < argc) {
+			benchmark.workDir = argv[++a];
+		}
+		else if (arg == "--benchmark-faces" && a + 1 < argc) {
+			benchmarkFaces = argv[++a];
+		}
+		else if (arg == "--benchmark-frames" && a + 1 < argc) {
+			benchmark.numFrames = size_t(std::max(1, atoi(argv[++a])));
+		}
+		else if (arg == "--benchmark-runs" && a + 1 < argc) {
+			benchmark.numRuns = std::max(1, atoi(argv[++a]));
+		}
+		else {
+			positionalArgs.push_back(arg);
+		}
+	}
+	const std::string& backend = options.backend;
+	const bool batch = !manifestFile.empty();
+	const bool validIdFormat = isValidIdFormat(options.idFormat);
+	const bool validAttributes = options.faceAttributes == "text" || options.faceAttributes == "binary" || options.faceAttributes == "both";
+	const bool validMaps = (options.depthFormat == "none" || options.depthFormat == "raw") &&
+		(options.normalFormat == "none" || options.normalFormat == "png" || options.normalFormat == "raw") &&
+		(options.barycentricFormat == "none" || options.barycentricFormat == "raw") &&
+		(!options.fuseColors || (options.depthFormat == "none" && options.normalFormat == "none" && options.barycentricFormat == "none" && !options.archive));
+	GLContextBackend requestedContext = GLContextBackend::GLFW;
+	const bool validContext = contextName == "auto" || parseGLContextBackend(contextName, requestedContext);
+	const bool benchmarkSuite = !benchmark.workDir.empty();
+	std::stringstream faceList(benchmarkFaces);
+	std::string faces;
+	while (std::getline(faceList, faces, ',')) {
+		if (strtoull(faces.c_str(), NULL, 10) > 0) {
+			benchmark.meshFaces.push_back(size_t(strtoull(faces.c_str(), NULL, 10)));
+		}
+	}
+	// In batch mode the scene directories come from the manifest and the only positional argument is the shader directory.
+	// The benchmark suite only takes an optional shader directory.
+	const size_t numDirArgs = batch || benchmarkSuite ? 0 : 1;
+	const bool validBatch = !batch || (meshFile.empty() && !benchmarkLoader);
+	const bool validBenchmark = !benchmarkSuite || (!batch && meshFile.empty() && !benchmarkLoader && !benchmark.meshFaces.empty());
+	if ((backend != "gl" && backend != "cpu") || !validIdFormat || !validAttributes || !validMaps || !validContext || !validBatch || !validBenchmark || positionalArgs.size() < numDirArgs ||
+		(backend == "gl" && positionalArgs.size() < numDirArgs + 1 && !benchmarkLoader && !benchmarkSuite)) {
+		printUsage(argv[0]);
+		return -1;
+	}
+	if (!traceFile.empty()) {
+		enableTracing();
+		setTraceThreadName("main");
+	}
+	if (benchmarkLoader) {
+		benchmarkObjLoaders(positionalArgs[0] + PATH_SEPARATOR "mesh" PATH_SEPARATOR "mesh.refined.obj", options.numThreads);
+		return 0;
+	}
+	if (benchmarkSuite) {
+		const std::string shaderDir = positionalArgs.empty() ? "" : positionalArgs[0];
+		const bool ok = runBenchmarkSuite(benchmark, options, shaderDir, contextName, requestedContext, frustumCulling);
+		finishTracing(traceFile);
+		return ok ? 0 : -1;
+	}
+	if (options.numThreads <= 0) {
+		// Every OpenGL worker needs its own context, a handful is enough to keep one GPU busy.
+		options.numThreads = backend == "gl" ? std::min(4, getHardwareThreadCount()) : getHardwareThreadCount();
+	}
+	if (options.encodeThreads <= 0) {
+		options.encodeThreads = getHardwareThreadCount();
+	}
+
+	std::vector<std::string> rootDirs;
+	if (batch) {
+		if (!readSceneManifest(manifestFile, rootDirs)) {
+			return -1;
+		}
+	}
+	else {
+		rootDirs.push_back(positionalArgs[0]);
+	}
+	std::string shaderDir = positionalArgs.size() > numDirArgs ? positionalArgs[numDirArgs] : "";
+
+	GLRenderer renderer;
+	if (backend == "gl") {
+		renderer.vShader = shaderDir + PATH_SEPARATOR "TransformVertexShader.vertexshader";
+		renderer.gShader = shaderDir + PATH_SEPARATOR "BarycentricGeometryShader.geometryshader";
+		renderer.fShader = shaderDir + PATH_SEPARATOR "TextureFragmentShader.fragmentshader";
+		renderer.frustumCulling = frustumCulling;
+		renderer.depthOutput = options.depthFormat != "none";
+		renderer.normalOutput = options.normalFormat != "none";
+		renderer.barycentricOutput = options.barycentricFormat != "none";
+		if (!createGLRenderer(renderer, contextName, requestedContext, options.numThreads)) {
+			destroyGLRenderer(renderer);
+			return -1;
+		}
+	}
+
+	// Scenes whose folders can not be listed are skipped, the others are rendered in manifest order.
+	std::vector<ScenePaths> scenes;
+	int numFailed = 0;
+	for (size_t s = 0; s < rootDirs.size(); s++) {
+		ScenePaths scene;
+		if (collectScenePaths(rootDirs[s], meshFile, scene)) {
+			scenes.push_back(scene);
+		}
+		else {
+			numFailed++;
+		}
+	}
+
+	// The poses, the render state and the mesh of the next scene are prepared on a background thread while
+	// the current scene renders, the loaders only touch the scene they are given.
+	std::future<std::unique_ptr<PreparedScene> > nextScene;
+	if (!scenes.empty()) {
+		nextScene = std::async(std::launch::async, prefetchScene, std::cref(scenes[0]), std::cref(options));
+	}
+	auto batchStartTime = std::chrono::steady_clock::now();
+	size_t totalFrames = 0;
+	int numRendered = 0;
+	for (size_t s = 0; s < scenes.size(); s++) {
+		const ScenePaths& scene = scenes[s];
+		TRACE_SCOPE("scene");
+		auto waitStartTime = std::chrono::steady_clock::now();
+		std::unique_ptr<PreparedScene> prepared;
+		{
+			TRACE_SCOPE("wait for prefetch");
+			prepared = nextScene.get();
+		}
+		double waitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStartTime).count();
+		if (s + 1 < scenes.size()) {
+			nextScene = std::async(std::launch::async, prefetchScene, std::cref(scenes[s + 1]), std::cref(options));
+		}
+		if (!prepared) {
+			numFailed++;
+			continue;
+		}
+		SceneRenderState& state = prepared->state;
+		const SceneMesh* mesh = prepared->mesh.get();
+		auto renderStartTime = std::chrono::steady_clock::now();
+		const bool rendered = renderPreparedScene(renderer, scene, *prepared, options);
+		double renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStartTime).count();
+		const size_t sceneFrames = state.getRenderFrames().size();
+		if (rendered) {
+			numRendered++;
+			totalFrames += sceneFrames;
+		}
+		else {
+			numFailed++;
+		}
+		if (batch) {
+			printf("Scene %d/%d %s: %d of %d frames, mesh loaded in %.2f s (waited %.2f s), clustered in %.2f s, rendered in %.2f s\n",
+				int(s + 1), int(scenes.size()), scene.rootDir.c_str(), int(sceneFrames), int(scene.cam2WorldMatrixFiles.size()),
+				mesh ? mesh->loadSeconds : 0.0, waitSeconds, mesh ? mesh->clusterSeconds : 0.0, renderSeconds);
+		}
+		// A broken worker would fail every further scene as well.
+		if (backend == "gl" && renderer.workerError) {
+			break;
+		}
+	}
+	if (batch) {
+		double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStartTime).count();
+		printf("Rendered %d scenes with %d frames in %.2f s (%.1f frames/sec), %d failed\n", numRendered, int(totalFrames),
+			batchSeconds, batchSeconds > 0.0 ? totalFrames / batchSeconds : 0.0, numFailed);
+	}
+	if (nextScene.valid()) {
+		nextScene.wait();
+	}
+
+	if (backend == "gl") {
+		destroyGLRenderer(renderer);
+	}
+	finishTracing(traceFile);
+	return numFailed > 0 ? -1 : 0;
+}
@@ -0,0 +1,391 @@
+#include "pch.h"
+#include <algorithm>
+#include <chrono>
+#include <experimental/filesystem>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <system_error>
+
+#include <glm/glm.hpp>
+
+#include "benchmark.hpp"
+#include "controls.hpp"
+#include "faceattributes.hpp"
+#include "facemap.hpp"
+#include "facemaparchive.hpp"
+#include "facemapcodec.hpp"
+#include "meshcache.hpp"
+#include "meshorder.hpp"
+#include "objparser.hpp"
+#include "rasterizer.hpp"
+#include "stats.hpp"
+#include "visibility.hpp"
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BenchmarkReport::add(const std::string& stage, size_t numFaces, const std::string& unit, double numItems, double seconds) {
+	for (size_t s = 0; s < stages.size(); s++) {
+		if (stages[s].name == stage && stages[s].numFaces == numFaces) {
+			stages[s].numItems += numItems;
+			stages[s].seconds.push_back(seconds);
+			return;
+		}
+	}
+	Stage entry;
+	entry.name = stage;
+	entry.numFaces = numFaces;
+	entry.unit = unit;
+	entry.numItems = numItems;
+	entry.seconds.push_back(seconds);
+	stages.push_back(entry);
+}
+
+void BenchmarkReport::print() const {
+	printf("%-20s %10s %8s %18s %10s %10s %10s %10s\n", "stage", "faces", "samples", "throughput", "p50 ms", "p95 ms", "p99 ms", "max ms");
+	for (size_t s = 0; s < stages.size(); s++) {
+		const Stage& stage = stages[s];
+		double total = 0.0;
+		for (size_t i = 0; i < stage.seconds.size(); i++) {
+			total += stage.seconds[i];
+		}
+		printf("%-20s %10d %8d %9.4g %-8s %10.2f %10.2f %10.2f %10.2f\n", stage.name.c_str(), int(stage.numFaces), int(stage.seconds.size()),
+			total > 0.0 ? stage.numItems / total : 0.0, (stage.unit + "/s").c_str(), 1000.0 * percentile(stage.seconds, 0.5),
+			1000.0 * percentile(stage.seconds, 0.95), 1000.0 * percentile(stage.seconds, 0.99), 1000.0 * percentile(stage.seconds, 1.0));
+	}
+}
+
+bool BenchmarkReport::write(const std::string& path, int numThreads, size_t numFrames) const {
+	FILE* fp = fopen(path.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	fprintf(fp, "{\n  \"threads\": %d,\n  \"frames\": %d,\n  \"stages\": [\n", numThreads, int(numFrames));
+	for (size_t s = 0; s < stages.size(); s++) {
+		const Stage& stage = stages[s];
+		double total = 0.0;
+		for (size_t i = 0; i < stage.seconds.size(); i++) {
+			total += stage.seconds[i];
+		}
+		fprintf(fp, "    { \"stage\": \"%s\", \"faces\": %llu, \"unit\": \"%s\", \"samples\": %d, \"throughput\": %.6g, "
+			"\"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f }%s\n",
+			stage.name.c_str(), (unsigned long long)stage.numFaces, stage.unit.c_str(), int(stage.seconds.size()),
+			total > 0.0 ? stage.numItems / total : 0.0, 1000.0 * total / stage.seconds.size(), 1000.0 * percentile(stage.seconds, 0.5),
+			1000.0 * percentile(stage.seconds, 0.95), 1000.0 * percentile(stage.seconds, 0.99), 1000.0 * percentile(stage.seconds, 1.0),
+			s + 1 < stages.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Side length of the square the synthetic meshes cover, in meters. The size does not change
+// with the number of faces, so every camera sees about the same share of the mesh.
+static const float SYNTHETIC_EXTENT = 20.0f;
+
+static float syntheticHeight(float x, float y) {
+	return 0.4f * sinf(0.6f * x) * cosf(0.45f * y) + 0.08f * sinf(2.3f * x + 1.7f * y);
+}
+
+// Writes a grid of quads, two triangles each, with the heights of syntheticHeight. The
+// triangles are counter-clockwise seen from above, where the cameras are.
+static bool writeHeightField(const std::string& path, size_t numFaces) {
+	const size_t cols = std::max<size_t>(1, size_t(sqrt(numFaces / 2.0) + 0.5));
+	const size_t rows = std::max<size_t>(1, (numFaces / 2 + cols / 2) / cols);
+	// A partly written mesh would be picked up by the next run, so it gets its name at the end.
+	const std::string tempFile = path + ".tmp";
+	FILE* fp = fopen(tempFile.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", tempFile.c_str());
+		return false;
+	}
+	bool ok = true;
+	std::string text;
+	char line[96];
+	for (size_t y = 0; y <= rows && ok; y++) {
+		for (size_t x = 0; x <= cols; x++) {
+			const float px = SYNTHETIC_EXTENT * x / cols;
+			const float py = SYNTHETIC_EXTENT * y / rows;
+			text.append(line, snprintf(line, sizeof(line), "v %.4f %.4f %.4f\n", px, py, syntheticHeight(px, py)));
+		}
+		if (text.size() > (1 << 20)) {
+			ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+			text.clear();
+		}
+	}
+	for (size_t y = 0; y < rows && ok; y++) {
+		for (size_t x = 0; x < cols; x++) {
+			const unsigned long long a = y * (cols + 1) + x + 1;
+			const unsigned long long b = a + 1;
+			const unsigned long long c = a + cols + 2;
+			const unsigned long long d = a + cols + 1;
+			text.append(line, snprintf(line, sizeof(line), "f %llu %llu %llu\nf %llu %llu %llu\n", a, b, c, a, c, d));
+		}
+		if (text.size() > (1 << 20)) {
+			ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+			text.clear();
+		}
+	}
+	ok = ok && fwrite(text.data(), 1, text.size(), fp) == text.size();
+	ok = fclose(fp) == 0 && ok;
+	if (ok) {
+		remove(path.c_str());
+		ok = rename(tempFile.c_str(), path.c_str()) == 0;
+	}
+	if (!ok) {
+		remove(tempFile.c_str());
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+	}
+	return ok;
+}
+
+static bool writeTextFile(const std::string& path, const std::string& text) {
+	FILE* fp = fopen(path.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+	return fclose(fp) == 0 && ok;
+}
+
+bool generateSyntheticScene(const std::string& rootDir, size_t numFaces, size_t numFrames) {
+	namespace fs = std::experimental::filesystem;
+	std::error_code ec;
+	// Frames of an earlier run with more frames must not be listed.
+	fs::remove_all(rootDir + PATH_SEPARATOR "color", ec);
+	fs::remove_all(rootDir + PATH_SEPARATOR "pose", ec);
+	const char* dirs[] = { PATH_SEPARATOR "mesh", PATH_SEPARATOR "camera", PATH_SEPARATOR "color", PATH_SEPARATOR "pose", PATH_SEPARATOR "face_maps" };
+	for (int d = 0; d < 5; d++) {
+		fs::create_directories(rootDir + dirs[d], ec);
+		if (ec) {
+			fprintf(stderr, "Unable to create %s%s: %s\n", rootDir.c_str(), dirs[d], ec.message().c_str());
+			return false;
+		}
+	}
+	const std::string meshFile = rootDir + PATH_SEPARATOR "mesh" PATH_SEPARATOR "mesh.refined.obj";
+	if (!fs::exists(meshFile) && !writeHeightField(meshFile, numFaces)) {
+		return false;
+	}
+	if (!writeTextFile(rootDir + PATH_SEPARATOR "camera" PATH_SEPARATOR "intrinsic_color.txt", "600 0 480 0\n0 600 270 0\n0 0 1 0\n0 0 0 1\n")) {
+		return false;
+	}
+
+	// The cameras circle the center at 2.2 m and look down at a point ahead of them. Camera
+	// axes are x right, y down and z forward like in the recorded poses.
+	const glm::vec3 center(0.5f * SYNTHETIC_EXTENT, 0.5f * SYNTHETIC_EXTENT, 0.0f);
+	for (size_t f = 0; f < numFrames; f++) {
+		const float t = 6.2831853f * f / numFrames;
+		const glm::vec3 position = center + glm::vec3(6.0f * cosf(t), 6.0f * sinf(t), 2.2f);
+		const glm::vec3 target = center + glm::vec3(3.0f * cosf(t + 0.8f), 3.0f * sinf(t + 0.8f), 0.0f);
+		const glm::vec3 forward = glm::normalize(target - position);
+		const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 0.0f, 1.0f)));
+		const glm::vec3 down = glm::cross(forward, right);
+		char name[32];
+		snprintf(name, sizeof(name), "frame-%06d", int(f));
+		char pose[256];
+		snprintf(pose, sizeof(pose), "%f %f %f %f\n%f %f %f %f\n%f %f %f %f\n0 0 0 1\n",
+			right.x, down.x, forward.x, position.x, right.y, down.y, forward.y, position.y, right.z, down.z, forward.z, position.z);
+		if (!writeTextFile(rootDir + PATH_SEPARATOR "pose" PATH_SEPARATOR + name + ".pose.txt", pose) ||
+			!writeTextFile(rootDir + PATH_SEPARATOR "color" PATH_SEPARATOR + name + ".color.jpg", "")) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Reads every frame of the archive back in each codec and through findRawFrame, and compares it
+// with the raw face map written next to it.
+static bool checkFaceMapArchive(const ScenePaths& scene, const PoseSet& poses, size_t numFaces, BenchmarkReport& report) {
+	FaceMapArchiveReader reader;
+	if (!reader.open(scene.faceMapArchiveFile)) {
+		fprintf(stderr, "Unable to open the face map archive %s\n", scene.faceMapArchiveFile.c_str());
+		return false;
+	}
+	static const FaceMapCodec codecs[3] = { FACEMAP_CODEC_RAW, FACEMAP_CODEC_PNG, FACEMAP_CODEC_RLE };
+	std::vector<unsigned int> faceIds, decodedIds;
+	int width, height;
+	for (size_t f = 0; f < poses.size(); f++) {
+		if (!poses.isValid(f)) {
+			continue;
+		}
+		const std::string& name = scene.frameNames[f];
+		if (!readFaceMapRaw(scene.faceMapFiles[f] + ".bin", faceIds, width, height)) {
+			fprintf(stderr, "Unable to read the face map of frame %d\n", int(f));
+			return false;
+		}
+		auto start = std::chrono::steady_clock::now();
+		bool ok = reader.readFrame(name, decodedIds, width, height) && decodedIds == faceIds;
+		report.add("archive_read", numFaces, "frames", 1.0, secondsSince(start));
+		for (int c = 0; c < 3 && ok; c++) {
+			ok = reader.readFrame(name, codecs[c], decodedIds, width, height) && decodedIds == faceIds;
+		}
+		const unsigned int* rawIds = reader.findRawFrame(name);
+		if (!ok || !rawIds || !std::equal(faceIds.begin(), faceIds.end(), rawIds)) {
+			fprintf(stderr, "The archived face maps of frame %d do not decode to the rendered one\n", int(f));
+			return false;
+		}
+	}
+	return true;
+}
+
+bool benchmarkSceneStages(const ScenePaths& scene, int numThreads, int numRuns, BenchmarkReport& report) {
+	TaskPool pool(numThreads);
+	const std::string meshDir = scene.rootDir + PATH_SEPARATOR "mesh" PATH_SEPARATOR;
+
+	// Loading without the cache parses and converts the OBJ file and writes the cache.
+	std::unique_ptr<SceneMesh> mesh;
+	for (int r = 0; r < numRuns; r++) {
+		remove(getMeshCachePath(scene.meshFile).c_str());
+		mesh.reset(new SceneMesh());
+		auto start = std::chrono::steady_clock::now();
+		if (!loadSceneMesh(scene.meshFile, false, false, *mesh)) {
+			fprintf(stderr, "Unable to load the mesh %s\n", scene.meshFile.c_str());
+			return false;
+		}
+		report.add("mesh_load", mesh->drawObjects[0].faceAreas.size(), "faces", double(mesh->drawObjects[0].faceAreas.size()), secondsSince(start));
+	}
+	const DrawObject& object = mesh->drawObjects[0];
+	const size_t numFaces = object.faceAreas.size();
+	for (int r = 0; r < numRuns; r++) {
+		SceneMesh cached;
+		auto start = std::chrono::steady_clock::now();
+		loadSceneMesh(scene.meshFile, false, false, cached);
+		report.add("mesh_load_cached", numFaces, "faces", double(numFaces), secondsSince(start));
+	}
+	for (int r = 0; r < numRuns; r++) {
+		ObjTriangleMesh parsed;
+		std::vector<tinyobj::material_t> materials;
+		std::string warn;
+		auto start = std::chrono::steady_clock::now();
+		if (parseObjParallel(scene.meshFile, meshDir, pool, parsed, materials, warn)) {
+			report.add("obj_parse", numFaces, "faces", double(numFaces), secondsSince(start));
+		}
+	}
+
+	ClusterBVH bvh;
+	for (int r = 0; r < numRuns; r++) {
+		std::vector<unsigned int> sortedIndices, clusterFaceIds;
+		auto start = std::chrono::steady_clock::now();
+		bvh = ClusterBVH();
+		bvh.build(object.vertices, object.indices, sortedIndices, clusterFaceIds);
+		report.add("cluster_build", numFaces, "faces", double(numFaces), secondsSince(start));
+	}
+	// Reordered triangles for cpu_raster_reordered, see meshorder.hpp.
+	std::vector<unsigned int> orderedIndices, orderedFaceIds;
+	std::vector<float> orderedVertices;
+	for (int r = 0; r < numRuns; r++) {
+		bvh.build(object.vertices, object.indices, orderedIndices, orderedFaceIds);
+		auto start = std::chrono::steady_clock::now();
+		optimizeClusterOrder(object.vertices, bvh, orderedIndices, orderedFaceIds);
+		reorderVertices(object.vertices, orderedIndices, orderedVertices);
+		report.add("triangle_reorder", numFaces, "faces", double(numFaces), secondsSince(start));
+	}
+	printf("ACMR of %d faces: %.3f in file order, %.3f reordered\n", int(numFaces),
+		computeACMR(object.indices.data(), numFaces, object.vertices.size() / 3), computeACMR(orderedIndices.data(), numFaces, orderedVertices.size() / 3));
+	for (int r = 0; r < numRuns; r++) {
+		std::vector<float> areas;
+		auto start = std::chrono::steady_clock::now();
+		computeFaceAreas(object.vertices, object.indices, pool, areas);
+		report.add("face_areas", numFaces, "faces", double(numFaces), secondsSince(start));
+
+		FaceAttributes attributes;
+		start = std::chrono::steady_clock::now();
+		computeFaceAttributes(object.vertices, object.indices, pool, attributes);
+		report.add("face_attributes", numFaces, "faces", double(numFaces), secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		writeFaceAreasText(scene.faceAreasFile, areas, pool);
+		report.add("areas_text_write", numFaces, "faces", double(numFaces), secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		writeFaceAttributes(scene.faceAttributesFile, attributes);
+		report.add("attributes_write", numFaces, "faces", double(numFaces), secondsSince(start));
+	}
+	for (int r = 0; r < numRuns; r++) {
+		PoseSet poses;
+		auto start = std::chrono::steady_clock::now();
+		loadScenePoses(scene, poses);
+		report.add("pose_load", numFaces, "frames", double(scene.frameNames.size()), secondsSince(start));
+	}
+
+	// Per frame stages, each frame is one sample.
+	PoseSet poses;
+	float camIntrinsicRowMajor[16];
+	if (!loadScenePoses(scene, poses) || !readMatrixFile(scene.camIntrinsicsFile, camIntrinsicRowMajor)) {
+		fprintf(stderr, "Unable to read the poses or intrinsics of %s\n", scene.rootDir.c_str());
+		return false;
+	}
+	const glm::mat4 ProjectionMatrix = computeProjectionMatrix(camIntrinsicRowMajor[0], camIntrinsicRowMajor[5], camIntrinsicRowMajor[2], camIntrinsicRowMajor[6], 960, 540);
+	SoftwareRasterizer rasterizer(960, 540, numThreads);
+	VisibilityCollector visibility(poses.size(), numFaces);
+	std::vector<unsigned int> faceIds(960 * 540), reorderedIds(960 * 540), decodedIds;
+	std::vector<FaceRange> ranges;
+	std::vector<unsigned char> encoded;
+	const bool withAlpha = numFaces >= (1u << 24);
+	FaceMapArchiveWriter archive;
+	if (!archive.open(scene.faceMapArchiveFile, 960, 540)) {
+		return false;
+	}
+	for (size_t f = 0; f < poses.size(); f++) {
+		if (!poses.isValid(f)) {
+			continue;
+		}
+		const glm::mat4 MVP = ProjectionMatrix * computeViewMatrix(poses.get(f));
+		auto start = std::chrono::steady_clock::now();
+		ranges.clear();
+		bvh.cullFrustum(MVP, ranges);
+		report.add("frustum_cull", numFaces, "frames", 1.0, secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		rasterizer.render(object, MVP, faceIds.data());
+		report.add("cpu_raster", numFaces, "frames", 1.0, secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		rasterizer.render(orderedVertices, orderedIndices, orderedFaceIds.data(), MVP, reorderedIds.data());
+		report.add("cpu_raster_reordered", numFaces, "frames", 1.0, secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		visibility.addFrame(f, faceIds.data(), faceIds.size());
+		report.add("visibility_count", numFaces, "frames", 1.0, secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		writeFaceMapRaw(scene.faceMapFiles[f] + ".bin", faceIds.data(), 960, 540);
+		report.add("raw_write", numFaces, "frames", 1.0, secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		writeFaceMapPNG(scene.faceMapFiles[f] + ".png", faceIds.data(), 960, 540, withAlpha);
+		report.add("png_write", numFaces, "frames", 1.0, secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		writeFaceMapRLE(scene.faceMapFiles[f] + ".rle", faceIds.data(), 960, 540);
+		report.add("rle_write", numFaces, "frames", 1.0, secondsSince(start));
+
+		start = std::chrono::steady_clock::now();
+		int width, height;
+		if (!readFaceMapRLE(scene.faceMapFiles[f] + ".rle", decodedIds, width, height) || decodedIds != faceIds) {
+			fprintf(stderr, "The RLE face map of frame %d does not decode to the rendered one\n", int(f));
+			return false;
+		}
+		report.add("rle_read", numFaces, "frames", 1.0, secondsSince(start));
+
+		// Every frame goes into the archive in all three codecs, checkFaceMapArchive reads them back.
+		start = std::chrono::steady_clock::now();
+		encodeFaceMapRaw(faceIds.data(), 960, 540, encoded);
+		bool archived = archive.add(scene.frameNames[f], FACEMAP_CODEC_RAW, encoded);
+		archived = encodeFaceMapPNG(faceIds.data(), 960, 540, withAlpha, encoded) && archive.add(scene.frameNames[f], FACEMAP_CODEC_PNG, encoded) && archived;
+		encodeFaceMapRLE(faceIds.data(), 960, 540, encoded);
+		archived = archive.add(scene.frameNames[f], FACEMAP_CODEC_RLE, encoded) && archived;
+		if (!archived) {
+			return false;
+		}
+		report.add("archive_write", numFaces, "frames", 1.0, secondsSince(start));
+	}
+	return archive.finish() && checkFaceMapArchive(scene, poses, numFaces, report);
+}
@@ -0,0 +1,49 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <string>
+#include <vector>
+
+#include "scene.hpp"
+
+// Latencies of the stages of the pipeline, collected by --benchmark-suite. Every sample is one
+// run of a stage that processed a number of items, faces or frames; the throughput of a stage
+// is its items per second over all samples.
+class BenchmarkReport {
+public:
+	void add(const std::string& stage, size_t numFaces, const std::string& unit, double numItems, double seconds);
+
+	// One line per stage and mesh size.
+	void print() const;
+
+	// Writes the stages as JSON:
+	//   { "threads": N, "frames": N, "stages": [ { "stage": "cpu_raster", "faces": 100000,
+	//     "unit": "frames", "samples": 60, "throughput": 41.3, "mean_ms": 24.2, "p50_ms": 24.0,
+	//     "p95_ms": 26.9, "p99_ms": 27.5, "max_ms": 28.1 }, ... ] }
+	bool write(const std::string& path, int numThreads, size_t numFrames) const;
+
+private:
+	struct Stage {
+		std::string name;
+		size_t numFaces;
+		std::string unit;
+		double numItems;
+		std::vector<double> seconds;
+	};
+
+	std::vector<Stage> stages;
+};
+
+// Writes a synthetic scene to rootDir: a height field with about numFaces triangles as
+// mesh\mesh.refined.obj, the intrinsics, and numFrames cameras flying a loop over it, with a
+// .pose.txt and an empty color image per frame so the frames can be listed. The mesh is only
+// generated if it does not exist yet, large meshes take a while to write.
+bool generateSyntheticScene(const std::string& rootDir, size_t numFaces, size_t numFrames);
+
+// Times the stages of the CPU pipeline on scene in isolation. The whole-mesh stages run
+// numRuns times: OBJ parsing, loading with and without the mesh cache, clustering, face
+// attributes and pose loading. Per frame: frustum culling, software rasterization, visibility
+// counting and writing raw and PNG face maps.
+bool benchmarkSceneStages(const ScenePaths& scene, int numThreads, int numRuns, BenchmarkReport& report);
+
+#endif
@@ -0,0 +1,146 @@
+#include "pch.h"
+#include <algorithm>
+#include <limits>
+
+#include "bvh.hpp"
+
+void ClusterBVH::build(const std::vector<float>& vertices, const std::vector<unsigned int>& indices,
+	std::vector<unsigned int>& sortedIndices, std::vector<unsigned int>& faceIds) {
+	const unsigned int numFaces = (unsigned int)(indices.size() / 3);
+	std::vector<glm::vec3> centroids(numFaces);
+	std::vector<glm::vec3> faceMin(numFaces);
+	std::vector<glm::vec3> faceMax(numFaces);
+	std::vector<unsigned int> order(numFaces);
+	for (unsigned int f = 0; f < numFaces; f++) {
+		const float* v0 = &vertices[3 * indices[3 * f + 0]];
+		const float* v1 = &vertices[3 * indices[3 * f + 1]];
+		const float* v2 = &vertices[3 * indices[3 * f + 2]];
+		glm::vec3 p0(v0[0], v0[1], v0[2]), p1(v1[0], v1[1], v1[2]), p2(v2[0], v2[1], v2[2]);
+		faceMin[f] = glm::min(p0, glm::min(p1, p2));
+		faceMax[f] = glm::max(p0, glm::max(p1, p2));
+		centroids[f] = (p0 + p1 + p2) / 3.0f;
+		order[f] = f;
+	}
+
+	nodes.clear();
+	numClusters = 0;
+	nodes.resize(1);
+	buildNode(0, centroids, faceMin, faceMax, order, 0, numFaces);
+
+	sortedIndices.resize(indices.size());
+	faceIds.resize(numFaces);
+	for (unsigned int f = 0; f < numFaces; f++) {
+		for (int c = 0; c < 3; c++) {
+			sortedIndices[3 * f + c] = indices[3 * order[f] + c];
+		}
+		faceIds[f] = order[f] + 1;
+	}
+}
+
+// Splits at the median centroid along the longest axis of the centroid bounds, which keeps
+// the tree balanced and the clusters compact. The children are stored next to each other
+// before their subtrees, so a node can be filled after the vector has grown.
+void ClusterBVH::buildNode(unsigned int node, const std::vector<glm::vec3>& centroids, const std::vector<glm::vec3>& faceMin,
+	const std::vector<glm::vec3>& faceMax, std::vector<unsigned int>& order, unsigned int first, unsigned int count) {
+	glm::vec3 bmin(std::numeric_limits<float>::max());
+	glm::vec3 bmax(-std::numeric_limits<float>::max());
+	glm::vec3 cmin(std::numeric_limits<float>::max());
+	glm::vec3 cmax(-std::numeric_limits<float>::max());
+	for (unsigned int i = first; i < first + count; i++) {
+		bmin = glm::min(bmin, faceMin[order[i]]);
+		bmax = glm::max(bmax, faceMax[order[i]]);
+		cmin = glm::min(cmin, centroids[order[i]]);
+		cmax = glm::max(cmax, centroids[order[i]]);
+	}
+	nodes[node].bmin = bmin;
+	nodes[node].bmax = bmax;
+	nodes[node].firstFace = first;
+	nodes[node].numFaces = count;
+	nodes[node].left = 0;
+	if (count <= CLUSTER_FACES) {
+		numClusters++;
+		return;
+	}
+
+	glm::vec3 extent = cmax - cmin;
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	unsigned int half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+		[&centroids, axis](unsigned int a, unsigned int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+	unsigned int left = (unsigned int)nodes.size();
+	nodes[node].left = left;
+	nodes.resize(nodes.size() + 2);
+	buildNode(left, centroids, faceMin, faceMax, order, first, half);
+	buildNode(left + 1, centroids, faceMin, faceMax, order, first + half, count - half);
+}
+
+void ClusterBVH::cullFrustum(const glm::mat4& MVP, std::vector<FaceRange>& ranges) const {
+	if (nodes.empty()) {
+		return;
+	}
+	// Clip space planes w + x >= 0, w - x >= 0 etc. in model space, from the rows of MVP.
+	glm::vec4 planes[6];
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; r++) {
+		rows[r] = glm::vec4(MVP[0][r], MVP[1][r], MVP[2][r], MVP[3][r]);
+	}
+	for (int k = 0; k < 3; k++) {
+		planes[2 * k + 0] = rows[3] + rows[k];
+		planes[2 * k + 1] = rows[3] - rows[k];
+	}
+
+	std::vector<unsigned int> stack(1, 0);
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		// The box is outside if its corner farthest along a plane normal is behind the plane,
+		// and fully inside if even the nearest corner is in front of all of them.
+		bool inside = true;
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; p++) {
+			const glm::vec4& plane = planes[p];
+			glm::vec3 farCorner(plane.x >= 0.0f ? node.bmax.x : node.bmin.x, plane.y >= 0.0f ? node.bmax.y : node.bmin.y, plane.z >= 0.0f ? node.bmax.z : node.bmin.z);
+			glm::vec3 nearCorner(plane.x >= 0.0f ? node.bmin.x : node.bmax.x, plane.y >= 0.0f ? node.bmin.y : node.bmax.y, plane.z >= 0.0f ? node.bmin.z : node.bmax.z);
+			outside = glm::dot(glm::vec3(plane), farCorner) + plane.w < 0.0f;
+			inside = inside && glm::dot(glm::vec3(plane), nearCorner) + plane.w >= 0.0f;
+		}
+		if (outside) {
+			continue;
+		}
+		if (inside || node.left == 0) {
+			if (!ranges.empty() && ranges.back().first + ranges.back().count == node.firstFace) {
+				ranges.back().count += node.numFaces;
+			}
+			else {
+				FaceRange range = { node.firstFace, node.numFaces };
+				ranges.push_back(range);
+			}
+			continue;
+		}
+		// The right child is pushed first so the ranges come out in ascending order.
+		stack.push_back(node.left + 1);
+		stack.push_back(node.left);
+	}
+}
+
+void ClusterBVH::getClusters(std::vector<FaceRange>& clusters) const {
+	// Children follow their parents, so the leaves are visited in order of their faces by
+	// walking the tree depth first.
+	std::vector<unsigned int> stack;
+	if (!nodes.empty()) {
+		stack.push_back(0);
+	}
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.left == 0) {
+			FaceRange range = { node.firstFace, node.numFaces };
+			clusters.push_back(range);
+			continue;
+		}
+		stack.push_back(node.left + 1);
+		stack.push_back(node.left);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// A range of faces in the cluster order of a ClusterBVH.
+struct FaceRange {
+	unsigned int first;
+	unsigned int count;
+};
+
+// Bounding volume hierarchy over spatially coherent clusters of a triangle mesh, used to
+// skip the parts of large scenes that a camera does not see. The triangles are sorted so
+// that every node covers a contiguous range of faces; drawing a node is a single range of
+// the sorted index buffer.
+class ClusterBVH {
+public:
+	// Leaves hold at most this many faces.
+	static const unsigned int CLUSTER_FACES = 2048;
+
+	ClusterBVH() : numClusters(0) {}
+
+	// Sorts the triangles of indices into clusters. sortedIndices receives the triangles in
+	// cluster order and faceIds the 1-based index of each of them in indices, so the
+	// renderer can still output the original face ids.
+	void build(const std::vector<float>& vertices, const std::vector<unsigned int>& indices,
+		std::vector<unsigned int>& sortedIndices, std::vector<unsigned int>& faceIds);
+
+	// Appends the face ranges of the clusters intersecting the view frustum of MVP in
+	// ascending order, neighbouring ranges are merged into one.
+	void cullFrustum(const glm::mat4& MVP, std::vector<FaceRange>& ranges) const;
+
+	size_t getNumClusters() const { return numClusters; }
+
+	// Appends the face ranges of the leaves in ascending order.
+	void getClusters(std::vector<FaceRange>& clusters) const;
+
+private:
+	struct Node {
+		glm::vec3 bmin;
+		glm::vec3 bmax;
+		unsigned int firstFace;
+		unsigned int numFaces;
+		unsigned int left; // index of the first child, the second follows it; 0 for leaves
+	};
+
+	void buildNode(unsigned int node, const std::vector<glm::vec3>& centroids, const std::vector<glm::vec3>& faceMin, const std::vector<glm::vec3>& faceMax,
+		std::vector<unsigned int>& order, unsigned int first, unsigned int count);
+
+	std::vector<Node> nodes;
+	size_t numClusters;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "pch.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stb_image.h"
+
+#include "colorfusion.hpp"
+#include "trace.hpp"
+
+ColorFusion::ColorFusion(const DrawObject& object, const PoseSet& poses, const std::vector<std::string>& colorFiles)
+	: object(object), poses(poses), colorFiles(colorFiles) {
+	TaskPool pool(0);
+	computeFaceAttributes(object.vertices, object.indices, pool, attributes);
+	const size_t numSums = 4 * attributes.areas.size();
+	sums.reset(new std::atomic<unsigned long long>[numSums]);
+	for (size_t i = 0; i < numSums; i++) {
+		sums[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void ColorFusion::addRun(unsigned int faceId, const unsigned int color[3], unsigned int count, const float center[3]) {
+	const size_t f = faceId - 1;
+	float toCamera[3];
+	float distance = 0.0f;
+	for (int a = 0; a < 3; a++) {
+		toCamera[a] = center[a] - attributes.centroids[a][f];
+		distance += toCamera[a] * toCamera[a];
+	}
+	distance = sqrtf(distance);
+	if (distance <= 0.0f) {
+		return;
+	}
+	const float cosine = (attributes.normals[0][f] * toCamera[0] + attributes.normals[1][f] * toCamera[1] + attributes.normals[2][f] * toCamera[2]) / distance;
+	// Back faces are culled, this only drops faces seen edge-on and degenerate ones.
+	const unsigned long long weight = (unsigned long long)(std::min(fabsf(cosine), 1.0f) * 65536.0f + 0.5f);
+	if (weight == 0) {
+		return;
+	}
+	for (int c = 0; c < 3; c++) {
+		sums[4 * f + c].fetch_add(color[c] * weight, std::memory_order_relaxed);
+	}
+	sums[4 * f + 3].fetch_add(count * weight, std::memory_order_relaxed);
+}
+
+bool ColorFusion::addFrame(size_t frame, const unsigned int* faceIds, int width, int height) {
+	int colorWidth, colorHeight, channels;
+	unsigned char* image;
+	{
+		TRACE_SCOPE("decode color");
+		image = stbi_load(colorFiles[frame].c_str(), &colorWidth, &colorHeight, &channels, 3);
+	}
+	if (!image) {
+		fprintf(stderr, "Unable to read the color image %s\n", colorFiles[frame].c_str());
+		return false;
+	}
+	// The face maps are rendered with the color intrinsics, a color image of another size does
+	// not line up with them.
+	if (colorWidth != width || colorHeight != height) {
+		fprintf(stderr, "The color image %s is %dx%d, its face map is %dx%d\n", colorFiles[frame].c_str(), colorWidth, colorHeight, width, height);
+		stbi_image_free(image);
+		return false;
+	}
+
+	TRACE_SCOPE("fuse colors");
+	const float* cam2World = poses.get(frame);
+	const float center[3] = { cam2World[3], cam2World[7], cam2World[11] };
+	for (int y = 0; y < height; y++) {
+		const unsigned int* ids = faceIds + size_t(y) * width;
+		const unsigned char* colors = image + 3 * size_t(y) * width;
+		unsigned int runFace = 0;
+		unsigned int runColor[3] = { 0, 0, 0 };
+		unsigned int runCount = 0;
+		for (int x = 0; x < width; x++) {
+			if (ids[x] != runFace) {
+				if (runFace != 0) {
+					addRun(runFace, runColor, runCount, center);
+				}
+				runFace = ids[x];
+				runColor[0] = runColor[1] = runColor[2] = 0;
+				runCount = 0;
+			}
+			for (int c = 0; c < 3; c++) {
+				runColor[c] += colors[3 * x + c];
+			}
+			runCount++;
+		}
+		if (runFace != 0) {
+			addRun(runFace, runColor, runCount, center);
+		}
+	}
+	stbi_image_free(image);
+	return true;
+}
+
+bool ColorFusion::writeColoredMesh(const std::string& path) const {
+	TRACE_SCOPE("write colored mesh");
+	const size_t numVertices = object.vertices.size() / 3;
+	const size_t numFaces = attributes.areas.size();
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	fprintf(fp, "ply\nformat binary_little_endian 1.0\n");
+	fprintf(fp, "element vertex %llu\nproperty float x\nproperty float y\nproperty float z\n", (unsigned long long)numVertices);
+	fprintf(fp, "element face %llu\nproperty list uchar int vertex_indices\n", (unsigned long long)numFaces);
+	fprintf(fp, "property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n");
+	bool ok = numVertices == 0 || fwrite(&object.vertices[0], sizeof(float) * 3, numVertices, fp) == numVertices;
+
+	// Faces are 16 bytes: count, indices and color.
+	const size_t faceSize = 1 + 3 * sizeof(int) + 3;
+	std::vector<unsigned char> faces(faceSize * numFaces);
+	size_t numColored = 0;
+	for (size_t f = 0; f < numFaces; f++) {
+		unsigned char* face = &faces[faceSize * f];
+		face[0] = 3;
+		memcpy(face + 1, &object.indices[3 * f], 3 * sizeof(int));
+		const unsigned long long weight = sums[4 * f + 3].load(std::memory_order_relaxed);
+		for (int c = 0; c < 3; c++) {
+			face[1 + 3 * sizeof(int) + c] = weight == 0 ? 0 :
+				(unsigned char)std::min<unsigned long long>(255, (sums[4 * f + c].load(std::memory_order_relaxed) + weight / 2) / weight);
+		}
+		if (weight != 0) {
+			numColored++;
+		}
+	}
+	ok = ok && (faces.empty() || fwrite(&faces[0], 1, faces.size(), fp) == faces.size());
+	if (fclose(fp) != 0 || !ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		return false;
+	}
+	printf("Fused colors into %d of %d faces, wrote %s\n", int(numColored), int(numFaces), path.c_str());
+	return true;
+}
@@ -0,0 +1,48 @@
+#ifndef COLORFUSION_HPP
+#define COLORFUSION_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "faceattributes.hpp"
+#include "mesh.hpp"
+#include "poses.hpp"
+
+// Per-face colors fused from the color frames of a scene (--fuse-colors), in the same pass
+// that renders the face maps, which never reach the disk. Pixel (x, y) of a face map sees the
+// same point as pixel (x, y) of its color image, both are projected with the intrinsics.
+//
+// Every pixel adds its color to its face, weighted by the cosine between the face normal and
+// the direction to the camera, so faces seen head-on and by many pixels dominate. Frames are
+// added concurrently from the encoder threads, which also decode the images: the sums are
+// 16.16 fixed point atomics, and runs of pixels on the same face are summed before they are
+// added, so the threads rarely touch the same face at the same time.
+class ColorFusion {
+public:
+	// object is the mesh of the scene and poses the camera to world matrices of its frames.
+	ColorFusion(const DrawObject& object, const PoseSet& poses, const std::vector<std::string>& colorFiles);
+
+	// Decodes the color image of frame and adds it to the faces of its face map. Returns false
+	// if the image can not be read or its size differs from the face map.
+	bool addFrame(size_t frame, const unsigned int* faceIds, int width, int height);
+
+	// Writes the mesh as binary PLY with one color per face. Faces that no frame saw are black.
+	bool writeColoredMesh(const std::string& path) const;
+
+private:
+	ColorFusion(const ColorFusion&);
+	ColorFusion& operator=(const ColorFusion&);
+
+	void addRun(unsigned int faceId, const unsigned int color[3], unsigned int count, const float center[3]);
+
+	const DrawObject& object;
+	const PoseSet& poses;
+	const std::vector<std::string>& colorFiles;
+	FaceAttributes attributes;
+	// Weighted red, green and blue and the sum of the weights, 4 per face.
+	std::unique_ptr<std::atomic<unsigned long long>[]> sums;
+};
+
+#endif
@@ -32,7 +32,8 @@ float speed = 3.0f; // 3 units / second
 float mouseSpeed = 0.005f;
 
 
-void setProjectionMatrix(float alpha, float beta, float cx, float cy, int width, int height) {
+glm::mat4 computeProjectionMatrix(float alpha, float beta, float cx, float cy, int width, int height) {
+	glm::mat4 ProjectionMatrix;
 	float f = 100.0f;
 	float n = 0.2f;
 	ProjectionMatrix[0][0] = 2 * alpha / width;
@@ -51,9 +52,14 @@ void setProjectionMatrix(float alpha, float beta, float cx, float cy, int width,
 	ProjectionMatrix[3][1] = 0;
 	ProjectionMatrix[3][2] = -2 * f * n / (f - n);
 	ProjectionMatrix[3][3] = 0;
+	return ProjectionMatrix;
 }
 
-void setViewMatrix(float matrixEntriesRowMajor[]) {
+void setProjectionMatrix(float alpha, float beta, float cx, float cy, int width, int height) {
+	ProjectionMatrix = computeProjectionMatrix(alpha, beta, cx, cy, width, height);
+}
+
+glm::mat4 computeViewMatrix(const float matrixEntriesRowMajor[]) {
 	glm::mat4x4 cam2WorldMatrix;
 	cam2WorldMatrix[0][0] = matrixEntriesRowMajor[0];
 	cam2WorldMatrix[1][0] = matrixEntriesRowMajor[1];
@@ -73,8 +79,11 @@ void setViewMatrix(float matrixEntriesRowMajor[]) {
 	cam2WorldMatrix[3][3] = matrixEntriesRowMajor[15];
 	glm::mat4x4 world2camMatrix = glm::inverse(cam2WorldMatrix);
 	glm::mat4x4 cam(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, -1, 0, 0, 0, 0, 1);
-	ViewMatrix = cam * world2camMatrix;
-	
+	return cam * world2camMatrix;
+}
+
+void setViewMatrix(float matrixEntriesRowMajor[]) {
+	ViewMatrix = computeViewMatrix(matrixEntriesRowMajor);
 }
 
 void computeMatricesFromInputs() {
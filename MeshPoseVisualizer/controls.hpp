@@ -8,4 +8,8 @@ glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
 void setProjectionMatrix(float alpha, float beta, float cx, float cy, int width, int height);
 void setViewMatrix(float matrixEntriesRowMajor[]);
+// Same as the setters above, but return the matrix instead of changing the global state,
+// so render threads can compute their own matrices.
+glm::mat4 computeProjectionMatrix(float alpha, float beta, float cx, float cy, int width, int height);
+glm::mat4 computeViewMatrix(const float matrixEntriesRowMajor[]);
 #endif
\ No newline at end of file
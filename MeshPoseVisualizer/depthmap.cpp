@@ -0,0 +1,141 @@
+#include "pch.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "stb_image_write.h"
+
+#include "depthmap.hpp"
+#include "facemap.hpp"
+#include "trace.hpp"
+
+static bool writeMapRaw(const std::string& path, const char magic[4], const void* values, size_t valueSize, size_t numValues, int width, int height) {
+	FaceMapHeader header;
+	memcpy(header.magic, magic, 4);
+	header.version = DEPTHMAP_RAW_VERSION;
+	header.width = width;
+	header.height = height;
+
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(values, valueSize, numValues, fp) == numValues;
+	return fclose(fp) == 0 && ok;
+}
+
+bool writeDepthMapRaw(const std::string& path, const float* depth, int width, int height) {
+	TRACE_SCOPE("write raw depth map");
+	return writeMapRaw(path, "DMAP", depth, sizeof(float), size_t(width) * height, width, height);
+}
+
+bool writeNormalMapRaw(const std::string& path, const float* normals, int width, int height) {
+	TRACE_SCOPE("write raw normal map");
+	return writeMapRaw(path, "NMAP", normals, sizeof(float), 3 * size_t(width) * height, width, height);
+}
+
+bool writeBarycentricMapRaw(const std::string& path, const unsigned short* barycentrics, int width, int height) {
+	TRACE_SCOPE("write raw barycentric map");
+	return writeMapRaw(path, "BARY", barycentrics, sizeof(unsigned short), 2 * size_t(width) * height, width, height);
+}
+
+bool writeNormalMapPNG(const std::string& path, const float* normals, int width, int height) {
+	TRACE_SCOPE("write PNG normal map");
+	const size_t numValues = 3 * size_t(width) * height;
+	std::vector<unsigned char> image(numValues);
+	for (size_t i = 0; i < numValues; i += 3) {
+		// Background stays black, no unit normal maps to (0, 0, 0).
+		if (normals[i] != 0.0f || normals[i + 1] != 0.0f || normals[i + 2] != 0.0f) {
+			for (int c = 0; c < 3; c++) {
+				image[i + c] = (unsigned char)floorf((normals[i + c] + 1.0f) * 127.5f + 0.5f);
+			}
+		}
+	}
+	return stbi_write_png(path.c_str(), width, height, 3, &image[0], width * 3) != 0;
+}
+
+// Quantizes a barycentric weight to 16 bits, see depthmap.hpp.
+static unsigned short quantizeWeight(float weight) {
+	return (unsigned short)(std::min(std::max(weight, 0.0f), 1.0f) * 65535.0f + 0.5f);
+}
+
+void computeFaceMapAttributes(const DrawObject& object, const glm::mat4& ViewMatrix, float fx, float fy, float cx, float cy,
+	int width, int height, const unsigned int* faceIds, float* depth, float* normals, unsigned short* barycentrics) {
+	TRACE_SCOPE("reconstruct attributes");
+	// The view matrix looks down -z like OpenGL, the camera frame of the poses down +z.
+	const glm::mat4 toCamera = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, -1.0f)) * ViewMatrix;
+	// Plane of the current face, dot(normal, p) = distance, and what the barycentrics of a point
+	// in it need. Neighbouring pixels mostly hit the same face, so this is only computed when the
+	// face changes.
+	unsigned int planeFace = 0;
+	glm::vec3 normal(0.0f);
+	float distance = 0.0f;
+	glm::vec3 origin(0.0f), edge1(0.0f), edge2(0.0f);
+	float d11 = 0.0f, d12 = 0.0f, d22 = 0.0f, inverseDenominator = 0.0f;
+	for (int y = 0; y < height; y++) {
+		const float rayY = (y + 0.5f - cy) / fy;
+		for (int x = 0; x < width; x++) {
+			const size_t p = size_t(y) * width + x;
+			const unsigned int faceId = faceIds[p];
+			float z = 0.0f;
+			glm::vec3 n(0.0f);
+			float b1 = 0.0f, b2 = 0.0f;
+			if (faceId != 0) {
+				if (faceId != planeFace) {
+					glm::vec3 corners[3];
+					for (int c = 0; c < 3; c++) {
+						const float* v = &object.vertices[3 * size_t(object.indices[3 * size_t(faceId - 1) + c])];
+						corners[c] = glm::vec3(toCamera * glm::vec4(v[0], v[1], v[2], 1.0f));
+					}
+					origin = corners[0];
+					edge1 = corners[1] - corners[0];
+					edge2 = corners[2] - corners[0];
+					normal = glm::cross(edge1, edge2);
+					const float length = glm::length(normal);
+					normal = length > 0.0f ? normal / length : glm::vec3(0.0f);
+					distance = glm::dot(normal, corners[0]);
+					// Towards the camera, which is at the origin.
+					if (distance > 0.0f) {
+						normal = -normal;
+						distance = -distance;
+					}
+					d11 = glm::dot(edge1, edge1);
+					d12 = glm::dot(edge1, edge2);
+					d22 = glm::dot(edge2, edge2);
+					const float denominator = d11 * d22 - d12 * d12;
+					inverseDenominator = denominator != 0.0f ? 1.0f / denominator : 0.0f;
+					planeFace = faceId;
+				}
+				const glm::vec3 ray((x + 0.5f - cx) / fx, rayY, 1.0f);
+				const float denominator = glm::dot(normal, ray);
+				if (denominator != 0.0f) {
+					z = distance / denominator;
+					n = normal;
+					const glm::vec3 offset = ray * z - origin;
+					const float d1 = glm::dot(offset, edge1);
+					const float d2 = glm::dot(offset, edge2);
+					b1 = (d22 * d1 - d12 * d2) * inverseDenominator;
+					b2 = (d11 * d2 - d12 * d1) * inverseDenominator;
+				}
+			}
+			if (depth) {
+				depth[p] = z;
+			}
+			if (normals) {
+				normals[3 * p] = n.x;
+				normals[3 * p + 1] = n.y;
+				normals[3 * p + 2] = n.z;
+			}
+			if (barycentrics) {
+				barycentrics[2 * p] = quantizeWeight(b1);
+				barycentrics[2 * p + 1] = quantizeWeight(b2);
+			}
+		}
+	}
+}
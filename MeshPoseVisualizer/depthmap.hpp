@@ -0,0 +1,39 @@
+#ifndef DEPTHMAP_HPP
+#define DEPTHMAP_HPP
+
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+
+// Depth, normal and barycentric maps, rendered in the same pass as the face maps (--depth,
+// --normals, --barycentrics).
+// Depth is the metric distance along the optical axis. Normals are the unit normals of the
+// faces in the camera frame of the poses (x right, y down, z forward), turned towards the
+// camera. Barycentrics are the weights of the second and third vertex of the face at the
+// pixel center, the first one is 1 minus both, quantized to 16 bits (65535 is 1).
+// Pixels where no face was hit are 0 in all maps.
+//
+// Raw maps (.depth.bin, .normals.bin) are little-endian: a FaceMapHeader with the magic "DMAP"
+// or "NMAP", followed by width * height floats for depth or width * height xyz triples for
+// normals, rows from top to bottom.
+// PNG normal maps (.normals.png) store (n + 1) / 2 * 255 per channel.
+// Barycentric maps (.barycentrics.bin) have the magic "BARY" and two 16-bit weights per pixel.
+// Depth and barycentrics are only written raw, stb_image_write has no 16-bit PNG encoder.
+
+static const unsigned int DEPTHMAP_RAW_VERSION = 1;
+
+bool writeDepthMapRaw(const std::string& path, const float* depth, int width, int height);
+bool writeNormalMapRaw(const std::string& path, const float* normals, int width, int height);
+bool writeNormalMapPNG(const std::string& path, const float* normals, int width, int height);
+bool writeBarycentricMapRaw(const std::string& path, const unsigned short* barycentrics, int width, int height);
+
+// Depth, normals and barycentrics for a face map of the software rasterizer, which has no
+// attributes to interpolate: the ray through the center of every pixel is intersected with the
+// plane of its face, which gives what the GPU interpolates. ViewMatrix is the one of
+// computeViewMatrix and fx, fy, cx, cy are the intrinsics. Any of the outputs may be null.
+void computeFaceMapAttributes(const DrawObject& object, const glm::mat4& ViewMatrix, float fx, float fy, float cx, float cy,
+	int width, int height, const unsigned int* faceIds, float* depth, float* normals, unsigned short* barycentrics);
+
+#endif
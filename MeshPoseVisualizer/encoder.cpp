@@ -0,0 +1,113 @@
+#include "pch.h"
+#include <algorithm>
+#include <stdio.h>
+
+#include "encoder.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+EncodePipeline::EncodePipeline(int numThreads, size_t numBuffers, size_t numPixels, bool withDepth, bool withNormals, bool withBarycentrics,
+	const std::function<void(const EncodeJob&)>& encode)
+	: encode(encode), stopping(false), maxQueueDepth(0), queueDepthSum(0), numSubmitted(0), acquireWaitSeconds(0.0) {
+	for (size_t i = 0; i < std::max<size_t>(numBuffers, 1); i++) {
+		std::unique_ptr<EncodeJob> job(new EncodeJob());
+		job->faceIds.resize(numPixels);
+		job->depth.resize(withDepth ? numPixels : 0);
+		job->normals.resize(withNormals ? 3 * numPixels : 0);
+		job->barycentrics.resize(withBarycentrics ? 2 * numPixels : 0);
+		freeBuffers.push_back(std::move(job));
+	}
+	for (int i = 0; i < std::max(numThreads, 1); i++) {
+		threads.push_back(std::thread(&EncodePipeline::encoderLoop, this));
+	}
+}
+
+EncodePipeline::~EncodePipeline() {
+	finish();
+}
+
+std::unique_ptr<EncodeJob> EncodePipeline::acquire() {
+	TRACE_SCOPE("wait for encode buffer");
+	auto start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(mutex);
+	freeCondition.wait(lock, [this] { return !freeBuffers.empty(); });
+	std::unique_ptr<EncodeJob> job = std::move(freeBuffers.back());
+	freeBuffers.pop_back();
+	acquireWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return job;
+}
+
+void EncodePipeline::submit(std::unique_ptr<EncodeJob> job) {
+	job->submitTime = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(job));
+		maxQueueDepth = std::max(maxQueueDepth, queue.size());
+		queueDepthSum += queue.size();
+		numSubmitted++;
+		traceCounter("encode queue", (long long)queue.size());
+	}
+	queueCondition.notify_one();
+}
+
+void EncodePipeline::finish() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stopping) {
+			return;
+		}
+		stopping = true;
+	}
+	queueCondition.notify_all();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void EncodePipeline::encoderLoop() {
+	setTraceThreadName("encoder");
+	for (;;) {
+		std::unique_ptr<EncodeJob> job;
+		{
+			TRACE_SCOPE("wait for frame");
+			std::unique_lock<std::mutex> lock(mutex);
+			// Keep draining the queue after finish() was called.
+			queueCondition.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		{
+			TRACE_SCOPE("encode");
+			encode(*job);
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queueSeconds.push_back(std::chrono::duration<double>(start - job->submitTime).count());
+			encodeSeconds.push_back(std::chrono::duration<double>(end - start).count());
+			freeBuffers.push_back(std::move(job));
+		}
+		freeCondition.notify_one();
+	}
+}
+
+void EncodePipeline::printStats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	double sum = 0.0;
+	for (size_t i = 0; i < encodeSeconds.size(); i++) {
+		sum += encodeSeconds[i];
+	}
+	double mean = encodeSeconds.empty() ? 0.0 : sum / encodeSeconds.size();
+	printf("Encoded %d frames on %d threads: encode latency mean %.1f ms, p50 %.1f ms, p95 %.1f ms, max %.1f ms\n",
+		int(encodeSeconds.size()), int(threads.size()), mean * 1000.0, percentile(encodeSeconds, 0.5) * 1000.0,
+		percentile(encodeSeconds, 0.95) * 1000.0, percentile(encodeSeconds, 1.0) * 1000.0);
+	printf("Encode queue depth mean %.1f, max %d; queue wait p95 %.1f ms; render workers waited %.2f s in total for free buffers\n",
+		numSubmitted ? double(queueDepthSum) / numSubmitted : 0.0, int(maxQueueDepth),
+		percentile(queueSeconds, 0.95) * 1000.0, acquireWaitSeconds);
+}
@@ -0,0 +1,66 @@
+#ifndef ENCODER_HPP
+#define ENCODER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A rendered frame waiting to be compressed and written.
+struct EncodeJob {
+	size_t frame;
+	std::vector<unsigned int> faceIds; // 1-based face ids, rows from top to bottom
+	std::vector<float> depth;          // same layout, empty unless depth maps are written
+	std::vector<float> normals;        // xyz per pixel, empty unless normal maps are written
+	std::vector<unsigned short> barycentrics; // 2 per pixel, empty unless barycentric maps are written
+	std::chrono::steady_clock::time_point submitTime;
+};
+
+// Bounded producer/consumer stage between the render workers and the image files.
+// Render workers take a buffer from a fixed pool, fill it and submit it; encoder threads
+// compress and write it, then return the buffer to the pool. When all buffers are in
+// flight acquire() blocks, so memory stays bounded and rendering waits for the encoders.
+class EncodePipeline {
+public:
+	// encode is called on the encoder threads, once per submitted job. Every buffer holds
+	// numPixels face ids, and depth, normals and barycentrics of as many pixels if requested.
+	EncodePipeline(int numThreads, size_t numBuffers, size_t numPixels, bool withDepth, bool withNormals, bool withBarycentrics,
+		const std::function<void(const EncodeJob&)>& encode);
+	~EncodePipeline();
+
+	// Takes a free buffer from the pool, blocks while none is available.
+	std::unique_ptr<EncodeJob> acquire();
+	// Queues a filled buffer for the encoder threads.
+	void submit(std::unique_ptr<EncodeJob> job);
+	// Waits until every submitted job is written and stops the encoder threads.
+	void finish();
+
+	// Prints queue depth, encode latency and the time renderers were blocked by backpressure.
+	void printStats() const;
+
+private:
+	void encoderLoop();
+
+	std::function<void(const EncodeJob&)> encode;
+	std::vector<std::thread> threads;
+	mutable std::mutex mutex;
+	std::condition_variable queueCondition;
+	std::condition_variable freeCondition;
+	std::deque<std::unique_ptr<EncodeJob> > queue;
+	std::vector<std::unique_ptr<EncodeJob> > freeBuffers;
+	bool stopping;
+
+	// Statistics, guarded by mutex.
+	size_t maxQueueDepth;
+	size_t queueDepthSum;
+	size_t numSubmitted;
+	double acquireWaitSeconds;
+	std::vector<double> queueSeconds;
+	std::vector<double> encodeSeconds;
+};
+
+#endif
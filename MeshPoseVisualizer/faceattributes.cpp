@@ -0,0 +1,270 @@
+#include "pch.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FACE_ATTRIBUTES_SSE
+#endif
+
+#include "faceattributes.hpp"
+#include "trace.hpp"
+
+// Faces are processed in blocks, a multiple of the SIMD width so only the last block has a
+// scalar tail.
+static const size_t BLOCK_FACES = 1 << 16;
+
+// Computes the attributes of faces [first, end). normals and centroids may be null when only
+// the areas are needed. The SIMD and the scalar path use the same operations in the same
+// order, so the results do not depend on where a face falls.
+static void computeBlock(const float* vertices, const unsigned int* indices, size_t first, size_t end,
+	float* areas, float* const* normals, float* const* centroids) {
+	const float third = 1.0f / 3.0f;
+	size_t f = first;
+#ifdef FACE_ATTRIBUTES_SSE
+	for (; f + 4 <= end; f += 4) {
+		// Gather the corners of four faces into lanes, corner by axis.
+		float corners[3][3][4];
+		for (int lane = 0; lane < 4; lane++) {
+			for (int c = 0; c < 3; c++) {
+				const float* v = vertices + 3 * size_t(indices[3 * (f + lane) + c]);
+				corners[c][0][lane] = v[0];
+				corners[c][1][lane] = v[1];
+				corners[c][2][lane] = v[2];
+			}
+		}
+		__m128 p[3][3];
+		for (int c = 0; c < 3; c++) {
+			for (int k = 0; k < 3; k++) {
+				p[c][k] = _mm_loadu_ps(corners[c][k]);
+			}
+		}
+		__m128 e1[3], e2[3];
+		for (int k = 0; k < 3; k++) {
+			e1[k] = _mm_sub_ps(p[1][k], p[0][k]);
+			e2[k] = _mm_sub_ps(p[2][k], p[0][k]);
+		}
+		__m128 n[3];
+		n[0] = _mm_sub_ps(_mm_mul_ps(e1[1], e2[2]), _mm_mul_ps(e1[2], e2[1]));
+		n[1] = _mm_sub_ps(_mm_mul_ps(e1[2], e2[0]), _mm_mul_ps(e1[0], e2[2]));
+		n[2] = _mm_sub_ps(_mm_mul_ps(e1[0], e2[1]), _mm_mul_ps(e1[1], e2[0]));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1])), _mm_mul_ps(n[2], n[2])));
+		_mm_storeu_ps(areas + f, _mm_mul_ps(_mm_set1_ps(0.5f), length));
+		if (normals) {
+			// Degenerate faces get a zero normal instead of NaN.
+			__m128 inverse = _mm_and_ps(_mm_cmpgt_ps(length, _mm_setzero_ps()), _mm_div_ps(_mm_set1_ps(1.0f), length));
+			for (int k = 0; k < 3; k++) {
+				_mm_storeu_ps(normals[k] + f, _mm_mul_ps(n[k], inverse));
+			}
+		}
+		if (centroids) {
+			for (int k = 0; k < 3; k++) {
+				_mm_storeu_ps(centroids[k] + f, _mm_mul_ps(_mm_add_ps(_mm_add_ps(p[0][k], p[1][k]), p[2][k]), _mm_set1_ps(third)));
+			}
+		}
+	}
+#endif
+	for (; f < end; f++) {
+		const float* p[3];
+		for (int c = 0; c < 3; c++) {
+			p[c] = vertices + 3 * size_t(indices[3 * f + c]);
+		}
+		float e1[3], e2[3];
+		for (int k = 0; k < 3; k++) {
+			e1[k] = p[1][k] - p[0][k];
+			e2[k] = p[2][k] - p[0][k];
+		}
+		float n[3];
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		areas[f] = 0.5f * length;
+		if (normals) {
+			float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+			for (int k = 0; k < 3; k++) {
+				normals[k][f] = n[k] * inverse;
+			}
+		}
+		if (centroids) {
+			for (int k = 0; k < 3; k++) {
+				centroids[k][f] = (p[0][k] + p[1][k] + p[2][k]) * third;
+			}
+		}
+	}
+}
+
+static void computeAttributes(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, TaskPool& pool,
+	float* areas, float* const* normals, float* const* centroids) {
+	TRACE_SCOPE("compute face attributes");
+	const size_t numFaces = indices.size() / 3;
+	if (numFaces == 0) {
+		return;
+	}
+	pool.parallelFor((numFaces + BLOCK_FACES - 1) / BLOCK_FACES, [&](size_t block, int) {
+		computeBlock(vertices.data(), indices.data(), block * BLOCK_FACES, std::min(numFaces, (block + 1) * BLOCK_FACES), areas, normals, centroids);
+	});
+}
+
+void computeFaceAreas(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, TaskPool& pool, std::vector<float>& areas) {
+	areas.resize(indices.size() / 3);
+	computeAttributes(vertices, indices, pool, areas.data(), nullptr, nullptr);
+}
+
+void computeFaceAttributes(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, TaskPool& pool, FaceAttributes& attributes) {
+	const size_t numFaces = indices.size() / 3;
+	attributes.areas.resize(numFaces);
+	float* normals[3];
+	float* centroids[3];
+	for (int k = 0; k < 3; k++) {
+		attributes.normals[k].resize(numFaces);
+		attributes.centroids[k].resize(numFaces);
+		normals[k] = attributes.normals[k].data();
+		centroids[k] = attributes.centroids[k].data();
+	}
+	computeAttributes(vertices, indices, pool, attributes.areas.data(), normals, centroids);
+}
+
+static bool writeFloats(FILE* fp, const std::vector<float>& values) {
+	return values.empty() || fwrite(values.data(), sizeof(float), values.size(), fp) == values.size();
+}
+
+bool writeFaceAttributes(const std::string& path, const FaceAttributes& attributes) {
+	TRACE_SCOPE("write face_attributes.bin");
+	FaceAttributesHeader header;
+	memcpy(header.magic, "FATR", 4);
+	header.version = FACE_ATTRIBUTES_VERSION;
+	header.numFaces = attributes.areas.size();
+
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && writeFloats(fp, attributes.areas);
+	for (int k = 0; k < 3 && ok; k++) {
+		ok = writeFloats(fp, attributes.normals[k]);
+	}
+	for (int k = 0; k < 3 && ok; k++) {
+		ok = writeFloats(fp, attributes.centroids[k]);
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+	}
+	return ok;
+}
+
+// Formats value followed by a newline exactly like printf("%g\n"), which is what ostream
+// prints for a float with the default precision of 6. The 6 significant digits are rounded in
+// double precision, which is exact unless the value is very close to halfway between two
+// results; those and special values go through snprintf. Returns the length.
+static int formatArea(float value, char* text) {
+	const double v = value;
+	if (!(v > 0.0) || !isfinite(v)) {
+		return snprintf(text, 32, "%g\n", value);
+	}
+	int exponent = int(floor(log10(v)));
+	double scaled = v * pow(10.0, 5 - exponent);
+	if (scaled >= 1e6) {
+		scaled /= 10.0;
+		exponent++;
+	}
+	else if (scaled < 1e5) {
+		scaled *= 10.0;
+		exponent--;
+	}
+	const double fraction = scaled - floor(scaled);
+	if (fabs(fraction - 0.5) < 1e-6) {
+		return snprintf(text, 32, "%g\n", value);
+	}
+	long long significand = (long long)floor(scaled + 0.5);
+	if (significand >= 1000000) {
+		significand /= 10;
+		exponent++;
+	}
+	char digits[6];
+	for (int i = 5; i >= 0; i--) {
+		digits[i] = char('0' + significand % 10);
+		significand /= 10;
+	}
+	int numDigits = 6;
+	while (numDigits > 1 && digits[numDigits - 1] == '0') {
+		numDigits--;
+	}
+
+	char* p = text;
+	if (exponent < -4 || exponent >= 6) {
+		*p++ = digits[0];
+		if (numDigits > 1) {
+			*p++ = '.';
+			for (int i = 1; i < numDigits; i++) {
+				*p++ = digits[i];
+			}
+		}
+		*p++ = 'e';
+		*p++ = exponent < 0 ? '-' : '+';
+		int magnitude = exponent < 0 ? -exponent : exponent;
+		if (magnitude >= 100) {
+			*p++ = char('0' + magnitude / 100);
+		}
+		*p++ = char('0' + magnitude / 10 % 10);
+		*p++ = char('0' + magnitude % 10);
+	}
+	else if (exponent >= 0) {
+		for (int i = 0; i <= exponent; i++) {
+			*p++ = digits[i];
+		}
+		if (numDigits > exponent + 1) {
+			*p++ = '.';
+			for (int i = exponent + 1; i < numDigits; i++) {
+				*p++ = digits[i];
+			}
+		}
+	}
+	else {
+		*p++ = '0';
+		*p++ = '.';
+		for (int i = 1; i < -exponent; i++) {
+			*p++ = '0';
+		}
+		for (int i = 0; i < numDigits; i++) {
+			*p++ = digits[i];
+		}
+	}
+	*p++ = '\n';
+	return int(p - text);
+}
+
+bool writeFaceAreasText(const std::string& path, const std::vector<float>& areas, TaskPool& pool) {
+	TRACE_SCOPE("write areas.txt");
+	const size_t numBlocks = (areas.size() + BLOCK_FACES - 1) / BLOCK_FACES;
+	std::vector<std::string> blocks(numBlocks);
+	pool.parallelFor(numBlocks, [&](size_t block, int) {
+		const size_t end = std::min(areas.size(), (block + 1) * BLOCK_FACES);
+		std::string& text = blocks[block];
+		text.reserve((end - block * BLOCK_FACES) * 12);
+		char line[32];
+		for (size_t f = block * BLOCK_FACES; f < end; f++) {
+			text.append(line, formatArea(areas[f], line));
+		}
+	});
+
+	// Text mode, so the lines end like the ones ofstream wrote before.
+	FILE* fp = fopen(path.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	bool ok = true;
+	for (size_t b = 0; b < numBlocks && ok; b++) {
+		ok = fwrite(blocks[b].data(), 1, blocks[b].size(), fp) == blocks[b].size();
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+	}
+	return ok;
+}
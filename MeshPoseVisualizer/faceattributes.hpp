@@ -0,0 +1,43 @@
+#ifndef FACEATTRIBUTES_HPP
+#define FACEATTRIBUTES_HPP
+
+#include <string>
+#include <vector>
+
+#include "parallel.hpp"
+
+// Geometry of every face of an indexed triangle mesh, one array per component so the
+// kernel can compute several faces per SIMD instruction.
+struct FaceAttributes {
+	std::vector<float> areas;
+	std::vector<float> normals[3];   // unit normals by axis, 0 for degenerate faces
+	std::vector<float> centroids[3]; // by axis
+};
+
+// Binary face attributes (face_attributes.bin), little-endian:
+//   FaceAttributesHeader
+//   float areas[numFaces]
+//   float normals[3][numFaces]     x of all faces, then y, then z
+//   float centroids[3][numFaces]
+// Faces are 0-based like the lines of areas.txt (face id - 1).
+struct FaceAttributesHeader {
+	char magic[4]; // "FATR"
+	unsigned int version;
+	unsigned long long numFaces;
+};
+
+static const unsigned int FACE_ATTRIBUTES_VERSION = 1;
+
+// Computes the area of every triangle of indices on all threads of pool.
+void computeFaceAreas(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, TaskPool& pool, std::vector<float>& areas);
+
+// Computes areas, unit normals and centroids of every triangle of indices on all threads of pool.
+void computeFaceAttributes(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, TaskPool& pool, FaceAttributes& attributes);
+
+bool writeFaceAttributes(const std::string& path, const FaceAttributes& attributes);
+
+// Writes one area per line, formatted like ostream << float. Blocks of faces are formatted
+// in parallel and written in order.
+bool writeFaceAreasText(const std::string& path, const std::vector<float>& areas, TaskPool& pool);
+
+#endif
@@ -0,0 +1,188 @@
+#include "pch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+#include "facemap.hpp"
+#include "facemapcodec.hpp"
+#include "trace.hpp"
+
+static FaceMapHeader makeRawHeader(int width, int height) {
+	FaceMapHeader header;
+	memcpy(header.magic, "FMAP", 4);
+	header.version = FACEMAP_RAW_VERSION;
+	header.width = width;
+	header.height = height;
+	return header;
+}
+
+bool writeFaceMapRaw(const std::string& path, const unsigned int* faceIds, int width, int height) {
+	TRACE_SCOPE("write raw face map");
+	const FaceMapHeader header = makeRawHeader(width, height);
+
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	// All supported platforms are little-endian, so the ids are written as they are in memory.
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(faceIds, sizeof(unsigned int), size_t(width) * height, fp) == size_t(width) * height;
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+	}
+	return ok;
+}
+
+// Bytes of the id in the channels, lowest byte in red.
+static std::vector<unsigned char> toChannels(const unsigned int* faceIds, size_t numPixels, int channels) {
+	std::vector<unsigned char> image(numPixels * channels);
+	for (size_t p = 0; p < numPixels; p++) {
+		unsigned int id = faceIds[p];
+		for (int c = 0; c < channels; c++) {
+			image[channels * p + c] = (unsigned char)((id >> (8 * c)) & 0xFF);
+		}
+	}
+	return image;
+}
+
+bool writeFaceMapPNG(const std::string& path, const unsigned int* faceIds, int width, int height, bool withAlpha) {
+	TRACE_SCOPE("write PNG face map");
+	const int channels = withAlpha ? 4 : 3;
+	std::vector<unsigned char> image = toChannels(faceIds, size_t(width) * height, channels);
+	if (image.empty() || stbi_write_png(path.c_str(), width, height, channels, &image[0], width * channels) == 0) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool writeFaceMapRLE(const std::string& path, const unsigned int* faceIds, int width, int height) {
+	TRACE_SCOPE("write RLE face map");
+	std::vector<unsigned char> file;
+	encodeFaceMapRLE(faceIds, width, height, file);
+
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	bool ok = fwrite(&file[0], 1, file.size(), fp) == file.size();
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+	}
+	return ok;
+}
+
+bool readFaceMapRaw(const std::string& path, std::vector<unsigned int>& faceIds, int& width, int& height) {
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp) {
+		return false;
+	}
+	FaceMapHeader header;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, "FMAP", 4) == 0 && header.version == FACEMAP_RAW_VERSION;
+	if (ok) {
+		width = int(header.width);
+		height = int(header.height);
+		faceIds.resize(size_t(width) * height);
+		ok = faceIds.empty() || fread(&faceIds[0], sizeof(unsigned int), faceIds.size(), fp) == faceIds.size();
+	}
+	fclose(fp);
+	return ok;
+}
+
+// Face maps without alpha hold 24-bit ids.
+static void fromChannels(const unsigned char* image, size_t numPixels, int channels, std::vector<unsigned int>& faceIds) {
+	faceIds.resize(numPixels);
+	for (size_t p = 0; p < numPixels; p++) {
+		unsigned int id = 0;
+		for (int c = 0; c < channels; c++) {
+			id |= (unsigned int)image[channels * p + c] << (8 * c);
+		}
+		faceIds[p] = id;
+	}
+}
+
+bool readFaceMapPNG(const std::string& path, std::vector<unsigned int>& faceIds, int& width, int& height) {
+	int channels;
+	unsigned char* image = stbi_load(path.c_str(), &width, &height, &channels, 0);
+	if (!image) {
+		return false;
+	}
+	fromChannels(image, size_t(width) * height, channels, faceIds);
+	stbi_image_free(image);
+	return true;
+}
+
+bool readFaceMapRLE(const std::string& path, std::vector<unsigned int>& faceIds, int& width, int& height) {
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp) {
+		return false;
+	}
+	std::vector<unsigned char> file;
+	unsigned char buffer[65536];
+	size_t numRead;
+	while ((numRead = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+		file.insert(file.end(), buffer, buffer + numRead);
+	}
+	fclose(fp);
+	return !file.empty() && decodeFaceMapRLE(&file[0], file.size(), faceIds, width, height);
+}
+
+void encodeFaceMapRaw(const unsigned int* faceIds, int width, int height, std::vector<unsigned char>& file) {
+	const FaceMapHeader header = makeRawHeader(width, height);
+	const size_t numBytes = sizeof(unsigned int) * size_t(width) * height;
+	file.resize(sizeof(header) + numBytes);
+	memcpy(&file[0], &header, sizeof(header));
+	memcpy(&file[sizeof(header)], faceIds, numBytes);
+}
+
+// stbi_write_func that appends the PNG to the std::vector<unsigned char> in context.
+static void appendToVector(void* context, void* data, int size) {
+	std::vector<unsigned char>& file = *(std::vector<unsigned char>*)context;
+	file.insert(file.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+}
+
+bool encodeFaceMapPNG(const unsigned int* faceIds, int width, int height, bool withAlpha, std::vector<unsigned char>& file) {
+	TRACE_SCOPE("encode PNG face map");
+	const int channels = withAlpha ? 4 : 3;
+	std::vector<unsigned char> image = toChannels(faceIds, size_t(width) * height, channels);
+	file.clear();
+	return !image.empty() && stbi_write_png_to_func(appendToVector, &file, width, height, channels, &image[0], width * channels) != 0;
+}
+
+bool decodeFaceMapRaw(const unsigned char* file, size_t size, std::vector<unsigned int>& faceIds, int& width, int& height) {
+	FaceMapHeader header;
+	if (size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, file, sizeof(header));
+	if (memcmp(header.magic, "FMAP", 4) != 0 || header.version != FACEMAP_RAW_VERSION ||
+		(size - sizeof(header)) / sizeof(unsigned int) != size_t(header.width) * header.height) {
+		return false;
+	}
+	width = int(header.width);
+	height = int(header.height);
+	faceIds.resize(size_t(width) * height);
+	if (!faceIds.empty()) {
+		memcpy(&faceIds[0], file + sizeof(header), faceIds.size() * sizeof(unsigned int));
+	}
+	return true;
+}
+
+bool decodeFaceMapPNG(const unsigned char* file, size_t size, std::vector<unsigned int>& faceIds, int& width, int& height) {
+	int channels;
+	unsigned char* image = stbi_load_from_memory(file, int(size), &width, &height, &channels, 0);
+	if (!image) {
+		return false;
+	}
+	fromChannels(image, size_t(width) * height, channels, faceIds);
+	stbi_image_free(image);
+	return true;
+}
@@ -0,0 +1,43 @@
+#ifndef FACEMAP_HPP
+#define FACEMAP_HPP
+
+#include <string>
+#include <vector>
+
+// Face ids are the 1-based index of the face in the mesh, 0 marks pixels where no face was hit.
+//
+// Raw face maps (.facemap.bin) are little-endian: a FaceMapHeader followed by width * height
+// 32-bit ids, rows from top to bottom. The ids start 16 bytes into the file, so a memory
+// mapped file can be used as an id array directly.
+struct FaceMapHeader {
+	char magic[4]; // "FMAP"
+	unsigned int version;
+	unsigned int width;
+	unsigned int height;
+};
+
+static const unsigned int FACEMAP_RAW_VERSION = 1;
+
+bool writeFaceMapRaw(const std::string& path, const unsigned int* faceIds, int width, int height);
+
+// Writes the ids as a PNG image whose channels hold the bytes of the id, lowest byte in red.
+// Without alpha only the lower 24 bits are stored, which is the layout of the original face maps.
+bool writeFaceMapPNG(const std::string& path, const unsigned int* faceIds, int width, int height, bool withAlpha);
+
+// Writes the ids with the run-length codec of facemapcodec.hpp (.facemap.rle).
+bool writeFaceMapRLE(const std::string& path, const unsigned int* faceIds, int width, int height);
+
+// Read face maps back, faceIds receives width * height ids. Return false if the file is
+// missing or has another format.
+bool readFaceMapRaw(const std::string& path, std::vector<unsigned int>& faceIds, int& width, int& height);
+bool readFaceMapPNG(const std::string& path, std::vector<unsigned int>& faceIds, int& width, int& height);
+bool readFaceMapRLE(const std::string& path, std::vector<unsigned int>& faceIds, int& width, int& height);
+
+// In-memory versions for the face map archive, file holds the bytes of a .facemap.bin or .png
+// file. The RLE versions are in facemapcodec.hpp.
+void encodeFaceMapRaw(const unsigned int* faceIds, int width, int height, std::vector<unsigned char>& file);
+bool encodeFaceMapPNG(const unsigned int* faceIds, int width, int height, bool withAlpha, std::vector<unsigned char>& file);
+bool decodeFaceMapRaw(const unsigned char* file, size_t size, std::vector<unsigned int>& faceIds, int& width, int& height);
+bool decodeFaceMapPNG(const unsigned char* file, size_t size, std::vector<unsigned int>& faceIds, int& width, int& height);
+
+#endif
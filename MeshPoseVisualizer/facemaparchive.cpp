@@ -0,0 +1,189 @@
+#include "pch.h"
+#include <string.h>
+
+#include "facemap.hpp"
+#include "facemapcodec.hpp"
+#include "facemaparchive.hpp"
+#include "trace.hpp"
+
+// Entries start at multiples of this.
+static const unsigned long long ENTRY_ALIGNMENT = 16;
+// Index offset, number of entries and magic.
+static const size_t TRAILER_SIZE = 8 + 4 + 4;
+
+FaceMapArchiveWriter::FaceMapArchiveWriter() : fp(NULL), offset(0), failed(false) {
+}
+
+FaceMapArchiveWriter::~FaceMapArchiveWriter() {
+	if (fp) {
+		fclose(fp);
+		remove((path + ".partial").c_str());
+	}
+}
+
+bool FaceMapArchiveWriter::open(const std::string& path, int width, int height) {
+	this->path = path;
+	fp = fopen((path + ".partial").c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s.partial\n", path.c_str());
+		return false;
+	}
+	FaceMapHeader header;
+	memcpy(header.magic, "FARC", 4);
+	header.version = FACEMAP_ARCHIVE_VERSION;
+	header.width = width;
+	header.height = height;
+	failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+	offset = sizeof(header);
+	entries.clear();
+	return !failed;
+}
+
+bool FaceMapArchiveWriter::add(const std::string& name, FaceMapCodec codec, const std::vector<unsigned char>& data) {
+	TRACE_SCOPE("append to archive");
+	static const unsigned char padding[ENTRY_ALIGNMENT] = { 0 };
+	std::lock_guard<std::mutex> lock(mutex);
+	if (failed) {
+		return false;
+	}
+	const size_t paddingSize = size_t((ENTRY_ALIGNMENT - offset % ENTRY_ALIGNMENT) % ENTRY_ALIGNMENT);
+	if ((paddingSize > 0 && fwrite(padding, 1, paddingSize, fp) != paddingSize) ||
+		(!data.empty() && fwrite(&data[0], 1, data.size(), fp) != data.size())) {
+		fprintf(stderr, "Failed to write to %s.partial\n", path.c_str());
+		failed = true;
+		return false;
+	}
+	const Entry entry = { name, codec, offset + paddingSize, data.size() };
+	entries.push_back(entry);
+	offset = entry.offset + entry.size;
+	return true;
+}
+
+bool FaceMapArchiveWriter::finish() {
+	TRACE_SCOPE("write archive index");
+	std::vector<unsigned char> index;
+	for (size_t i = 0; i < entries.size(); i++) {
+		const Entry& entry = entries[i];
+		const unsigned int fields[2] = { (unsigned int)entry.codec, (unsigned int)entry.name.size() };
+		index.insert(index.end(), (const unsigned char*)&entry.offset, (const unsigned char*)&entry.offset + 8);
+		index.insert(index.end(), (const unsigned char*)&entry.size, (const unsigned char*)&entry.size + 8);
+		index.insert(index.end(), (const unsigned char*)fields, (const unsigned char*)fields + 8);
+		index.insert(index.end(), entry.name.begin(), entry.name.end());
+	}
+	const unsigned int numEntries = (unsigned int)entries.size();
+	index.insert(index.end(), (const unsigned char*)&offset, (const unsigned char*)&offset + 8);
+	index.insert(index.end(), (const unsigned char*)&numEntries, (const unsigned char*)&numEntries + 4);
+	index.insert(index.end(), "FIDX", "FIDX" + 4);
+
+	const std::string tempFile = path + ".partial";
+	bool ok = !failed && fwrite(&index[0], 1, index.size(), fp) == index.size();
+	ok = fclose(fp) == 0 && ok;
+	fp = NULL;
+	if (ok) {
+		// rename does not replace existing files on Windows.
+		remove(path.c_str());
+		ok = rename(tempFile.c_str(), path.c_str()) == 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		remove(tempFile.c_str());
+		return false;
+	}
+	printf("Archived %d face maps in %s, %.1f MB\n", int(numEntries), path.c_str(), (offset + index.size()) / 1e6);
+	return true;
+}
+
+bool FaceMapArchiveReader::open(const std::string& path) {
+	entries.clear();
+	if (!file.open(path)) {
+		return false;
+	}
+	const unsigned char* bytes = (const unsigned char*)file.data();
+	const size_t size = file.size();
+	FaceMapHeader header;
+	if (size < sizeof(header) + TRAILER_SIZE) {
+		return false;
+	}
+	memcpy(&header, bytes, sizeof(header));
+	unsigned long long indexOffset;
+	unsigned int numEntries;
+	memcpy(&indexOffset, bytes + size - TRAILER_SIZE, 8);
+	memcpy(&numEntries, bytes + size - TRAILER_SIZE + 8, 4);
+	if (memcmp(header.magic, "FARC", 4) != 0 || header.version != FACEMAP_ARCHIVE_VERSION ||
+		memcmp(bytes + size - 4, "FIDX", 4) != 0 || indexOffset < sizeof(header) || indexOffset > size - TRAILER_SIZE) {
+		return false;
+	}
+	width = int(header.width);
+	height = int(header.height);
+
+	const unsigned char* in = bytes + indexOffset;
+	const unsigned char* end = bytes + size - TRAILER_SIZE;
+	for (unsigned int i = 0; i < numEntries; i++) {
+		Entry entry;
+		unsigned int fields[2];
+		if (end - in < 24) {
+			return false;
+		}
+		memcpy(&entry.offset, in, 8);
+		memcpy(&entry.size, in + 8, 8);
+		memcpy(fields, in + 16, 8);
+		in += 24;
+		if (fields[1] > size_t(end - in) || entry.offset > indexOffset || entry.size > indexOffset - entry.offset) {
+			return false;
+		}
+		entries[std::make_pair(std::string((const char*)in, fields[1]), fields[0])] = entry;
+		in += fields[1];
+	}
+	return in == end;
+}
+
+std::vector<std::string> FaceMapArchiveReader::getFrameNames() const {
+	std::vector<std::string> names;
+	for (std::map<std::pair<std::string, unsigned int>, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (names.empty() || names.back() != it->first.first) {
+			names.push_back(it->first.first);
+		}
+	}
+	return names;
+}
+
+bool FaceMapArchiveReader::readFrame(const std::string& name, std::vector<unsigned int>& faceIds, int& width, int& height) const {
+	static const FaceMapCodec preferred[3] = { FACEMAP_CODEC_RAW, FACEMAP_CODEC_RLE, FACEMAP_CODEC_PNG };
+	for (int c = 0; c < 3; c++) {
+		if (entries.count(std::make_pair(name, (unsigned int)preferred[c])) != 0) {
+			return readFrame(name, preferred[c], faceIds, width, height);
+		}
+	}
+	return false;
+}
+
+bool FaceMapArchiveReader::readFrame(const std::string& name, FaceMapCodec codec, std::vector<unsigned int>& faceIds, int& width, int& height) const {
+	std::map<std::pair<std::string, unsigned int>, Entry>::const_iterator it = entries.find(std::make_pair(name, (unsigned int)codec));
+	if (it == entries.end()) {
+		return false;
+	}
+	const unsigned char* data = (const unsigned char*)file.data() + it->second.offset;
+	const size_t size = size_t(it->second.size);
+	switch (codec) {
+	case FACEMAP_CODEC_RAW:
+		return decodeFaceMapRaw(data, size, faceIds, width, height);
+	case FACEMAP_CODEC_RLE:
+		return decodeFaceMapRLE(data, size, faceIds, width, height);
+	default:
+		return decodeFaceMapPNG(data, size, faceIds, width, height);
+	}
+}
+
+const unsigned int* FaceMapArchiveReader::findRawFrame(const std::string& name) const {
+	std::map<std::pair<std::string, unsigned int>, Entry>::const_iterator it = entries.find(std::make_pair(name, (unsigned int)FACEMAP_CODEC_RAW));
+	if (it == entries.end() || it->second.size != sizeof(FaceMapHeader) + sizeof(unsigned int) * size_t(width) * height) {
+		return NULL;
+	}
+	// The entry is a whole .facemap.bin, its header has to match the archive like in decodeFaceMapRaw.
+	FaceMapHeader header;
+	memcpy(&header, file.data() + it->second.offset, sizeof(header));
+	if (memcmp(header.magic, "FMAP", 4) != 0 || header.version != FACEMAP_RAW_VERSION || int(header.width) != width || int(header.height) != height) {
+		return NULL;
+	}
+	return (const unsigned int*)(file.data() + it->second.offset + sizeof(FaceMapHeader));
+}
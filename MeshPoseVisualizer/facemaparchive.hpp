@@ -0,0 +1,107 @@
+#ifndef FACEMAPARCHIVE_HPP
+#define FACEMAPARCHIVE_HPP
+
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mappedfile.hpp"
+
+// Face map archive (--archive): all face maps of a scene in face_maps\facemaps.fmar instead of
+// one file per frame and id format, which keeps scenes with tens of thousands of frames from
+// filling network file systems with small files.
+//
+// Layout, little-endian:
+//   FaceMapHeader       magic "FARC", version FACEMAP_ARCHIVE_VERSION, size of the face maps
+//   entries             the bytes of a .facemap.bin, .png or .rle file each, in the order the
+//                       encoders finished them; every entry starts at a multiple of 16 bytes, so
+//                       the ids of raw entries are aligned in a mapped archive
+//   index               per entry: unsigned long long offset, unsigned long long size,
+//                       unsigned int codec, unsigned int length of the name, the frame name
+//   trailer             unsigned long long offset of the index, unsigned int number of entries,
+//                       magic "FIDX"
+// The index is written last, so an archive is only valid once all frames are in it. Until
+// then it is written to path.partial.
+
+static const unsigned int FACEMAP_ARCHIVE_VERSION = 1;
+
+enum FaceMapCodec {
+	FACEMAP_CODEC_RAW = 0,
+	FACEMAP_CODEC_PNG = 1,
+	FACEMAP_CODEC_RLE = 2
+};
+
+// Appends encoded face maps to an archive. The encoder threads compress their frames in
+// parallel, only the writes are serialized, so the file is written sequentially.
+class FaceMapArchiveWriter {
+public:
+	FaceMapArchiveWriter();
+	~FaceMapArchiveWriter();
+
+	bool open(const std::string& path, int width, int height);
+
+	// Appends the encoded face map of a frame. Safe to call from several threads.
+	bool add(const std::string& name, FaceMapCodec codec, const std::vector<unsigned char>& data);
+
+	// Writes the index and renames the partial archive to its path. Returns false if any write
+	// failed, the partial archive is removed then.
+	bool finish();
+
+private:
+	FaceMapArchiveWriter(const FaceMapArchiveWriter&);
+	FaceMapArchiveWriter& operator=(const FaceMapArchiveWriter&);
+
+	struct Entry {
+		std::string name;
+		FaceMapCodec codec;
+		unsigned long long offset;
+		unsigned long long size;
+	};
+
+	std::string path;
+	FILE* fp;
+	std::mutex mutex;
+	unsigned long long offset;
+	std::vector<Entry> entries;
+	bool failed;
+};
+
+// Random access to the frames of an archive. The archive is mapped and only the index is read
+// when it is opened, readFrame touches nothing but the entry it decodes.
+class FaceMapArchiveReader {
+public:
+	bool open(const std::string& path);
+
+	size_t numEntries() const { return entries.size(); }
+
+	// Names of the frames in the archive, sorted.
+	std::vector<std::string> getFrameNames() const;
+
+	// Decodes the face map of a frame. Raw entries are preferred over RLE and PNG ones if the
+	// frame was archived in several formats. Returns false if the frame is missing or its entry
+	// can not be decoded.
+	bool readFrame(const std::string& name, std::vector<unsigned int>& faceIds, int& width, int& height) const;
+
+	// Decodes the entry of a frame in one codec, false if the frame was not archived in it.
+	bool readFrame(const std::string& name, FaceMapCodec codec, std::vector<unsigned int>& faceIds, int& width, int& height) const;
+
+	// Ids of a raw entry inside the mapped archive, NULL if the frame has no raw entry or its
+	// header does not match the archive.
+	const unsigned int* findRawFrame(const std::string& name) const;
+
+private:
+	struct Entry {
+		unsigned long long offset;
+		unsigned long long size;
+	};
+
+	MappedFile file;
+	int width;
+	int height;
+	std::map<std::pair<std::string, unsigned int>, Entry> entries;
+};
+
+#endif
@@ -0,0 +1,340 @@
+#include "pch.h"
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FACEMAP_CODEC_SSE
+#endif
+
+#include "facemap.hpp"
+#include "facemapcodec.hpp"
+#include "trace.hpp"
+
+namespace {
+
+struct Run {
+	unsigned int start;
+	unsigned int id;
+};
+
+const unsigned char CODE_SKIP = 0x80;
+const unsigned char CODE_ROW_END = 0xFE;
+const unsigned char CODE_NEW = 0xFF;
+const int MAX_SKIP = 8;
+const int MIN_MATCH = 4;
+const int HASH_BITS = 16;
+
+unsigned int zigzag(int value) {
+	return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+int unzigzag(unsigned int value) {
+	return int(value >> 1) ^ -int(value & 1);
+}
+
+void appendVarint(std::vector<unsigned char>& out, unsigned int value) {
+	while (value >= 0x80) {
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+bool readVarint(const unsigned char*& in, const unsigned char* end, unsigned int& value) {
+	value = 0;
+	for (int shift = 0; shift < 35 && in < end; shift += 7) {
+		const unsigned char byte = *in++;
+		value |= (unsigned int)(byte & 0x7F) << shift;
+		if (byte < 0x80) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Splits a row into runs of equal ids.
+void findRuns(const unsigned int* row, int width, std::vector<Run>& runs) {
+	// Index of the lowest clear bit of a 4-bit mask.
+	static const int firstClear[16] = { 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4 };
+	runs.clear();
+	int x = 0;
+	while (x < width) {
+		const Run run = { (unsigned int)x, row[x] };
+		runs.push_back(run);
+		x++;
+#ifdef FACEMAP_CODEC_SSE
+		// Compare four ids at a time until one differs.
+		const __m128i id = _mm_set1_epi32(int(run.id));
+		for (; x + 4 <= width; x += 4) {
+			const int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(row + x)), id)));
+			if (mask != 0xF) {
+				x += firstClear[mask];
+				break;
+			}
+		}
+#endif
+		while (x < width && row[x] == run.id) {
+			x++;
+		}
+	}
+}
+
+// Fills pixels [start, end) of a row with id.
+void fillRun(unsigned int* row, unsigned int start, unsigned int end, unsigned int id) {
+	unsigned int x = start;
+#ifdef FACEMAP_CODEC_SSE
+	const __m128i value = _mm_set1_epi32(int(id));
+	for (; x + 4 <= end; x += 4) {
+		_mm_storeu_si128((__m128i*)(row + x), value);
+	}
+#endif
+	for (; x < end; x++) {
+		row[x] = id;
+	}
+}
+
+void encodeRows(const unsigned int* faceIds, int width, int height, std::vector<unsigned char>& codes) {
+	std::vector<Run> above, current;
+	for (int y = 0; y < height; y++) {
+		findRuns(faceIds + size_t(y) * width, width, current);
+		size_t j = 0;
+		unsigned int lastId = 0;
+		unsigned int lastStart = 0;
+		for (size_t i = 0; i < current.size(); i++) {
+			const Run& run = current[i];
+			// Look for the run in the next few unused runs of the row above.
+			size_t k = 0;
+			while (k <= size_t(MAX_SKIP) && j + k < above.size() && above[j + k].id != run.id) {
+				k++;
+			}
+			const int shift = k <= size_t(MAX_SKIP) && j + k < above.size() ? int(run.start) - int(above[j + k].start) : 1 << 30;
+			if (shift >= -64 && shift < 64) {
+				if (k > 0) {
+					codes.push_back((unsigned char)(CODE_SKIP + k - 1));
+				}
+				codes.push_back((unsigned char)zigzag(shift));
+				j += k + 1;
+			}
+			else {
+				codes.push_back(CODE_NEW);
+				appendVarint(codes, zigzag(int(run.id - lastId)));
+				appendVarint(codes, run.start - lastStart);
+			}
+			lastId = run.id;
+			lastStart = run.start;
+		}
+		codes.push_back(CODE_ROW_END);
+		above.swap(current);
+	}
+}
+
+bool decodeRows(const unsigned char* in, const unsigned char* end, int width, int height, unsigned int* faceIds) {
+	std::vector<Run> above, current;
+	for (int y = 0; y < height; y++) {
+		current.clear();
+		size_t j = 0;
+		unsigned int lastId = 0;
+		unsigned int lastStart = 0;
+		for (;;) {
+			if (in >= end) {
+				return false;
+			}
+			unsigned char code = *in++;
+			if (code == CODE_ROW_END) {
+				break;
+			}
+			Run run;
+			if (code >= CODE_SKIP && code < CODE_SKIP + MAX_SKIP) {
+				j += code - CODE_SKIP + 1;
+				if (in >= end || *in >= CODE_SKIP) {
+					return false;
+				}
+				code = *in++;
+			}
+			if (code < CODE_SKIP) {
+				if (j >= above.size()) {
+					return false;
+				}
+				run.start = above[j].start + unzigzag(code);
+				run.id = above[j].id;
+				j++;
+			}
+			else if (code == CODE_NEW) {
+				unsigned int delta, offset;
+				if (!readVarint(in, end, delta) || !readVarint(in, end, offset)) {
+					return false;
+				}
+				run.id = lastId + unzigzag(delta);
+				run.start = lastStart + offset;
+			}
+			else {
+				return false;
+			}
+			// Runs start at 0 and move right.
+			if ((current.empty() ? run.start != 0 : run.start <= lastStart) || run.start >= (unsigned int)width) {
+				return false;
+			}
+			current.push_back(run);
+			lastId = run.id;
+			lastStart = run.start;
+		}
+		if (current.empty()) {
+			return false;
+		}
+		unsigned int* row = faceIds + size_t(y) * width;
+		for (size_t i = 0; i < current.size(); i++) {
+			fillRun(row, current[i].start, i + 1 < current.size() ? current[i + 1].start : (unsigned int)width, current[i].id);
+		}
+		above.swap(current);
+	}
+	return in == end;
+}
+
+unsigned int read32(const unsigned char* p) {
+	unsigned int value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+void appendLength(std::vector<unsigned char>& out, size_t length) {
+	for (; length >= 255; length -= 255) {
+		out.push_back(255);
+	}
+	out.push_back((unsigned char)length);
+}
+
+void appendSequence(std::vector<unsigned char>& out, const unsigned char* literals, size_t numLiterals, size_t offset, size_t matchLength) {
+	const size_t matchCode = matchLength >= MIN_MATCH ? matchLength - MIN_MATCH : 0;
+	out.push_back((unsigned char)((std::min<size_t>(numLiterals, 15) << 4) | std::min<size_t>(matchCode, 15)));
+	if (numLiterals >= 15) {
+		appendLength(out, numLiterals - 15);
+	}
+	out.insert(out.end(), literals, literals + numLiterals);
+	if (matchLength >= MIN_MATCH) {
+		out.push_back((unsigned char)offset);
+		out.push_back((unsigned char)(offset >> 8));
+		if (matchCode >= 15) {
+			appendLength(out, matchCode - 15);
+		}
+	}
+}
+
+// Greedy LZ77 with a hash table of the last position of every 4-byte sequence.
+void compressBlock(const unsigned char* in, size_t size, std::vector<unsigned char>& out) {
+	std::vector<unsigned int> table(size_t(1) << HASH_BITS, 0);
+	size_t i = 0, anchor = 0;
+	while (i + MIN_MATCH <= size) {
+		const unsigned int sequence = read32(in + i);
+		const unsigned int hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+		const size_t candidate = table[hash];
+		table[hash] = (unsigned int)(i + 1);
+		if (candidate == 0 || i + 1 - candidate > 0xFFFF || read32(in + candidate - 1) != sequence) {
+			i++;
+			continue;
+		}
+		const size_t match = candidate - 1;
+		size_t length = MIN_MATCH;
+		while (i + length < size && in[match + length] == in[i + length]) {
+			length++;
+		}
+		appendSequence(out, in + anchor, i - anchor, i - match, length);
+		i += length;
+		anchor = i;
+	}
+	appendSequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+bool readLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+	unsigned char byte;
+	do {
+		if (in >= end) {
+			return false;
+		}
+		byte = *in++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+bool decompressBlock(const unsigned char* in, size_t size, unsigned char* out, size_t outSize) {
+	const unsigned char* end = in + size;
+	size_t o = 0;
+	while (in < end) {
+		const unsigned char token = *in++;
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !readLength(in, end, numLiterals)) {
+			return false;
+		}
+		if (numLiterals > size_t(end - in) || numLiterals > outSize - o) {
+			return false;
+		}
+		memcpy(out + o, in, numLiterals);
+		in += numLiterals;
+		o += numLiterals;
+		if (in == end) {
+			break;
+		}
+		if (end - in < 2) {
+			return false;
+		}
+		const size_t offset = in[0] | (size_t(in[1]) << 8);
+		in += 2;
+		size_t length = token & 15;
+		if (length == 15 && !readLength(in, end, length)) {
+			return false;
+		}
+		length += MIN_MATCH;
+		if (offset == 0 || offset > o || length > outSize - o) {
+			return false;
+		}
+		// Matches may overlap their own output, so they are copied byte by byte.
+		for (size_t k = 0; k < length; k++, o++) {
+			out[o] = out[o - offset];
+		}
+	}
+	return o == outSize;
+}
+
+}
+
+void encodeFaceMapRLE(const unsigned int* faceIds, int width, int height, std::vector<unsigned char>& file) {
+	TRACE_SCOPE("encode RLE face map");
+	std::vector<unsigned char> codes;
+	codes.reserve(size_t(height) * 64);
+	encodeRows(faceIds, width, height, codes);
+
+	FaceMapHeader header;
+	memcpy(header.magic, "FRLE", 4);
+	header.version = FACEMAP_RLE_VERSION;
+	header.width = width;
+	header.height = height;
+	file.resize(sizeof(header) + 8);
+	memcpy(&file[0], &header, sizeof(header));
+	compressBlock(codes.empty() ? NULL : &codes[0], codes.size(), file);
+	const unsigned int sizes[2] = { (unsigned int)codes.size(), (unsigned int)(file.size() - sizeof(header) - 8) };
+	memcpy(&file[sizeof(header)], sizes, 8);
+}
+
+bool decodeFaceMapRLE(const unsigned char* file, size_t size, std::vector<unsigned int>& faceIds, int& width, int& height) {
+	FaceMapHeader header;
+	unsigned int sizes[2];
+	if (size < sizeof(header) + 8) {
+		return false;
+	}
+	memcpy(&header, file, sizeof(header));
+	memcpy(sizes, file + sizeof(header), 8);
+	if (memcmp(header.magic, "FRLE", 4) != 0 || header.version != FACEMAP_RLE_VERSION || sizes[1] != size - sizeof(header) - 8 ||
+		header.width == 0 || header.width > (1u << 16) || header.height > (1u << 16)) {
+		return false;
+	}
+	std::vector<unsigned char> codes(sizes[0]);
+	if (!decompressBlock(file + sizeof(header) + 8, sizes[1], codes.empty() ? NULL : &codes[0], codes.size())) {
+		return false;
+	}
+	width = int(header.width);
+	height = int(header.height);
+	faceIds.resize(size_t(width) * height);
+	return decodeRows(codes.empty() ? NULL : &codes[0], codes.empty() ? NULL : &codes[0] + codes.size(), width, height, faceIds.empty() ? NULL : &faceIds[0]);
+}
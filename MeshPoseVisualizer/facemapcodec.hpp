@@ -0,0 +1,40 @@
+#ifndef FACEMAPCODEC_HPP
+#define FACEMAPCODEC_HPP
+
+#include <vector>
+
+// Lossless codec for face maps (.facemap.rle, --id-format rle). Face maps are large regions of
+// constant ids whose borders move little from one row to the next, so every row is stored as
+// runs of equal ids predicted from the runs of the row above, and the run codes are compressed
+// with a small LZ77 coder in the style of LZ4. Encoding and decoding take a few milliseconds a
+// frame and the files are smaller than the PNG face maps.
+//
+// File layout, little-endian:
+//   FaceMapHeader                 magic "FRLE", version FACEMAP_RLE_VERSION
+//   unsigned int runBytes         size of the run codes
+//   unsigned int compressedBytes  size of the compressed run codes that follow
+//
+// Run codes, one row after the other. Runs are given by their first pixel, a run ends where
+// the next one starts or at the end of the row:
+//   0x00-0x7F  the next unused run of the row above continues; the byte is the zigzag coded
+//              shift of its first pixel
+//   0x80-0x87  skips 1 to 8 runs of the row above, followed by a continuing run
+//   0xFE       end of the row
+//   0xFF       a new run: varint zigzag(id - id of the previous run in the row), varint first
+//              pixel - first pixel of the previous run
+// Varints hold 7 bits per byte, lowest first, the high bit is set on all but the last byte.
+//
+// Compressed blocks are sequences of a token (literal count << 4 | match length - 4), extra
+// literal count bytes if the count is 15 (255 continues), the literals, a 16-bit offset back
+// into the output, and extra match length bytes like the literal count. The last sequence has
+// only literals.
+
+static const unsigned int FACEMAP_RLE_VERSION = 1;
+
+// Encodes a face map as the contents of a .facemap.rle file.
+void encodeFaceMapRLE(const unsigned int* faceIds, int width, int height, std::vector<unsigned char>& file);
+
+// Decodes the contents of a .facemap.rle file, returns false if they are not valid.
+bool decodeFaceMapRLE(const unsigned char* file, size_t size, std::vector<unsigned int>& faceIds, int& width, int& height);
+
+#endif
@@ -0,0 +1,295 @@
+#include "pch.h"
+#include <stdio.h>
+#include <string.h>
+
+// Include GLEW
+#include <GL/glew.h>
+
+// Include GLFW
+#include <GLFW/glfw3.h>
+
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef USE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+#include "glcontext.hpp"
+
+const char* getGLContextBackendName(GLContextBackend backend) {
+	switch (backend) {
+	case GLContextBackend::EGL:
+		return "egl";
+	case GLContextBackend::OSMesa:
+		return "osmesa";
+	default:
+		return "glfw";
+	}
+}
+
+bool parseGLContextBackend(const std::string& name, GLContextBackend& backend) {
+	if (name == "glfw") {
+		backend = GLContextBackend::GLFW;
+	}
+	else if (name == "egl") {
+		backend = GLContextBackend::EGL;
+	}
+	else if (name == "osmesa") {
+		backend = GLContextBackend::OSMesa;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+std::vector<GLContextBackend> getAvailableGLContextBackends() {
+	std::vector<GLContextBackend> backends;
+#ifdef USE_EGL
+	backends.push_back(GLContextBackend::EGL);
+#endif
+#ifdef USE_OSMESA
+	backends.push_back(GLContextBackend::OSMesa);
+#endif
+	backends.push_back(GLContextBackend::GLFW);
+	return backends;
+}
+
+#ifdef USE_EGL
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLConfig eglConfig = 0;
+
+static bool hasEGLExtension(const char* extensions, const char* name) {
+	size_t length = strlen(name);
+	for (const char* p = extensions; p && (p = strstr(p, name)) != NULL; p += length) {
+		if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Prefers the first GPU device so no X or Wayland display is needed, then Mesa's surfaceless
+// platform and finally the default display.
+static EGLDisplay openEGLDisplay() {
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay && hasEGLExtension(clientExtensions, "EGL_EXT_platform_device")) {
+		PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+		EGLDeviceEXT device;
+		EGLint numDevices = 0;
+		if (queryDevices && queryDevices(1, &device, &numDevices) && numDevices > 0) {
+			EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+			if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+				return display;
+			}
+		}
+	}
+	if (getPlatformDisplay && hasEGLExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+		EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+			return display;
+		}
+	}
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+		return display;
+	}
+	return EGL_NO_DISPLAY;
+}
+#endif
+
+bool initGLContextBackend(GLContextBackend backend) {
+	switch (backend) {
+	case GLContextBackend::GLFW:
+		if (!glfwInit()) {
+			fprintf(stderr, "Failed to initialize GLFW\n");
+			return false;
+		}
+		glfwWindowHint(GLFW_SAMPLES, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, 0);
+		return true;
+	case GLContextBackend::EGL:
+#ifdef USE_EGL
+		eglDisplay = openEGLDisplay();
+		if (eglDisplay == EGL_NO_DISPLAY) {
+			fprintf(stderr, "Failed to initialize EGL\n");
+			return false;
+		}
+		// Contexts are only ever bound without a surface, the framebuffers are created by the workers.
+		if (!hasEGLExtension(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+			fprintf(stderr, "EGL does not support surfaceless contexts\n");
+			eglTerminate(eglDisplay);
+			eglDisplay = EGL_NO_DISPLAY;
+			return false;
+		}
+		{
+			// Without a surface type eglChooseConfig only returns window configs, which headless
+			// displays do not have.
+			const EGLint configAttributes[] = {
+				EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+				EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+				EGL_NONE
+			};
+			EGLint numConfigs = 0;
+			if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(eglDisplay, configAttributes, &eglConfig, 1, &numConfigs) || numConfigs == 0) {
+				fprintf(stderr, "EGL has no desktop OpenGL config\n");
+				eglTerminate(eglDisplay);
+				eglDisplay = EGL_NO_DISPLAY;
+				return false;
+			}
+		}
+		return true;
+#else
+		fprintf(stderr, "EGL contexts are not available, build with USE_EGL\n");
+		return false;
+#endif
+	case GLContextBackend::OSMesa:
+#ifdef USE_OSMESA
+		// OSMesa needs no setup, creating the first context loads llvmpipe.
+		return true;
+#else
+		fprintf(stderr, "OSMesa contexts are not available, build with USE_OSMESA\n");
+		return false;
+#endif
+	}
+	return false;
+}
+
+void terminateGLContextBackend(GLContextBackend backend) {
+	switch (backend) {
+	case GLContextBackend::GLFW:
+		glfwTerminate();
+		break;
+	case GLContextBackend::EGL:
+#ifdef USE_EGL
+		eglTerminate(eglDisplay);
+		eglDisplay = EGL_NO_DISPLAY;
+#endif
+		break;
+	case GLContextBackend::OSMesa:
+		break;
+	}
+}
+
+GLContext::GLContext() : backend(GLContextBackend::GLFW), window(NULL), context(NULL) {
+}
+
+GLContext::~GLContext() {
+	destroy();
+}
+
+bool GLContext::create(GLContextBackend backend, GLContext* share) {
+	destroy();
+	this->backend = backend;
+	switch (backend) {
+	case GLContextBackend::GLFW:
+		// The window is never shown, its size does not matter as everything goes to framebuffers.
+		window = glfwCreateWindow(960, 540, "MeshPoseVisualization", NULL, share ? share->window : NULL);
+		return window != NULL;
+	case GLContextBackend::EGL:
+#ifdef USE_EGL
+		{
+			const EGLint contextAttributes[] = {
+				EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+				EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+				EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+				EGL_NONE
+			};
+			context = eglCreateContext(eglDisplay, eglConfig, share ? (EGLContext)share->context : EGL_NO_CONTEXT, contextAttributes);
+			if (context == EGL_NO_CONTEXT) {
+				context = NULL;
+				return false;
+			}
+			return true;
+		}
+#else
+		return false;
+#endif
+	case GLContextBackend::OSMesa:
+#ifdef USE_OSMESA
+		{
+			const int contextAttributes[] = {
+				OSMESA_FORMAT, OSMESA_RGBA,
+				OSMESA_DEPTH_BITS, 0,
+				OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+				OSMESA_CONTEXT_MAJOR_VERSION, 3,
+				OSMESA_CONTEXT_MINOR_VERSION, 3,
+				0
+			};
+			context = OSMesaCreateContextAttribs(contextAttributes, share ? (OSMesaContext)share->context : NULL);
+			// OSMesa always needs a color buffer to be current, a single pixel is enough.
+			osmesaBuffer.assign(4, 0);
+			return context != NULL;
+		}
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+void GLContext::destroy() {
+	if (window) {
+		glfwDestroyWindow(window);
+		window = NULL;
+	}
+	if (context) {
+#ifdef USE_EGL
+		if (backend == GLContextBackend::EGL) {
+			eglDestroyContext(eglDisplay, (EGLContext)context);
+		}
+#endif
+#ifdef USE_OSMESA
+		if (backend == GLContextBackend::OSMesa) {
+			OSMesaDestroyContext((OSMesaContext)context);
+		}
+#endif
+		context = NULL;
+	}
+}
+
+bool GLContext::makeCurrent() {
+	switch (backend) {
+	case GLContextBackend::GLFW:
+		glfwMakeContextCurrent(window);
+		return window != NULL;
+	case GLContextBackend::EGL:
+#ifdef USE_EGL
+		return eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, (EGLContext)context) == EGL_TRUE;
+#else
+		return false;
+#endif
+	case GLContextBackend::OSMesa:
+#ifdef USE_OSMESA
+		return OSMesaMakeCurrent((OSMesaContext)context, &osmesaBuffer[0], GL_UNSIGNED_BYTE, 1, 1) == GL_TRUE;
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+void GLContext::releaseCurrent() {
+	switch (backend) {
+	case GLContextBackend::GLFW:
+		glfwMakeContextCurrent(NULL);
+		break;
+	case GLContextBackend::EGL:
+#ifdef USE_EGL
+		eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+#endif
+		break;
+	case GLContextBackend::OSMesa:
+#ifdef USE_OSMESA
+		OSMesaMakeCurrent(NULL, NULL, 0, 0, 0);
+#endif
+		break;
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef GLCONTEXT_HPP
+#define GLCONTEXT_HPP
+
+#include <string>
+#include <vector>
+
+struct GLFWwindow;
+
+// Library creating the OpenGL contexts. GLFW needs a window system even for hidden windows,
+// EGL creates surfaceless contexts on the GPU without a display (built with USE_EGL) and
+// OSMesa renders with llvmpipe on nodes without a GPU (built with USE_OSMESA).
+enum class GLContextBackend {
+	GLFW,
+	EGL,
+	OSMesa
+};
+
+const char* getGLContextBackendName(GLContextBackend backend);
+
+// Reads "glfw", "egl" or "osmesa", returns false for other names.
+bool parseGLContextBackend(const std::string& name, GLContextBackend& backend);
+
+// Backends compiled into this build, in the order they are tried when none is given:
+// the headless ones first, GLFW last.
+std::vector<GLContextBackend> getAvailableGLContextBackends();
+
+// Loads the library of backend, returns false if it is not compiled in or can not be used
+// on this machine, for example EGL without a GPU driver.
+bool initGLContextBackend(GLContextBackend backend);
+void terminateGLContextBackend(GLContextBackend backend);
+
+// An OpenGL 3.3 core context without a visible surface, everything is rendered into
+// framebuffer objects. There is nothing to swap and no events to poll.
+class GLContext {
+public:
+	GLContext();
+	~GLContext();
+
+	// Creates the context, sharing buffers, textures and programs with share if it is not null.
+	// The backend must be initialised. GLFW contexts must be created on the main thread.
+	bool create(GLContextBackend backend, GLContext* share);
+	void destroy();
+
+	// Binds the context to the calling thread.
+	bool makeCurrent();
+	// Unbinds the current context of the calling thread, so another thread can take it.
+	void releaseCurrent();
+
+	GLContextBackend getBackend() const { return backend; }
+
+private:
+	GLContext(const GLContext&);
+	GLContext& operator=(const GLContext&);
+
+	GLContextBackend backend;
+	GLFWwindow* window;
+	void* context; // EGLContext or OSMesaContext
+	std::vector<unsigned char> osmesaBuffer;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "pch.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.hpp"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : bytes(nullptr), length(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL) {
+}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == NULL) {
+		close();
+		return false;
+	}
+	bytes = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!bytes) {
+		close();
+		return false;
+	}
+	length = size_t(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close() {
+	if (bytes) {
+		UnmapViewOfFile(bytes);
+	}
+	if (mappingHandle != NULL) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+	}
+	bytes = nullptr;
+	length = 0;
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : bytes(nullptr), length(0) {
+}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* mapping = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file.
+	::close(fd);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	madvise(mapping, size_t(st.st_size), MADV_SEQUENTIAL);
+	bytes = (const char*)mapping;
+	length = size_t(st.st_size);
+	return true;
+}
+
+void MappedFile::close() {
+	if (bytes) {
+		munmap((void*)bytes, length);
+	}
+	bytes = nullptr;
+	length = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
@@ -0,0 +1,32 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <string>
+
+// Read-only memory mapping of a whole file. The pages are loaded by the OS on first access,
+// so reading a mapped file runs at I/O bandwidth without an extra copy into a read buffer.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Maps the file, returns false if it does not exist or can not be mapped.
+	bool open(const std::string& path);
+	void close();
+
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* bytes;
+	size_t length;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+};
+
+#endif
@@ -0,0 +1,594 @@
+#include "pch.h"
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "mesh.hpp"
+#include "faceattributes.hpp"
+#include "meshcache.hpp"
+#include "objparser.hpp"
+#include "plyloader.hpp"
+#include "trace.hpp"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+#include "stb_image.h"
+
+static std::string GetBaseDir(const std::string& filepath) {
+	if (filepath.find_last_of("/\\") != std::string::npos)
+		return filepath.substr(0, filepath.find_last_of("/\\"));
+	return "";
+}
+
+static bool FileExists(const std::string& abs_filename) {
+	bool ret;
+	FILE* fp = fopen(abs_filename.c_str(), "rb");
+	if (fp) {
+		ret = true;
+		fclose(fp);
+	}
+	else {
+		ret = false;
+	}
+
+	return ret;
+}
+
+static void CalcNormal(float N[3], float v0[3], float v1[3], float v2[3]) {
+	float v10[3];
+	v10[0] = v1[0] - v0[0];
+	v10[1] = v1[1] - v0[1];
+	v10[2] = v1[2] - v0[2];
+
+	float v20[3];
+	v20[0] = v2[0] - v0[0];
+	v20[1] = v2[1] - v0[1];
+	v20[2] = v2[2] - v0[2];
+
+	N[0] = v20[1] * v10[2] - v20[2] * v10[1];
+	N[1] = v20[2] * v10[0] - v20[0] * v10[2];
+	N[2] = v20[0] * v10[1] - v20[1] * v10[0];
+
+	float len2 = N[0] * N[0] + N[1] * N[1] + N[2] * N[2];
+	if (len2 > 0.0f) {
+		float len = sqrtf(len2);
+
+		N[0] /= len;
+		N[1] /= len;
+		N[2] /= len;
+	}
+}
+
+
+// Appends the normals, colors and texture coordinates of the 3 corners of a face. Corners can
+// use different normal and texture coordinate indices, so these are stored per corner.
+static void AppendCornerAttributes(DrawObject& o, const tinyobj::attrib_t& attrib, const std::vector<tinyobj::material_t>& materials, int current_material_id,
+	const tinyobj::index_t& idx0, const tinyobj::index_t& idx1, const tinyobj::index_t& idx2, float v[3][3]) {
+	if ((current_material_id < 0) || (current_material_id >= static_cast<int>(materials.size()))) {
+		// Invaid material ID. Use default material.
+		current_material_id = materials.size() - 1;  // Default material is added to the last item in `materials`.
+	}
+
+	float diffuse[3];
+	for (size_t i = 0; i < 3; i++) {
+		diffuse[i] = materials[current_material_id].diffuse[i];
+	}
+
+	float tc[3][2];
+
+	if (attrib.texcoords.size() > 0) {
+		if ((idx0.texcoord_index < 0) || (idx1.texcoord_index < 0) || (idx2.texcoord_index < 0)) {
+			// face does not contain valid uv index.
+			tc[0][0] = 0.0f;
+			tc[0][1] = 0.0f;
+			tc[1][0] = 0.0f;
+			tc[1][1] = 0.0f;
+			tc[2][0] = 0.0f;
+			tc[2][1] = 0.0f;
+		}
+		else {
+			assert(attrib.texcoords.size() >
+				size_t(2 * idx0.texcoord_index + 1));
+			assert(attrib.texcoords.size() >
+				size_t(2 * idx1.texcoord_index + 1));
+			assert(attrib.texcoords.size() >
+				size_t(2 * idx2.texcoord_index + 1));
+
+			// Flip Y coord.
+			tc[0][0] = attrib.texcoords[2 * idx0.texcoord_index];
+			tc[0][1] = 1.0f - attrib.texcoords[2 * idx0.texcoord_index + 1];
+			tc[1][0] = attrib.texcoords[2 * idx1.texcoord_index];
+			tc[1][1] = 1.0f - attrib.texcoords[2 * idx1.texcoord_index + 1];
+			tc[2][0] = attrib.texcoords[2 * idx2.texcoord_index];
+			tc[2][1] = 1.0f - attrib.texcoords[2 * idx2.texcoord_index + 1];
+		}
+	}
+	else {
+		tc[0][0] = 0.0f;
+		tc[0][1] = 0.0f;
+		tc[1][0] = 0.0f;
+		tc[1][1] = 0.0f;
+		tc[2][0] = 0.0f;
+		tc[2][1] = 0.0f;
+	}
+
+	float n[3][3];
+	{
+		bool invalid_normal_index = false;
+		if (attrib.normals.size() > 0) {
+			int nf0 = idx0.normal_index;
+			int nf1 = idx1.normal_index;
+			int nf2 = idx2.normal_index;
+
+			if ((nf0 < 0) || (nf1 < 0) || (nf2 < 0)) {
+				// normal index is missing from this face.
+				invalid_normal_index = true;
+			}
+			else {
+				for (int k = 0; k < 3; k++) {
+					assert(size_t(3 * nf0 + k) < attrib.normals.size());
+					assert(size_t(3 * nf1 + k) < attrib.normals.size());
+					assert(size_t(3 * nf2 + k) < attrib.normals.size());
+					n[0][k] = attrib.normals[3 * nf0 + k];
+					n[1][k] = attrib.normals[3 * nf1 + k];
+					n[2][k] = attrib.normals[3 * nf2 + k];
+				}
+			}
+		}
+		else {
+			invalid_normal_index = true;
+		}
+
+		if (invalid_normal_index) {
+			// compute geometric normal
+			CalcNormal(n[0], v[0], v[1], v[2]);
+			n[1][0] = n[0][0];
+			n[1][1] = n[0][1];
+			n[1][2] = n[0][2];
+			n[2][0] = n[0][0];
+			n[2][1] = n[0][1];
+			n[2][2] = n[0][2];
+		}
+	}
+
+	for (int k = 0; k < 3; k++) {
+		o.normals.push_back(n[k][0]);
+		o.normals.push_back(n[k][1]);
+		o.normals.push_back(n[k][2]);
+		// Combine normal and diffuse to get color.
+		float normal_factor = 0.2;
+		float diffuse_factor = 1 - normal_factor;
+		float c[3] = { n[k][0] * normal_factor + diffuse[0] * diffuse_factor,
+					  n[k][1] * normal_factor + diffuse[1] * diffuse_factor,
+					  n[k][2] * normal_factor + diffuse[2] * diffuse_factor };
+		float len2 = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+		if (len2 > 0.0f) {
+			float len = sqrtf(len2);
+
+			c[0] /= len;
+			c[1] /= len;
+			c[2] /= len;
+		}
+		o.colors.push_back(c[0] * 0.5 + 0.5);
+		o.colors.push_back(c[1] * 0.5 + 0.5);
+		o.colors.push_back(c[2] * 0.5 + 0.5);
+
+		o.uvs.push_back(tc[k][0]);
+		o.uvs.push_back(tc[k][1]);
+	}
+}
+
+// Converts a binary PLY mesh into a single DrawObject. With loadAttributes the corners get
+// geometric normals and the vertex colors, or colors from the normals if the file has none.
+static bool LoadPlyAndConvert(float bmin[3], float bmax[3], std::vector<DrawObject>* drawObjects, std::vector<tinyobj::material_t>& materials,
+	const char* filename, bool loadAttributes) {
+	PlyMesh mesh;
+	if (!LoadPly(filename, mesh, loadAttributes, loadAttributes)) {
+		return false;
+	}
+	printf("# of vertices  = %d\n", (int)(mesh.vertices.size()) / 3);
+	printf("# of triangles = %d\n", (int)(mesh.indices.size()) / 3);
+
+	// PLY files have no materials, every face uses the default one.
+	materials.push_back(tinyobj::material_t());
+
+	DrawObject o;
+	o.vertices.swap(mesh.vertices);
+	o.indices.swap(mesh.indices);
+	o.faceLabels.swap(mesh.faceLabels);
+	o.numTriangles = int(o.indices.size() / 3);
+	o.material_id = materials.size() - 1;
+	for (size_t i = 0; i < o.vertices.size(); i++) {
+		bmin[i % 3] = std::min(o.vertices[i], bmin[i % 3]);
+		bmax[i % 3] = std::max(o.vertices[i], bmax[i % 3]);
+	}
+
+	TaskPool pool(0);
+	computeFaceAreas(o.vertices, o.indices, pool, o.faceAreas);
+
+	if (loadAttributes) {
+		o.normals.resize(9 * o.numTriangles);
+		o.colors.resize(9 * o.numTriangles);
+		o.uvs.assign(6 * o.numTriangles, 0.0f);
+		for (size_t f = 0; f < size_t(o.numTriangles); f++) {
+			float v[3][3];
+			for (int c = 0; c < 3; c++) {
+				for (int k = 0; k < 3; k++) {
+					v[c][k] = o.vertices[3 * o.indices[3 * f + c] + k];
+				}
+			}
+			float n[3];
+			CalcNormal(n, v[0], v[1], v[2]);
+			for (int c = 0; c < 3; c++) {
+				for (int k = 0; k < 3; k++) {
+					o.normals[9 * f + 3 * c + k] = n[k];
+					o.colors[9 * f + 3 * c + k] = mesh.colors.empty() ? n[k] * 0.5f + 0.5f : mesh.colors[3 * o.indices[3 * f + c] + k] / 255.0f;
+				}
+			}
+		}
+	}
+
+	printf("shape[0] # of triangles = %d, # of vertices = %d\n", o.numTriangles, int(o.vertices.size() / 3));
+	drawObjects->push_back(std::move(o));
+	return true;
+}
+
+static bool HasExtension(const std::string& filename, const char* extension) {
+	size_t length = strlen(extension);
+	if (filename.size() < length) {
+		return false;
+	}
+	for (size_t i = 0; i < length; i++) {
+		if (tolower((unsigned char)filename[filename.size() - length + i]) != extension[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Converts the shapes found by parseObjParallel. Shapes keep the vertices they use in order of
+// first use, like the tinyobj path, and the face areas are computed in parallel.
+static void ConvertTriangleMesh(const ObjTriangleMesh& mesh, const std::vector<tinyobj::material_t>& materials, TaskPool& pool,
+	float bmin[3], float bmax[3], std::vector<DrawObject>* drawObjects) {
+	std::vector<int> vertexRemap(mesh.vertices.size() / 3, -1);
+	for (size_t s = 0; s < mesh.shapes.size(); s++) {
+		const ObjShapeRange& shape = mesh.shapes[s];
+		const unsigned int* shapeIndices = &mesh.indices[3 * shape.firstFace];
+		DrawObject o;
+
+		o.indices.resize(3 * shape.numFaces);
+		for (size_t i = 0; i < o.indices.size(); i++) {
+			unsigned int vi = shapeIndices[i];
+			if (vertexRemap[vi] < 0) {
+				vertexRemap[vi] = int(o.vertices.size() / 3);
+				for (int k = 0; k < 3; k++) {
+					float value = mesh.vertices[3 * vi + k];
+					o.vertices.push_back(value);
+					bmin[k] = std::min(value, bmin[k]);
+					bmax[k] = std::max(value, bmax[k]);
+				}
+			}
+			o.indices[i] = vertexRemap[vi];
+		}
+		for (size_t i = 0; i < o.indices.size(); i++) {
+			vertexRemap[shapeIndices[i]] = -1;
+		}
+
+		computeFaceAreas(o.vertices, o.indices, pool, o.faceAreas);
+		o.numTriangles = int(shape.numFaces);
+
+		// Same rule as for tinyobj shapes: the material of the first face.
+		if (shape.numFaces > 0) {
+			o.material_id = size_t(shape.materialId);
+		}
+		else {
+			o.material_id = materials.size() - 1;  // = ID for default material.
+		}
+		printf("shape[%d] material_id %d\n", int(s), int(o.material_id));
+		printf("shape[%d] # of triangles = %d, # of vertices = %d\n", static_cast<int>(s), o.numTriangles, int(o.vertices.size() / 3));
+
+		drawObjects->push_back(std::move(o));
+	}
+}
+
+bool LoadObjAndConvert(float bmin[3], float bmax[3], std::vector<DrawObject>* drawObjects, std::vector<ShapeRange>& shapeRanges,
+	std::vector<tinyobj::material_t>& materials, std::map<std::string, GLuint>& textures, const char* filename, bool loadTextures, bool loadAttributes) {
+	// The cache only holds what the face maps need, textures and attributes require the OBJ file.
+	const bool useCache = !loadTextures && !loadAttributes;
+	const std::string cacheFile = getMeshCachePath(filename);
+	bool cached = false;
+	if (useCache) {
+		TRACE_SCOPE("load mesh cache");
+		cached = loadMeshCache(cacheFile, filename, bmin, bmax, drawObjects, shapeRanges);
+	}
+	if (cached) {
+		printf("Loaded mesh cache %s\n", cacheFile.c_str());
+		printf("bmin = %f, %f, %f\n", bmin[0], bmin[1], bmin[2]);
+		printf("bmax = %f, %f, %f\n", bmax[0], bmax[1], bmax[2]);
+		return true;
+	}
+
+	// Binary PLY meshes from the reconstruction are read without converting them to OBJ.
+	if (HasExtension(filename, ".ply")) {
+		TRACE_SCOPE("load PLY");
+		bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<float>::max();
+		bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<float>::max();
+		if (!LoadPlyAndConvert(bmin, bmax, drawObjects, materials, filename, loadAttributes)) {
+			return false;
+		}
+		printf("bmin = %f, %f, %f\n", bmin[0], bmin[1], bmin[2]);
+		printf("bmax = %f, %f, %f\n", bmax[0], bmax[1], bmax[2]);
+		MergeDrawObjects(*drawObjects, shapeRanges);
+		if (useCache && !writeMeshCache(cacheFile, filename, bmin, bmax, *drawObjects, shapeRanges)) {
+			fprintf(stderr, "Unable to write mesh cache %s\n", cacheFile.c_str());
+		}
+		return true;
+	}
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+
+	std::string base_dir = GetBaseDir(filename);
+	if (base_dir.empty()) {
+		base_dir = ".";
+	}
+#ifdef _WIN32
+	base_dir += "\\";
+#else
+	base_dir += "/";
+#endif
+
+	std::string warn;
+	std::string err;
+
+	// Positions and triangles are enough for the face maps, they are parsed on all cores.
+	// tinyobj loads everything else and the files the parallel parser does not handle.
+	TaskPool pool(0);
+	ObjTriangleMesh triangleMesh;
+	bool parsedInParallel = false;
+	bool ret;
+	{
+		TRACE_SCOPE("parse OBJ");
+		if (!loadAttributes) {
+			parsedInParallel = parseObjParallel(filename, base_dir, pool, triangleMesh, materials, warn);
+			if (!parsedInParallel) {
+				printf("Parsing %s with tinyobj\n", filename);
+				materials.clear();
+				warn.clear();
+			}
+		}
+
+		ret = parsedInParallel || tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, base_dir.c_str());
+	}
+	if (!warn.empty()) {
+		std::cout << "WARN: " << warn << std::endl;
+	}
+	if (!err.empty()) {
+		std::cerr << err << std::endl;
+	}
+
+	if (!ret) {
+		std::cerr << "Failed to load " << filename << std::endl;
+		return false;
+	}
+
+	if (parsedInParallel) {
+		printf("# of vertices  = %d\n", (int)(triangleMesh.vertices.size()) / 3);
+		printf("# of materials = %d\n", (int)materials.size());
+		printf("# of shapes    = %d\n", (int)triangleMesh.shapes.size());
+	}
+	else {
+		printf("# of vertices  = %d\n", (int)(attrib.vertices.size()) / 3);
+		printf("# of normals   = %d\n", (int)(attrib.normals.size()) / 3);
+		printf("# of texcoords = %d\n", (int)(attrib.texcoords.size()) / 2);
+		printf("# of materials = %d\n", (int)materials.size());
+		printf("# of shapes    = %d\n", (int)shapes.size());
+	}
+
+	// Append `default` material
+	materials.push_back(tinyobj::material_t());
+
+	for (size_t i = 0; i < materials.size(); i++) {
+		printf("material[%d].diffuse_texname = %s\n", int(i),
+			materials[i].diffuse_texname.c_str());
+	}
+
+	// Load diffuse textures
+	if (loadTextures) {
+		for (size_t m = 0; m < materials.size(); m++) {
+			tinyobj::material_t* mp = &materials[m];
+
+			if (mp->diffuse_texname.length() > 0) {
+				// Only load the texture if it is not already loaded
+				if (textures.find(mp->diffuse_texname) == textures.end()) {
+					GLuint texture_id;
+					int w, h;
+					int comp;
+
+					std::string texture_filename = mp->diffuse_texname;
+					if (!FileExists(texture_filename)) {
+						// Append base dir.
+						texture_filename = base_dir + mp->diffuse_texname;
+						if (!FileExists(texture_filename)) {
+							std::cerr << "Unable to find file: " << mp->diffuse_texname << std::endl;
+							exit(1);
+						}
+					}
+
+					unsigned char* image = stbi_load(texture_filename.c_str(), &w, &h, &comp, STBI_default);
+					if (!image) {
+						std::cerr << "Unable to load texture: " << texture_filename << std::endl;
+						exit(1);
+					}
+					std::cout << "Loaded texture: " << texture_filename << ", w = " << w << ", h = " << h << ", comp = " << comp << std::endl;
+
+					glGenTextures(1, &texture_id);
+					glBindTexture(GL_TEXTURE_2D, texture_id);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+					if (comp == 3) {
+						glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+					}
+					else if (comp == 4) {
+						glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+					}
+					else {
+						assert(0);  // TODO
+					}
+					glBindTexture(GL_TEXTURE_2D, 0);
+					stbi_image_free(image);
+					textures.insert(std::make_pair(mp->diffuse_texname, texture_id));
+				}
+			}
+		}
+	}
+
+	// Includes writing the cache, which is traced on its own.
+	TRACE_SCOPE("convert mesh");
+	bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<float>::max();
+	bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<float>::max();
+
+	if (parsedInParallel) {
+		ConvertTriangleMesh(triangleMesh, materials, pool, bmin, bmax, drawObjects);
+	}
+	else {
+		// Maps OBJ vertex indices to the vertex array of the current shape, -1 when not yet used.
+		std::vector<int> vertexRemap(attrib.vertices.size() / 3, -1);
+
+		for (size_t s = 0; s < shapes.size(); s++) {
+			DrawObject o;
+
+			const size_t numFaces = shapes[s].mesh.indices.size() / 3;
+			o.indices.reserve(3 * numFaces);
+			if (loadAttributes) {
+				o.normals.reserve(9 * numFaces);
+				o.colors.reserve(9 * numFaces);
+				o.uvs.reserve(6 * numFaces);
+			}
+
+			for (size_t f = 0; f < numFaces; f++) {
+				tinyobj::index_t idx0 = shapes[s].mesh.indices[3 * f + 0];
+				tinyobj::index_t idx1 = shapes[s].mesh.indices[3 * f + 1];
+				tinyobj::index_t idx2 = shapes[s].mesh.indices[3 * f + 2];
+
+				float v[3][3];
+				const int vertexIndex[3] = { idx0.vertex_index, idx1.vertex_index, idx2.vertex_index };
+				for (int c = 0; c < 3; c++) {
+					int vi = vertexIndex[c];
+					assert(vi >= 0);
+					for (int k = 0; k < 3; k++) {
+						v[c][k] = attrib.vertices[3 * vi + k];
+					}
+					if (vertexRemap[vi] < 0) {
+						vertexRemap[vi] = int(o.vertices.size() / 3);
+						for (int k = 0; k < 3; k++) {
+							o.vertices.push_back(v[c][k]);
+							bmin[k] = std::min(v[c][k], bmin[k]);
+							bmax[k] = std::max(v[c][k], bmax[k]);
+						}
+					}
+					o.indices.push_back(vertexRemap[vi]);
+				}
+
+				if (loadAttributes) {
+					AppendCornerAttributes(o, attrib, materials, shapes[s].mesh.material_ids[f], idx0, idx1, idx2, v);
+				}
+			}
+
+			// Free the remap table for the next shape.
+			for (size_t i = 0; i < shapes[s].mesh.indices.size(); i++) {
+				vertexRemap[shapes[s].mesh.indices[i].vertex_index] = -1;
+			}
+			o.numTriangles = int(numFaces);
+			computeFaceAreas(o.vertices, o.indices, pool, o.faceAreas);
+
+			// OpenGL viewer does not support texturing with per-face material.
+			if (shapes[s].mesh.material_ids.size() > 0) {
+				o.material_id = shapes[s].mesh.material_ids[0];  // use the material ID
+																 // of the first face.
+			}
+			else {
+				o.material_id = materials.size() - 1;  // = ID for default material.
+			}
+			printf("shape[%d] material_id %d\n", int(s), int(o.material_id));
+
+			if (o.numTriangles > 0) {
+				printf("shape[%d] # of triangles = %d, # of vertices = %d\n", static_cast<int>(s), o.numTriangles, int(o.vertices.size() / 3));
+			}
+
+			drawObjects->push_back(o);
+		}
+	}
+
+	printf("bmin = %f, %f, %f\n", bmin[0], bmin[1], bmin[2]);
+	printf("bmax = %f, %f, %f\n", bmax[0], bmax[1], bmax[2]);
+
+	// Face ids count through all shapes, and one vertex and index buffer draws the whole mesh.
+	MergeDrawObjects(*drawObjects, shapeRanges);
+	if (useCache && !writeMeshCache(cacheFile, filename, bmin, bmax, *drawObjects, shapeRanges)) {
+		fprintf(stderr, "Unable to write mesh cache %s\n", cacheFile.c_str());
+	}
+
+	return true;
+}
+
+void MergeDrawObjects(std::vector<DrawObject>& drawObjects, std::vector<ShapeRange>& shapes) {
+	TRACE_SCOPE("merge shapes");
+	shapes.clear();
+	size_t numFaces = 0;
+	size_t numVertices = 0;
+	bool hasAttributes = true;
+	bool hasLabels = false;
+	for (size_t s = 0; s < drawObjects.size(); s++) {
+		const DrawObject& o = drawObjects[s];
+		const ShapeRange shape = { (unsigned int)numFaces, (unsigned int)(o.indices.size() / 3), (unsigned int)numVertices,
+			(unsigned int)(o.vertices.size() / 3), int(o.material_id) };
+		shapes.push_back(shape);
+		numFaces += shape.numFaces;
+		numVertices += shape.numVertices;
+		hasAttributes = hasAttributes && o.normals.size() == 9 * size_t(shape.numFaces) && o.colors.size() == 9 * size_t(shape.numFaces) &&
+			o.uvs.size() == 6 * size_t(shape.numFaces);
+		hasLabels = hasLabels || !o.faceLabels.empty();
+	}
+	if (drawObjects.size() < 2) {
+		return;
+	}
+
+	DrawObject merged;
+	merged.vertices.reserve(3 * numVertices);
+	merged.indices.reserve(3 * numFaces);
+	merged.faceAreas.reserve(numFaces);
+	for (size_t s = 0; s < drawObjects.size(); s++) {
+		DrawObject& o = drawObjects[s];
+		const ShapeRange& shape = shapes[s];
+		merged.vertices.insert(merged.vertices.end(), o.vertices.begin(), o.vertices.end());
+		for (size_t i = 0; i < o.indices.size(); i++) {
+			merged.indices.push_back(o.indices[i] + shape.firstVertex);
+		}
+		merged.faceAreas.insert(merged.faceAreas.end(), o.faceAreas.begin(), o.faceAreas.end());
+		if (hasAttributes) {
+			merged.normals.insert(merged.normals.end(), o.normals.begin(), o.normals.end());
+			merged.colors.insert(merged.colors.end(), o.colors.begin(), o.colors.end());
+			merged.uvs.insert(merged.uvs.end(), o.uvs.begin(), o.uvs.end());
+		}
+		if (hasLabels) {
+			if (o.faceLabels.empty()) {
+				merged.faceLabels.resize(merged.faceLabels.size() + shape.numFaces, -1);
+			}
+			else {
+				merged.faceLabels.insert(merged.faceLabels.end(), o.faceLabels.begin(), o.faceLabels.end());
+			}
+		}
+		// Free every shape once it is copied, so the mesh is not held twice.
+		std::vector<float>().swap(o.vertices);
+		std::vector<unsigned int>().swap(o.indices);
+	}
+	merged.numTriangles = int(numFaces);
+	merged.material_id = drawObjects[0].material_id;
+	drawObjects.clear();
+	drawObjects.push_back(std::move(merged));
+	printf("Merged %d shapes into %d faces and %d vertices\n", int(shapes.size()), int(numFaces), int(numVertices));
+}
@@ -0,0 +1,53 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "tiny_obj_loader.h"
+
+// A shape as indexed triangle list: the vertices used by the shape, 3 floats each, and 3 indices
+// per face. Normals, colors (3 floats) and uvs (2 floats) are stored per face corner in the
+// order of the indices and are only filled when requested from LoadObjAndConvert, like the
+// per face labels of PLY meshes.
+typedef struct {
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<float> uvs;
+	std::vector<float> normals;
+	std::vector<float> colors;
+	std::vector<float> faceAreas;
+	std::vector<int> faceLabels;
+	int numTriangles;
+	size_t material_id;
+} DrawObject;
+
+// The faces and vertices of a shape in a merged DrawObject. Face f of the shape has the global
+// 1-based face id firstFace + f + 1, which is the id in the face maps and the line in areas.txt.
+// The ranges are sorted by firstFace, so the shape of a face id is a binary search away.
+struct ShapeRange {
+	unsigned int firstFace;
+	unsigned int numFaces;
+	unsigned int firstVertex;
+	unsigned int numVertices;
+	int material_id; // material of the first face, -1 if it has none
+};
+
+// Loads an OBJ file, converts every shape and merges them into drawObjects[0] with
+// MergeDrawObjects, shapeRanges receives the ranges of the shapes. Files ending in .ply are read as
+// binary PLY meshes with a single shape.
+// Diffuse textures are only uploaded when loadTextures is set, which requires a current OpenGL context.
+// Normals, colors and uvs are only built when loadAttributes is set, the face maps need positions only.
+bool LoadObjAndConvert(float bmin[3], float bmax[3], std::vector<DrawObject>* drawObjects, std::vector<ShapeRange>& shapeRanges,
+	std::vector<tinyobj::material_t>& materials, std::map<std::string, GLuint>& textures, const char* filename, bool loadTextures, bool loadAttributes);
+
+// Concatenates all shapes into drawObjects[0], so the whole mesh is a single vertex and index
+// buffer with one draw call. The faces keep the order of the shapes, shapes receives their
+// ranges. Per corner attributes are merged when every shape has them, face labels are -1 in
+// shapes without labels.
+void MergeDrawObjects(std::vector<DrawObject>& drawObjects, std::vector<ShapeRange>& shapes);
+
+#endif
@@ -0,0 +1,162 @@
+#include "pch.h"
+#include <experimental/filesystem>
+#include <stdio.h>
+#include <string.h>
+#include <system_error>
+
+#include "mappedfile.hpp"
+#include "meshcache.hpp"
+#include "trace.hpp"
+
+// Size and modification time identify the version of the OBJ file the cache was built from.
+static bool getSourceStamp(const std::string& objFile, unsigned long long& size, long long& time) {
+	namespace fs = std::experimental::filesystem;
+	std::error_code ec;
+	uintmax_t fileSize = fs::file_size(objFile, ec);
+	if (ec) {
+		return false;
+	}
+	fs::file_time_type writeTime = fs::last_write_time(objFile, ec);
+	if (ec) {
+		return false;
+	}
+	size = fileSize;
+	time = (long long)writeTime.time_since_epoch().count();
+	return true;
+}
+
+std::string getMeshCachePath(const std::string& objFile) {
+	return objFile + ".meshcache";
+}
+
+bool loadMeshCache(const std::string& cacheFile, const std::string& objFile, float bmin[3], float bmax[3], std::vector<DrawObject>* drawObjects,
+	std::vector<ShapeRange>& shapes) {
+	unsigned long long sourceSize;
+	long long sourceTime;
+	if (!getSourceStamp(objFile, sourceSize, sourceTime)) {
+		return false;
+	}
+
+	MappedFile file;
+	if (!file.open(cacheFile) || file.size() < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+	MeshCacheHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, "MPVM", 4) != 0 || header.version != MESH_CACHE_VERSION) {
+		printf("Ignoring mesh cache %s, it has an unknown format\n", cacheFile.c_str());
+		return false;
+	}
+	if (header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+		printf("Ignoring mesh cache %s, %s has changed\n", cacheFile.c_str(), objFile.c_str());
+		return false;
+	}
+
+	// Check the size of every section against the file before touching the data, so a
+	// truncated cache falls back to parsing the OBJ file.
+	const char* data = file.data();
+	size_t offset = sizeof(MeshCacheHeader);
+	if (file.size() - offset < size_t(header.numShapes) * sizeof(MeshCacheShape)) {
+		return false;
+	}
+	std::vector<MeshCacheShape> cacheShapes(header.numShapes);
+	if (header.numShapes > 0) {
+		memcpy(&cacheShapes[0], data + offset, cacheShapes.size() * sizeof(MeshCacheShape));
+	}
+	offset += cacheShapes.size() * sizeof(MeshCacheShape);
+	std::vector<ShapeRange> ranges(cacheShapes.size());
+	size_t numVertices = 0;
+	size_t numFaces = 0;
+	for (size_t s = 0; s < cacheShapes.size(); s++) {
+		const ShapeRange range = { (unsigned int)numFaces, cacheShapes[s].numTriangles, (unsigned int)numVertices, cacheShapes[s].numVertices,
+			cacheShapes[s].materialId };
+		ranges[s] = range;
+		numVertices += cacheShapes[s].numVertices;
+		numFaces += cacheShapes[s].numTriangles;
+	}
+	if (offset + (numVertices * 3 + numFaces * 4) * 4 != file.size()) {
+		printf("Ignoring mesh cache %s, it is truncated\n", cacheFile.c_str());
+		return false;
+	}
+	if (ranges.empty()) {
+		shapes.clear();
+		return true;
+	}
+
+	DrawObject o;
+	const float* vertices = (const float*)(data + offset);
+	o.vertices.assign(vertices, vertices + numVertices * 3);
+	offset += o.vertices.size() * sizeof(float);
+	const unsigned int* indices = (const unsigned int*)(data + offset);
+	o.indices.assign(indices, indices + numFaces * 3);
+	offset += o.indices.size() * sizeof(unsigned int);
+	const float* faceAreas = (const float*)(data + offset);
+	o.faceAreas.assign(faceAreas, faceAreas + numFaces);
+	o.numTriangles = int(numFaces);
+	o.material_id = size_t(ranges[0].material_id);
+	for (size_t i = 0; i < o.indices.size(); i++) {
+		if (o.indices[i] >= numVertices) {
+			printf("Ignoring mesh cache %s, it has invalid indices\n", cacheFile.c_str());
+			return false;
+		}
+	}
+	for (size_t s = 0; s < ranges.size(); s++) {
+		printf("shape[%d] # of triangles = %d, # of vertices = %d\n", int(s), int(ranges[s].numFaces), int(ranges[s].numVertices));
+	}
+
+	for (int k = 0; k < 3; k++) {
+		bmin[k] = header.bmin[k];
+		bmax[k] = header.bmax[k];
+	}
+	drawObjects->push_back(std::move(o));
+	shapes.swap(ranges);
+	return true;
+}
+
+bool writeMeshCache(const std::string& cacheFile, const std::string& objFile, const float bmin[3], const float bmax[3], const std::vector<DrawObject>& drawObjects,
+	const std::vector<ShapeRange>& shapes) {
+	TRACE_SCOPE("write mesh cache");
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "MPVM", 4);
+	header.version = MESH_CACHE_VERSION;
+	if (!getSourceStamp(objFile, header.sourceSize, header.sourceTime)) {
+		return false;
+	}
+	header.numShapes = (unsigned int)shapes.size();
+	for (int k = 0; k < 3; k++) {
+		header.bmin[k] = bmin[k];
+		header.bmax[k] = bmax[k];
+	}
+
+	std::string tempFile = cacheFile + ".tmp";
+	FILE* fp = fopen(tempFile.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	for (size_t s = 0; s < shapes.size() && ok; s++) {
+		MeshCacheShape shape;
+		shape.numVertices = shapes[s].numVertices;
+		shape.numTriangles = shapes[s].numFaces;
+		shape.materialId = shapes[s].material_id;
+		shape.reserved = 0;
+		ok = fwrite(&shape, sizeof(shape), 1, fp) == 1;
+	}
+	if (ok && !drawObjects.empty()) {
+		const DrawObject& object = drawObjects[0];
+		ok = fwrite(object.vertices.data(), sizeof(float), object.vertices.size(), fp) == object.vertices.size() &&
+			fwrite(object.indices.data(), sizeof(unsigned int), object.indices.size(), fp) == object.indices.size() &&
+			fwrite(object.faceAreas.data(), sizeof(float), object.faceAreas.size(), fp) == object.faceAreas.size();
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (ok) {
+		// rename does not replace existing files on Windows.
+		remove(cacheFile.c_str());
+		ok = rename(tempFile.c_str(), cacheFile.c_str()) == 0;
+	}
+	if (!ok) {
+		remove(tempFile.c_str());
+	}
+	return ok;
+}
@@ -0,0 +1,52 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <string>
+#include <vector>
+
+#include "mesh.hpp"
+
+// Binary copy of the converted and merged mesh of an OBJ file, stored next to it so re-runs can
+// skip the text parsing. Little-endian layout, every field is 4-byte aligned:
+//   MeshCacheHeader
+//   MeshCacheShape for each of the numShapes shapes, in the order of their faces
+//   vertices of all shapes (3 floats each), indices (3 per face) into them, faceAreas (1 float per face)
+// The shapes are stored merged like MergeDrawObjects leaves them, so a shape starts at the sums
+// of the face and vertex counts of the shapes before it.
+// The header records size and modification time of the OBJ file, the cache is ignored when
+// either changed or the version does not match.
+struct MeshCacheHeader {
+	char magic[4]; // "MPVM"
+	unsigned int version;
+	unsigned long long sourceSize;
+	long long sourceTime;
+	unsigned int numShapes;
+	float bmin[3];
+	float bmax[3];
+	unsigned int reserved;
+};
+
+struct MeshCacheShape {
+	unsigned int numVertices;
+	unsigned int numTriangles;
+	int materialId;
+	unsigned int reserved;
+};
+
+static const unsigned int MESH_CACHE_VERSION = 2;
+
+std::string getMeshCachePath(const std::string& objFile);
+
+// Fills drawObjects with the merged mesh, shapes with its shape ranges and the bounding box from
+// the cache of objFile, returns false if there is no valid cache for the current version of the
+// OBJ file.
+bool loadMeshCache(const std::string& cacheFile, const std::string& objFile, float bmin[3], float bmax[3], std::vector<DrawObject>* drawObjects,
+	std::vector<ShapeRange>& shapes);
+
+// Writes positions, indices, bounding box and face areas of the mesh merged into drawObjects and
+// the face and vertex counts and material ids of its shapes. The file is written under a
+// temporary name first, so concurrent runs never read a partial cache.
+bool writeMeshCache(const std::string& cacheFile, const std::string& objFile, const float bmin[3], const float bmax[3], const std::vector<DrawObject>& drawObjects,
+	const std::vector<ShapeRange>& shapes);
+
+#endif
@@ -0,0 +1,219 @@
+#include "pch.h"
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+#include <utility>
+
+#include "meshorder.hpp"
+#include "parallel.hpp"
+
+double computeACMR(const unsigned int* indices, size_t numFaces, size_t numVertices) {
+	if (numFaces == 0) {
+		return 0.0;
+	}
+	// A vertex is in the FIFO cache while fewer than VERTEX_CACHE_SIZE misses followed its own.
+	std::vector<size_t> missedAt(numVertices, 0);
+	size_t misses = 0;
+	for (size_t i = 0; i < 3 * numFaces; i++) {
+		const unsigned int v = indices[i];
+		if (missedAt[v] == 0 || misses + 1 - missedAt[v] > VERTEX_CACHE_SIZE) {
+			misses++;
+			missedAt[v] = misses;
+		}
+	}
+	return double(misses) / double(numFaces);
+}
+
+namespace {
+
+// Spreads the lower 10 bits of v to every third bit.
+unsigned int expandBits(unsigned int v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// Scores of Forsyth's optimizer: vertices that were just used are kept for the next triangle,
+// the others score by how recently they were used, and vertices with few triangles left get a
+// boost so that no isolated triangles are left behind.
+struct VertexScores {
+	float cache[VERTEX_CACHE_SIZE];
+	float valence[64];
+
+	VertexScores() {
+		for (unsigned int i = 0; i < VERTEX_CACHE_SIZE; i++) {
+			cache[i] = i < 3 ? 0.75f : powf(1.0f - float(i - 3) / float(VERTEX_CACHE_SIZE - 3), 1.5f);
+		}
+		for (int i = 0; i < 64; i++) {
+			valence[i] = i == 0 ? 0.0f : 2.0f / sqrtf(float(i));
+		}
+	}
+
+	float get(int cachePosition, unsigned int remaining) const {
+		if (remaining == 0) {
+			return -1.0f;
+		}
+		return (cachePosition >= 0 ? cache[cachePosition] : 0.0f) + (remaining < 64 ? valence[remaining] : 2.0f / sqrtf(float(remaining)));
+	}
+};
+
+// Reorders the numFaces triangles at indices (and their face ids) of one cluster.
+void optimizeCluster(const std::vector<float>& vertices, unsigned int* indices, unsigned int* faceIds, unsigned int numFaces) {
+	static const VertexScores scores;
+
+	// Morton order of the centroids in the bounds of the cluster.
+	std::vector<float> centroids(3 * size_t(numFaces));
+	float cmin[3] = { 1e30f, 1e30f, 1e30f };
+	float cmax[3] = { -1e30f, -1e30f, -1e30f };
+	for (unsigned int t = 0; t < numFaces; t++) {
+		for (int a = 0; a < 3; a++) {
+			const float c = (vertices[3 * size_t(indices[3 * t]) + a] + vertices[3 * size_t(indices[3 * t + 1]) + a] + vertices[3 * size_t(indices[3 * t + 2]) + a]) / 3.0f;
+			centroids[3 * t + a] = c;
+			cmin[a] = std::min(cmin[a], c);
+			cmax[a] = std::max(cmax[a], c);
+		}
+	}
+	std::vector<std::pair<unsigned int, unsigned int> > curve(numFaces);
+	for (unsigned int t = 0; t < numFaces; t++) {
+		unsigned int code = 0;
+		for (int a = 0; a < 3; a++) {
+			const float extent = cmax[a] - cmin[a];
+			const unsigned int cell = extent > 0.0f ? std::min(1023u, (unsigned int)((centroids[3 * t + a] - cmin[a]) / extent * 1024.0f)) : 0;
+			code |= expandBits(cell) << a;
+		}
+		curve[t] = std::make_pair(code, t);
+	}
+	std::sort(curve.begin(), curve.end());
+
+	// Triangles in curve order with cluster-local vertices.
+	std::vector<unsigned int> used(indices, indices + 3 * size_t(numFaces));
+	std::sort(used.begin(), used.end());
+	used.erase(std::unique(used.begin(), used.end()), used.end());
+	const unsigned int numVertices = (unsigned int)used.size();
+	std::vector<unsigned int> triangles(3 * size_t(numFaces));
+	std::vector<unsigned int> remaining(numVertices, 0);
+	for (unsigned int t = 0; t < numFaces; t++) {
+		for (int c = 0; c < 3; c++) {
+			const unsigned int v = (unsigned int)(std::lower_bound(used.begin(), used.end(), indices[3 * curve[t].second + c]) - used.begin());
+			triangles[3 * t + c] = v;
+			remaining[v]++;
+		}
+	}
+	// Triangles of every vertex that are not emitted yet, remaining[v] of them from offsets[v].
+	std::vector<unsigned int> offsets(numVertices + 1, 0);
+	for (unsigned int v = 0; v < numVertices; v++) {
+		offsets[v + 1] = offsets[v] + remaining[v];
+	}
+	std::vector<unsigned int> adjacent(offsets[numVertices]);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (unsigned int t = 0; t < numFaces; t++) {
+		for (int c = 0; c < 3; c++) {
+			adjacent[fill[triangles[3 * t + c]]++] = t;
+		}
+	}
+
+	std::vector<int> cachePosition(numVertices, -1);
+	std::vector<float> vertexScore(numVertices);
+	for (unsigned int v = 0; v < numVertices; v++) {
+		vertexScore[v] = scores.get(-1, remaining[v]);
+	}
+	std::vector<float> triangleScore(numFaces);
+	for (unsigned int t = 0; t < numFaces; t++) {
+		triangleScore[t] = vertexScore[triangles[3 * t]] + vertexScore[triangles[3 * t + 1]] + vertexScore[triangles[3 * t + 2]];
+	}
+	std::vector<char> emitted(numFaces, 0);
+	std::vector<unsigned int> order;
+	order.reserve(numFaces);
+	std::vector<unsigned int> cache, newCache;
+	unsigned int next = 0;
+	unsigned int best = 0;
+	while (order.size() < numFaces) {
+		// Without a candidate in the cache, continue with the next triangle along the curve.
+		if (best == UINT_MAX) {
+			while (emitted[next]) {
+				next++;
+			}
+			best = next;
+		}
+		order.push_back(best);
+		emitted[best] = 1;
+		newCache.clear();
+		for (int c = 0; c < 3; c++) {
+			const unsigned int v = triangles[3 * best + c];
+			unsigned int* list = &adjacent[offsets[v]];
+			unsigned int* found = std::find(list, list + remaining[v], best);
+			std::swap(*found, list[--remaining[v]]);
+			if (std::find(newCache.begin(), newCache.end(), v) == newCache.end()) {
+				newCache.push_back(v);
+			}
+		}
+		// The corners go to the front, the rest of the cache moves back.
+		const size_t numCorners = newCache.size();
+		for (size_t i = 0; i < cache.size(); i++) {
+			if (std::find(newCache.begin(), newCache.begin() + numCorners, cache[i]) == newCache.begin() + numCorners) {
+				newCache.push_back(cache[i]);
+			}
+		}
+		// Update the vertices that moved in the cache or dropped out of it, and their triangles.
+		for (size_t i = 0; i < newCache.size(); i++) {
+			const unsigned int v = newCache[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? int(i) : -1;
+			vertexScore[v] = scores.get(cachePosition[v], remaining[v]);
+		}
+		best = UINT_MAX;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < newCache.size(); i++) {
+			const unsigned int v = newCache[i];
+			for (unsigned int k = 0; k < remaining[v]; k++) {
+				const unsigned int t = adjacent[offsets[v] + k];
+				triangleScore[t] = vertexScore[triangles[3 * t]] + vertexScore[triangles[3 * t + 1]] + vertexScore[triangles[3 * t + 2]];
+				if (i < VERTEX_CACHE_SIZE && triangleScore[t] > bestScore) {
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+		newCache.resize(std::min<size_t>(newCache.size(), VERTEX_CACHE_SIZE));
+		cache.swap(newCache);
+	}
+
+	std::vector<unsigned int> oldIndices(indices, indices + 3 * size_t(numFaces));
+	std::vector<unsigned int> oldFaceIds(faceIds, faceIds + numFaces);
+	for (unsigned int k = 0; k < numFaces; k++) {
+		const unsigned int t = curve[order[k]].second;
+		for (int c = 0; c < 3; c++) {
+			indices[3 * k + c] = oldIndices[3 * t + c];
+		}
+		faceIds[k] = oldFaceIds[t];
+	}
+}
+
+}
+
+void optimizeClusterOrder(const std::vector<float>& vertices, const ClusterBVH& bvh, std::vector<unsigned int>& indices,
+	std::vector<unsigned int>& faceIds) {
+	std::vector<FaceRange> clusters;
+	bvh.getClusters(clusters);
+	// Clusters touch disjoint ranges, so they are optimized in parallel.
+	TaskPool pool(0);
+	pool.parallelFor(clusters.size(), [&](size_t c, int) {
+		const FaceRange& cluster = clusters[c];
+		optimizeCluster(vertices, &indices[3 * size_t(cluster.first)], &faceIds[cluster.first], cluster.count);
+	});
+}
+
+void reorderVertices(const std::vector<float>& vertices, std::vector<unsigned int>& indices, std::vector<float>& orderedVertices) {
+	std::vector<unsigned int> newIndex(vertices.size() / 3, UINT_MAX);
+	orderedVertices.clear();
+	orderedVertices.reserve(vertices.size());
+	for (size_t i = 0; i < indices.size(); i++) {
+		const unsigned int v = indices[i];
+		if (newIndex[v] == UINT_MAX) {
+			newIndex[v] = (unsigned int)(orderedVertices.size() / 3);
+			orderedVertices.insert(orderedVertices.end(), &vertices[3 * size_t(v)], &vertices[3 * size_t(v)] + 3);
+		}
+		indices[i] = newIndex[v];
+	}
+}
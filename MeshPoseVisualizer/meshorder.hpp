@@ -0,0 +1,35 @@
+#ifndef MESHORDER_HPP
+#define MESHORDER_HPP
+
+#include <vector>
+
+#include "bvh.hpp"
+
+// Triangle and vertex order for cache locality (--reorder-triangles). Meshes from the
+// reconstruction come with their triangles in an order that is close to random in space, so
+// the GPU transforms most vertices several times and the software rasterizer keeps missing
+// its caches. The clusters of the ClusterBVH already group nearby triangles; within every
+// cluster the triangles are sorted along a Morton curve and then reordered with Tom Forsyth's
+// linear-speed vertex cache optimization, which the curve order seeds. Finally the vertices
+// are renumbered in the order the triangles first use them.
+//
+// Only the buffers that are drawn change; faceIds keeps the original 1-based face id of every
+// triangle, so face maps, areas.txt and all other outputs use the ids of the mesh file.
+
+// Size of the simulated post-transform FIFO cache.
+static const unsigned int VERTEX_CACHE_SIZE = 32;
+
+// Average cache miss ratio: transformed vertices per triangle with a FIFO cache of
+// VERTEX_CACHE_SIZE entries. 0.5 is the best a regular grid can do, 3 means no reuse at all.
+double computeACMR(const unsigned int* indices, size_t numFaces, size_t numVertices);
+
+// Reorders the triangles of every cluster in place. indices and faceIds are in the cluster
+// order of bvh, as ClusterBVH::build returns them.
+void optimizeClusterOrder(const std::vector<float>& vertices, const ClusterBVH& bvh, std::vector<unsigned int>& indices,
+	std::vector<unsigned int>& faceIds);
+
+// Renumbers the vertices in the order indices first uses them. orderedVertices receives the
+// used vertices, indices is rewritten to refer to them.
+void reorderVertices(const std::vector<float>& vertices, std::vector<unsigned int>& indices, std::vector<float>& orderedVertices);
+
+#endif
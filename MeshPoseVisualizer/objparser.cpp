@@ -0,0 +1,429 @@
+#include "pch.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mappedfile.hpp"
+#include "objparser.hpp"
+
+// Chunks are large enough to amortize the merge, and there are a few per thread for balance.
+static const size_t MIN_CHUNK_BYTES = 4 << 20;
+static const int CHUNKS_PER_THREAD = 4;
+
+namespace {
+
+// Records that change how later faces are assigned to shapes and materials.
+struct ObjEvent {
+	enum Type { GROUP, OBJECT, USEMTL, MTLLIB };
+	Type type;
+	size_t face; // faces of the chunk before the record
+	std::string name;
+};
+
+struct RelativeCorner {
+	size_t corner;
+	int offset; // relative to the first vertex of the chunk
+};
+
+struct ObjChunk {
+	const char* begin;
+	const char* end;
+	std::vector<float> vertices;
+	// 3 vertex indices per triangle, 0-based. Negative OBJ indices refer to vertices before the
+	// line, they are stored in relativeCorners until the vertex counts of all chunks are known.
+	std::vector<int> corners;
+	std::vector<RelativeCorner> relativeCorners;
+	std::vector<ObjEvent> events;
+	bool supported;
+};
+
+inline bool isSpace(char c) {
+	return c == ' ' || c == '\t';
+}
+
+inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+inline const char* skipSpaces(const char* p, const char* end) {
+	while (p != end && isSpace(*p)) {
+		p++;
+	}
+	return p;
+}
+
+inline const char* skipToken(const char* p, const char* end) {
+	while (p != end && !isSpace(*p) && *p != '\r') {
+		p++;
+	}
+	return p;
+}
+
+}
+
+// The significant digits are collected into one integer which is scaled by a single exactly
+// representable power of ten, this is exact up to 15 significant digits and much faster than
+// strtod. Unparsable values become 0 like in tinyobj.
+const char* parseFloat(const char* p, const char* end, float& value) {
+	static const double powersOf10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	bool negative = false;
+	if (p != end && (*p == '+' || *p == '-')) {
+		negative = *p == '-';
+		p++;
+	}
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool found = false;
+	for (; p != end && isDigit(*p); p++) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		}
+		else {
+			exponent++;
+		}
+		found = true;
+	}
+	if (p != end && *p == '.') {
+		for (p++; p != end && isDigit(*p); p++) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+			found = true;
+		}
+	}
+	if (!found) {
+		value = 0.0f;
+		return p;
+	}
+	if (p != end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negativeExponent = false;
+		if (p != end && (*p == '+' || *p == '-')) {
+			negativeExponent = *p == '-';
+			p++;
+		}
+		int e = 0;
+		for (; p != end && isDigit(*p); p++) {
+			e = std::min(e * 10 + (*p - '0'), 100000);
+		}
+		exponent += negativeExponent ? -e : e;
+	}
+	double result = double(mantissa);
+	if (exponent < 0) {
+		result = exponent >= -22 ? result / powersOf10[-exponent] : result * pow(10.0, exponent);
+	}
+	else if (exponent > 0) {
+		result = exponent <= 22 ? result * powersOf10[exponent] : result * pow(10.0, exponent);
+	}
+	value = float(negative ? -result : result);
+	return p;
+}
+
+namespace {
+
+// Integer prefix of a face corner like "12/4/7", the texture and normal indices are skipped.
+const char* parseInt(const char* p, const char* end, int& value) {
+	bool negative = false;
+	if (p != end && (*p == '+' || *p == '-')) {
+		negative = *p == '-';
+		p++;
+	}
+	long long result = 0;
+	for (; p != end && isDigit(*p); p++) {
+		result = std::min(result * 10 + (*p - '0'), 1LL << 32);
+	}
+	value = int(std::max(-(1LL << 31), std::min(negative ? -result : result, (1LL << 31) - 1)));
+	return p;
+}
+
+inline bool hasKeyword(const char* p, const char* end, const char* keyword, size_t length) {
+	return size_t(end - p) > length && memcmp(p, keyword, length) == 0 && isSpace(p[length]);
+}
+
+void parseLine(ObjChunk& chunk, const char* p, const char* end) {
+	if (end != p && end[-1] == '\r') {
+		end--;
+	}
+	p = skipSpaces(p, end);
+	if (p == end || *p == '#') {
+		return;
+	}
+
+	if (hasKeyword(p, end, "v", 1)) {
+		p += 2;
+		for (int k = 0; k < 3; k++) {
+			float value;
+			p = skipSpaces(p, end);
+			p = skipToken(parseFloat(p, end, value), end);
+			chunk.vertices.push_back(value);
+		}
+		return;
+	}
+
+	if (hasKeyword(p, end, "f", 1)) {
+		p += 2;
+		const int numVertices = int(chunk.vertices.size() / 3);
+		int corner[3];
+		bool relative[3];
+		int numCorners = 0;
+		for (p = skipSpaces(p, end); p != end; p = skipSpaces(p, end)) {
+			int index;
+			p = skipToken(parseInt(p, end, index), end);
+			if (index == 0 || numCorners == 3) {
+				// Invalid index or a polygon, tinyobj reports the first and triangulates the second.
+				chunk.supported = false;
+				return;
+			}
+			relative[numCorners] = index < 0;
+			corner[numCorners] = index > 0 ? index - 1 : numVertices + index;
+			numCorners++;
+		}
+		if (numCorners < 3) {
+			// Faces need 3 corners, tinyobj skips the others.
+			return;
+		}
+		for (int k = 0; k < 3; k++) {
+			if (relative[k]) {
+				RelativeCorner r = { chunk.corners.size(), corner[k] };
+				chunk.relativeCorners.push_back(r);
+				chunk.corners.push_back(0);
+			}
+			else {
+				chunk.corners.push_back(corner[k]);
+			}
+		}
+		return;
+	}
+
+	ObjEvent event;
+	event.face = chunk.corners.size() / 3;
+	if (hasKeyword(p, end, "g", 1) || hasKeyword(p, end, "o", 1)) {
+		event.type = *p == 'g' ? ObjEvent::GROUP : ObjEvent::OBJECT;
+		chunk.events.push_back(event);
+	}
+	else if (hasKeyword(p, end, "usemtl", 6) || hasKeyword(p, end, "mtllib", 6)) {
+		event.type = *p == 'u' ? ObjEvent::USEMTL : ObjEvent::MTLLIB;
+		event.name.assign(p + 7, end);
+		chunk.events.push_back(event);
+	}
+	// Texture coordinates, normals, lines, smoothing groups and tags are not needed.
+}
+
+void parseChunk(ObjChunk& chunk) {
+	chunk.supported = true;
+	// Rough guess for scans: half of the lines are vertices, half are faces, ~30 bytes each.
+	size_t bytes = size_t(chunk.end - chunk.begin);
+	chunk.vertices.reserve(bytes / 60 * 3);
+	chunk.corners.reserve(bytes / 60 * 3);
+
+	const char* p = chunk.begin;
+	while (p < chunk.end && chunk.supported) {
+		const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+		if (!lineEnd) {
+			lineEnd = chunk.end;
+		}
+		parseLine(chunk, p, lineEnd);
+		p = lineEnd + 1;
+	}
+}
+
+void loadMaterialLibrary(const std::string& names, const std::string& mtlBaseDir, std::vector<tinyobj::material_t>& materials,
+	std::map<std::string, int>& materialMap, std::string& warn) {
+	// Same directory handling as tinyobj::LoadObj.
+	std::string baseDir = mtlBaseDir;
+#ifdef _WIN32
+	const char separator = '\\';
+#else
+	const char separator = '/';
+#endif
+	if (!baseDir.empty() && baseDir[baseDir.size() - 1] != separator) {
+		baseDir += separator;
+	}
+	tinyobj::MaterialFileReader reader(baseDir);
+	size_t start = 0;
+	while (start < names.size()) {
+		size_t stop = names.find(' ', start);
+		if (stop == std::string::npos) {
+			stop = names.size();
+		}
+		if (stop > start) {
+			std::string mtlWarn, mtlErr;
+			bool ok = reader(names.substr(start, stop - start), &materials, &materialMap, &mtlWarn, &mtlErr);
+			warn += mtlWarn + mtlErr;
+			if (ok) {
+				return;
+			}
+		}
+		start = stop + 1;
+	}
+	warn += "Failed to load material file(s). Use default material.\n";
+}
+
+}
+
+bool parseObjParallel(const std::string& filename, const std::string& mtlBaseDir, TaskPool& pool, ObjTriangleMesh& mesh,
+	std::vector<tinyobj::material_t>& materials, std::string& warn) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		return false;
+	}
+
+	// Line aligned chunks, every chunk starts after a newline.
+	const char* data = file.data();
+	const char* dataEnd = data + file.size();
+	size_t numChunks = std::max<size_t>(1, std::min(file.size() / MIN_CHUNK_BYTES, size_t(pool.size()) * CHUNKS_PER_THREAD));
+	std::vector<ObjChunk> chunks(numChunks);
+	const char* begin = data;
+	for (size_t c = 0; c < numChunks; c++) {
+		const char* end = c + 1 == numChunks ? dataEnd : data + file.size() / numChunks * (c + 1);
+		end = std::max(end, begin);
+		const char* newline = end < dataEnd ? (const char*)memchr(end, '\n', dataEnd - end) : nullptr;
+		end = c + 1 == numChunks || !newline ? dataEnd : newline + 1;
+		chunks[c].begin = begin;
+		chunks[c].end = end;
+		begin = end;
+	}
+
+	pool.parallelFor(numChunks, [&](size_t c, int) {
+		parseChunk(chunks[c]);
+	});
+
+	std::vector<size_t> vertexBase(numChunks + 1, 0);
+	std::vector<size_t> faceBase(numChunks + 1, 0);
+	for (size_t c = 0; c < numChunks; c++) {
+		if (!chunks[c].supported) {
+			return false;
+		}
+		vertexBase[c + 1] = vertexBase[c] + chunks[c].vertices.size() / 3;
+		faceBase[c + 1] = faceBase[c] + chunks[c].corners.size() / 3;
+	}
+	const size_t numVertices = vertexBase[numChunks];
+	const size_t numFaces = faceBase[numChunks];
+	if (numVertices >= (1ull << 32) || numFaces * 3 >= (1ull << 32)) {
+		return false;
+	}
+
+	mesh.vertices.resize(3 * numVertices);
+	mesh.indices.resize(3 * numFaces);
+	std::vector<char> valid(numChunks, 1);
+	pool.parallelFor(numChunks, [&](size_t c, int) {
+		ObjChunk& chunk = chunks[c];
+		std::copy(chunk.vertices.begin(), chunk.vertices.end(), mesh.vertices.begin() + 3 * vertexBase[c]);
+		unsigned int* indices = &mesh.indices[0] + 3 * faceBase[c];
+		bool ok = true;
+		for (size_t i = 0; i < chunk.corners.size(); i++) {
+			int index = chunk.corners[i];
+			ok &= index >= 0 && size_t(index) < numVertices;
+			indices[i] = (unsigned int)index;
+		}
+		for (size_t i = 0; i < chunk.relativeCorners.size(); i++) {
+			long long index = (long long)vertexBase[c] + chunk.relativeCorners[i].offset;
+			ok &= index >= 0 && (unsigned long long)index < numVertices;
+			indices[chunk.relativeCorners[i].corner] = (unsigned int)index;
+		}
+		valid[c] = ok;
+		std::vector<float>().swap(chunk.vertices);
+		std::vector<int>().swap(chunk.corners);
+	});
+	for (size_t c = 0; c < numChunks; c++) {
+		if (!valid[c]) {
+			// Out of range indices, let tinyobj report them.
+			return false;
+		}
+	}
+
+	// Replay the g, o, usemtl and mtllib records in file order. A shape takes the material of
+	// its first face, usemtl does not start a new shape.
+	std::map<std::string, int> materialMap;
+	int material = -1;
+	ObjShapeRange shape = { 0, 0, -1 };
+	bool shapeMaterialKnown = false;
+	mesh.shapes.clear();
+	for (size_t c = 0; c < numChunks; c++) {
+		for (size_t e = 0; e < chunks[c].events.size(); e++) {
+			const ObjEvent& event = chunks[c].events[e];
+			size_t face = faceBase[c] + event.face;
+			if (!shapeMaterialKnown && face > shape.firstFace) {
+				shape.materialId = material;
+				shapeMaterialKnown = true;
+			}
+			if (event.type == ObjEvent::GROUP || event.type == ObjEvent::OBJECT) {
+				if (face > shape.firstFace) {
+					shape.numFaces = face - shape.firstFace;
+					mesh.shapes.push_back(shape);
+				}
+				shape.firstFace = face;
+				shapeMaterialKnown = false;
+			}
+			else if (event.type == ObjEvent::USEMTL) {
+				std::map<std::string, int>::const_iterator it = materialMap.find(event.name);
+				material = it != materialMap.end() ? it->second : -1;
+			}
+			else {
+				loadMaterialLibrary(event.name, mtlBaseDir, materials, materialMap, warn);
+			}
+		}
+	}
+	if (numFaces > shape.firstFace) {
+		if (!shapeMaterialKnown) {
+			shape.materialId = material;
+		}
+		shape.numFaces = numFaces - shape.firstFace;
+		mesh.shapes.push_back(shape);
+	}
+	return true;
+}
+
+void benchmarkObjLoaders(const std::string& filename, int numThreads) {
+	std::string baseDir = filename.find_last_of("/\\") != std::string::npos ? filename.substr(0, filename.find_last_of("/\\") + 1) : "./";
+
+	auto start = std::chrono::steady_clock::now();
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn, err;
+	bool tinyobjOk = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str(), baseDir.c_str());
+	double tinyobjSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	TaskPool pool(numThreads);
+	start = std::chrono::steady_clock::now();
+	ObjTriangleMesh mesh;
+	std::vector<tinyobj::material_t> parallelMaterials;
+	std::string parallelWarn;
+	bool parallelOk = parseObjParallel(filename, baseDir, pool, mesh, parallelMaterials, parallelWarn);
+	double parallelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("tinyobj:  %.3f s%s\n", tinyobjSeconds, tinyobjOk ? "" : " (failed)");
+	printf("parallel: %.3f s on %d threads%s, %.1fx faster\n", parallelSeconds, pool.size(),
+		parallelOk ? "" : " (not supported, would fall back to tinyobj)", parallelSeconds > 0.0 ? tinyobjSeconds / parallelSeconds : 0.0);
+	if (!tinyobjOk || !parallelOk) {
+		return;
+	}
+
+	// Same triangles in the same shapes, and how far the parsed positions are apart.
+	bool sameTriangles = shapes.size() == mesh.shapes.size() && attrib.vertices.size() == mesh.vertices.size();
+	for (size_t s = 0; s < shapes.size() && sameTriangles; s++) {
+		const ObjShapeRange& range = mesh.shapes[s];
+		sameTriangles = shapes[s].mesh.indices.size() == 3 * range.numFaces &&
+			(range.numFaces == 0 || shapes[s].mesh.material_ids[0] == range.materialId);
+		for (size_t i = 0; i < shapes[s].mesh.indices.size() && sameTriangles; i++) {
+			sameTriangles = (unsigned int)shapes[s].mesh.indices[i].vertex_index == mesh.indices[3 * range.firstFace + i];
+		}
+	}
+	float maxDifference = 0.0f;
+	for (size_t i = 0; i < attrib.vertices.size() && sameTriangles; i++) {
+		maxDifference = std::max(maxDifference, fabsf(attrib.vertices[i] - mesh.vertices[i]));
+	}
+	printf("%d vertices, %d triangles, %d shapes: %s, max position difference %g\n", int(mesh.vertices.size() / 3),
+		int(mesh.indices.size() / 3), int(mesh.shapes.size()), sameTriangles ? "same triangles" : "triangles differ", maxDifference);
+}
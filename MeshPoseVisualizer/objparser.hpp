@@ -0,0 +1,41 @@
+#ifndef OBJPARSER_HPP
+#define OBJPARSER_HPP
+
+#include <string>
+#include <vector>
+
+#include "tiny_obj_loader.h"
+#include "parallel.hpp"
+
+// Triangles of one shape of a parsed OBJ file, a range of faces in ObjTriangleMesh::indices.
+struct ObjShapeRange {
+	size_t firstFace;
+	size_t numFaces;
+	int materialId; // material of the first face, -1 if none was set
+};
+
+// Positions and triangles of a whole OBJ file, indices are 0-based into vertices.
+struct ObjTriangleMesh {
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<ObjShapeRange> shapes;
+};
+
+// Parses the positions and faces of an OBJ file on all threads of pool. The file is split into
+// line aligned chunks which are parsed concurrently, relative (negative) indices and usemtl are
+// resolved when the chunks are merged. Shapes are split at g and o records like tinyobj does.
+// Texture coordinates and normals are skipped, they are not needed for the face maps.
+// Returns false if the file can not be read or uses something only tinyobj handles, such as
+// polygons with more than 3 corners or invalid indices; the caller then falls back to tinyobj.
+bool parseObjParallel(const std::string& filename, const std::string& mtlBaseDir, TaskPool& pool, ObjTriangleMesh& mesh,
+	std::vector<tinyobj::material_t>& materials, std::string& warn);
+
+// Parses a decimal number like "-1.25e-3" at p and returns the end of it. If there is no number
+// at p, p is returned and value is 0. Also used for the camera matrices.
+const char* parseFloat(const char* p, const char* end, float& value);
+
+// Loads filename with tinyobj and with parseObjParallel, prints both load times and whether
+// they produced the same triangles.
+void benchmarkObjLoaders(const std::string& filename, int numThreads);
+
+#endif
@@ -0,0 +1,85 @@
+#include "pch.h"
+
+#include "parallel.hpp"
+
+int getHardwareThreadCount() {
+	unsigned int n = std::thread::hardware_concurrency();
+	return n > 0 ? int(n) : 1;
+}
+
+TaskPool::TaskPool(int numThreads) : numThreads(numThreads > 0 ? numThreads : getHardwareThreadCount()),
+	currentTask(nullptr), taskCount(0), nextIndex(0), busyWorkers(0), generation(0), stopping(false) {
+	// Thread 0 is the caller of parallelFor, only the others get a std::thread.
+	for (int i = 1; i < this->numThreads; i++) {
+		workers.push_back(std::thread(&TaskPool::workerLoop, this, i));
+	}
+}
+
+TaskPool::~TaskPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void TaskPool::parallelFor(size_t count, const std::function<void(size_t, int)>& task) {
+	if (count == 0) {
+		return;
+	}
+	if (workers.empty() || count == 1) {
+		for (size_t i = 0; i < count; i++) {
+			task(i, 0);
+		}
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentTask = &task;
+		taskCount = count;
+		nextIndex = 0;
+		busyWorkers = int(workers.size());
+		generation++;
+	}
+	wakeCondition.notify_all();
+
+	runTasks(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return busyWorkers == 0; });
+	currentTask = nullptr;
+}
+
+void TaskPool::runTasks(int threadIndex) {
+	for (;;) {
+		size_t index = nextIndex.fetch_add(1);
+		if (index >= taskCount) {
+			break;
+		}
+		(*currentTask)(index, threadIndex);
+	}
+}
+
+void TaskPool::workerLoop(int threadIndex) {
+	unsigned long long seenGeneration = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+			if (stopping) {
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		runTasks(threadIndex);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0) {
+			doneCondition.notify_one();
+		}
+	}
+}
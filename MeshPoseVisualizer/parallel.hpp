@@ -0,0 +1,44 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads used to split a loop over [0, count) across cores.
+// The calling thread takes part in every loop, so a pool of size 1 runs everything inline.
+class TaskPool {
+public:
+	// numThreads <= 0 uses one thread per hardware core.
+	explicit TaskPool(int numThreads);
+	~TaskPool();
+
+	int size() const { return numThreads; }
+
+	// Calls task(index, threadIndex) once for every index and returns when all calls are done.
+	// Indices are handed out dynamically, threadIndex is in [0, size()).
+	void parallelFor(size_t count, const std::function<void(size_t, int)>& task);
+
+private:
+	void workerLoop(int threadIndex);
+	void runTasks(int threadIndex);
+
+	int numThreads;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	const std::function<void(size_t, int)>* currentTask;
+	size_t taskCount;
+	std::atomic<size_t> nextIndex;
+	int busyWorkers;
+	unsigned long long generation;
+	bool stopping;
+};
+
+int getHardwareThreadCount();
+
+#endif
@@ -0,0 +1,389 @@
+#include "pch.h"
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+
+#include "mappedfile.hpp"
+#include "plyloader.hpp"
+
+namespace {
+
+enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+struct PlyProperty {
+	std::string name;
+	PlyType type;      // type of the value, or of the list items
+	bool isList;
+	PlyType countType; // type of the item count of lists
+	size_t offset;     // offset in the element, only valid before the first list property
+};
+
+struct PlyElement {
+	std::string name;
+	size_t count;
+	std::vector<PlyProperty> properties;
+	// Elements without list properties have a fixed size.
+	bool fixedSize;
+	size_t stride;
+
+	int findProperty(const char* propertyName) const {
+		for (size_t i = 0; i < properties.size(); i++) {
+			if (properties[i].name == propertyName) {
+				return int(i);
+			}
+		}
+		return -1;
+	}
+};
+
+PlyType parseType(const std::string& name) {
+	if (name == "char" || name == "int8") return PLY_INT8;
+	if (name == "uchar" || name == "uint8") return PLY_UINT8;
+	if (name == "short" || name == "int16") return PLY_INT16;
+	if (name == "ushort" || name == "uint16") return PLY_UINT16;
+	if (name == "int" || name == "int32") return PLY_INT32;
+	if (name == "uint" || name == "uint32") return PLY_UINT32;
+	if (name == "float" || name == "float32") return PLY_FLOAT32;
+	if (name == "double" || name == "float64") return PLY_FLOAT64;
+	return PLY_INVALID;
+}
+
+size_t typeSize(PlyType type) {
+	static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+	return sizes[type];
+}
+
+// Values are little-endian like all supported platforms, memcpy handles the missing alignment.
+template <typename T>
+inline T load(const char* p) {
+	T value;
+	memcpy(&value, p, sizeof(T));
+	return value;
+}
+
+inline double readValue(const char* p, PlyType type) {
+	switch (type) {
+	case PLY_INT8: return load<signed char>(p);
+	case PLY_UINT8: return load<unsigned char>(p);
+	case PLY_INT16: return load<short>(p);
+	case PLY_UINT16: return load<unsigned short>(p);
+	case PLY_INT32: return load<int>(p);
+	case PLY_UINT32: return load<unsigned int>(p);
+	case PLY_FLOAT32: return load<float>(p);
+	case PLY_FLOAT64: return load<double>(p);
+	default: return 0.0;
+	}
+}
+
+inline long long readInteger(const char* p, PlyType type) {
+	switch (type) {
+	case PLY_INT8: return load<signed char>(p);
+	case PLY_UINT8: return load<unsigned char>(p);
+	case PLY_INT16: return load<short>(p);
+	case PLY_UINT16: return load<unsigned short>(p);
+	case PLY_INT32: return load<int>(p);
+	case PLY_UINT32: return load<unsigned int>(p);
+	default: return (long long)readValue(p, type);
+	}
+}
+
+bool parseHeader(const char* data, size_t size, std::vector<PlyElement>& elements, size_t& headerSize, std::string& error) {
+	size_t pos = 0;
+	bool first = true;
+	for (;;) {
+		const char* lineEnd = (const char*)memchr(data + pos, '\n', size - pos);
+		if (!lineEnd) {
+			error = "the header has no end_header line";
+			return false;
+		}
+		std::string line(data + pos, lineEnd);
+		pos = size_t(lineEnd - data) + 1;
+		if (!line.empty() && line[line.size() - 1] == '\r') {
+			line.erase(line.size() - 1);
+		}
+
+		std::istringstream tokens(line);
+		std::string keyword;
+		tokens >> keyword;
+		if (first) {
+			if (keyword != "ply") {
+				error = "it is not a PLY file";
+				return false;
+			}
+			first = false;
+		}
+		else if (keyword == "format") {
+			std::string format;
+			tokens >> format;
+			if (format != "binary_little_endian") {
+				error = "only binary_little_endian PLY files are supported, not " + format;
+				return false;
+			}
+		}
+		else if (keyword == "element") {
+			PlyElement element;
+			tokens >> element.name >> element.count;
+			element.fixedSize = true;
+			element.stride = 0;
+			elements.push_back(element);
+		}
+		else if (keyword == "property") {
+			if (elements.empty()) {
+				error = "property outside of an element";
+				return false;
+			}
+			PlyElement& element = elements.back();
+			PlyProperty property;
+			std::string typeName;
+			tokens >> typeName;
+			property.isList = typeName == "list";
+			property.countType = PLY_INVALID;
+			if (property.isList) {
+				std::string countTypeName;
+				tokens >> countTypeName >> typeName;
+				property.countType = parseType(countTypeName);
+			}
+			tokens >> property.name;
+			property.type = parseType(typeName);
+			if (property.type == PLY_INVALID || (property.isList && property.countType == PLY_INVALID)) {
+				error = "unknown type in \"" + line + "\"";
+				return false;
+			}
+			property.offset = element.stride;
+			if (property.isList) {
+				element.fixedSize = false;
+			}
+			else if (element.fixedSize) {
+				element.stride += typeSize(property.type);
+			}
+			element.properties.push_back(property);
+		}
+		else if (keyword == "end_header") {
+			headerSize = pos;
+			return true;
+		}
+		// comment and obj_info lines are ignored
+	}
+}
+
+// Size of one item of an element with list properties, or 0 if it does not fit before end.
+size_t itemSize(const PlyElement& element, const char* p, const char* end) {
+	size_t size = 0;
+	for (size_t i = 0; i < element.properties.size(); i++) {
+		const PlyProperty& property = element.properties[i];
+		if (property.isList) {
+			if (size_t(end - p) < size + typeSize(property.countType)) {
+				return 0;
+			}
+			long long count = readInteger(p + size, property.countType);
+			if (count < 0) {
+				return 0;
+			}
+			size += typeSize(property.countType) + size_t(count) * typeSize(property.type);
+		}
+		else {
+			size += typeSize(property.type);
+		}
+	}
+	return size <= size_t(end - p) ? size : 0;
+}
+
+bool readVertices(const PlyElement& element, const char*& p, const char* end, PlyMesh& mesh, bool loadColors, std::string& error) {
+	int x = element.findProperty("x");
+	int y = element.findProperty("y");
+	int z = element.findProperty("z");
+	if (x < 0 || y < 0 || z < 0 || !element.fixedSize) {
+		error = "vertices need x, y and z and can not have list properties";
+		return false;
+	}
+	if (element.stride != 0 && size_t(end - p) / element.stride < element.count) {
+		error = "the vertex data is truncated";
+		return false;
+	}
+
+	const std::vector<PlyProperty>& properties = element.properties;
+	const bool packedPositions = element.properties.size() == 3 && x == 0 && y == 1 && z == 2 &&
+		properties[0].type == PLY_FLOAT32 && properties[1].type == PLY_FLOAT32 && properties[2].type == PLY_FLOAT32;
+	mesh.vertices.resize(3 * element.count);
+	if (packedPositions) {
+		// The vertex block has the layout of the vertex array.
+		if (element.count > 0) {
+			memcpy(&mesh.vertices[0], p, element.count * element.stride);
+		}
+	}
+	else {
+		const size_t offsets[3] = { properties[x].offset, properties[y].offset, properties[z].offset };
+		const PlyType types[3] = { properties[x].type, properties[y].type, properties[z].type };
+		for (size_t i = 0; i < element.count; i++) {
+			const char* vertex = p + i * element.stride;
+			for (int k = 0; k < 3; k++) {
+				mesh.vertices[3 * i + k] = types[k] == PLY_FLOAT32 ? load<float>(vertex + offsets[k]) : float(readValue(vertex + offsets[k], types[k]));
+			}
+		}
+	}
+
+	int red = element.findProperty("red");
+	int green = element.findProperty("green");
+	int blue = element.findProperty("blue");
+	if (loadColors && red >= 0 && green >= 0 && blue >= 0) {
+		const int channels[3] = { red, green, blue };
+		mesh.colors.resize(3 * element.count);
+		for (size_t i = 0; i < element.count; i++) {
+			const char* vertex = p + i * element.stride;
+			for (int k = 0; k < 3; k++) {
+				const PlyProperty& property = properties[channels[k]];
+				double value = readValue(vertex + property.offset, property.type);
+				// Float colors are in [0, 1].
+				if (property.type == PLY_FLOAT32 || property.type == PLY_FLOAT64) {
+					value *= 255.0;
+				}
+				mesh.colors[3 * i + k] = (unsigned char)(value < 0.0 ? 0.0 : value > 255.0 ? 255.0 : value + 0.5);
+			}
+		}
+	}
+
+	p += element.count * element.stride;
+	return true;
+}
+
+bool readFaces(const PlyElement& element, const char*& p, const char* end, PlyMesh& mesh, bool loadLabels, std::string& error) {
+	int list = element.findProperty("vertex_indices");
+	if (list < 0) {
+		list = element.findProperty("vertex_index");
+	}
+	if (list < 0 || !element.properties[list].isList) {
+		error = "faces need a vertex_indices list";
+		return false;
+	}
+	int label = loadLabels ? element.findProperty("label") : -1;
+	if (label >= 0 && element.properties[label].isList) {
+		label = -1;
+	}
+
+	const PlyProperty& indexList = element.properties[list];
+	mesh.indices.reserve(3 * element.count);
+	if (label >= 0) {
+		mesh.faceLabels.reserve(element.count);
+	}
+
+	// ScanNet style faces: nothing but a list with an uchar count and 32-bit indices.
+	const bool simpleFaces = element.properties.size() == 1 && indexList.countType == PLY_UINT8 &&
+		(indexList.type == PLY_INT32 || indexList.type == PLY_UINT32);
+	unsigned int corners[3];
+	for (size_t f = 0; f < element.count; f++) {
+		if (simpleFaces && end - p >= 13 && (unsigned char)p[0] == 3) {
+			memcpy(corners, p + 1, sizeof(corners));
+			mesh.indices.insert(mesh.indices.end(), corners, corners + 3);
+			p += 13;
+			continue;
+		}
+
+		size_t size = itemSize(element, p, end);
+		if (size == 0) {
+			error = "the face data is truncated";
+			return false;
+		}
+		const char* q = p;
+		int faceLabel = 0;
+		for (size_t i = 0; i < element.properties.size(); i++) {
+			const PlyProperty& property = element.properties[i];
+			if (!property.isList) {
+				if (int(i) == label) {
+					faceLabel = int(readInteger(q, property.type));
+				}
+				q += typeSize(property.type);
+				continue;
+			}
+			size_t count = size_t(readInteger(q, property.countType));
+			q += typeSize(property.countType);
+			if (int(i) == list) {
+				// Polygons become a fan of triangles around their first corner.
+				size_t itemBytes = typeSize(property.type);
+				for (size_t k = 2; k < count; k++) {
+					mesh.indices.push_back((unsigned int)readInteger(q, property.type));
+					mesh.indices.push_back((unsigned int)readInteger(q + (k - 1) * itemBytes, property.type));
+					mesh.indices.push_back((unsigned int)readInteger(q + k * itemBytes, property.type));
+				}
+			}
+			q += count * typeSize(property.type);
+		}
+		if (label >= 0) {
+			// The label can come after the list, so the triangles of the face are labeled last.
+			mesh.faceLabels.resize(mesh.indices.size() / 3, faceLabel);
+		}
+		p += size;
+	}
+	return true;
+}
+
+}
+
+bool LoadPly(const std::string& filename, PlyMesh& mesh, bool loadColors, bool loadLabels) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		fprintf(stderr, "Failed to load %s\n", filename.c_str());
+		return false;
+	}
+
+	std::vector<PlyElement> elements;
+	size_t headerSize = 0;
+	std::string error;
+	if (!parseHeader(file.data(), file.size(), elements, headerSize, error)) {
+		fprintf(stderr, "Failed to load %s: %s\n", filename.c_str(), error.c_str());
+		return false;
+	}
+
+	// Elements are stored one after the other in the order of the header.
+	const char* p = file.data() + headerSize;
+	const char* end = file.data() + file.size();
+	bool foundVertices = false;
+	bool foundFaces = false;
+	for (size_t e = 0; e < elements.size(); e++) {
+		const PlyElement& element = elements[e];
+		bool ok = true;
+		if (element.name == "vertex") {
+			ok = readVertices(element, p, end, mesh, loadColors, error);
+			foundVertices = true;
+		}
+		else if (element.name == "face") {
+			ok = readFaces(element, p, end, mesh, loadLabels, error);
+			foundFaces = true;
+		}
+		else if (element.fixedSize) {
+			if (element.stride != 0 && size_t(end - p) / element.stride < element.count) {
+				error = "element " + element.name + " is truncated";
+				ok = false;
+			}
+			else {
+				p += element.count * element.stride;
+			}
+		}
+		else {
+			for (size_t i = 0; i < element.count && ok; i++) {
+				size_t size = itemSize(element, p, end);
+				ok = size > 0;
+				p += size;
+			}
+			if (!ok) {
+				error = "element " + element.name + " is truncated";
+			}
+		}
+		if (!ok) {
+			fprintf(stderr, "Failed to load %s: %s\n", filename.c_str(), error.c_str());
+			return false;
+		}
+	}
+	if (!foundVertices || !foundFaces) {
+		fprintf(stderr, "Failed to load %s: it needs vertex and face elements\n", filename.c_str());
+		return false;
+	}
+
+	const size_t numVertices = mesh.vertices.size() / 3;
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		if (mesh.indices[i] >= numVertices) {
+			fprintf(stderr, "Failed to load %s: face %d uses vertex %u of %d\n", filename.c_str(), int(i / 3), mesh.indices[i], int(numVertices));
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,22 @@
+#ifndef PLYLOADER_HPP
+#define PLYLOADER_HPP
+
+#include <string>
+#include <vector>
+
+// Mesh read from a binary little-endian PLY file, like the ScanNet *_vh_clean_2.ply meshes.
+// Faces with more than 3 corners are split into a fan of triangles.
+struct PlyMesh {
+	std::vector<float> vertices;          // x, y, z per vertex
+	std::vector<unsigned int> indices;    // 3 per triangle
+	std::vector<unsigned char> colors;    // red, green, blue per vertex, empty if the file has none
+	std::vector<int> faceLabels;          // label per triangle, empty if the faces have no label property
+};
+
+// Reads the vertex and face elements of filename, other elements are skipped.
+// Colors and labels are only read when requested and present.
+// The file is memory mapped; when the vertices are stored as 3 floats without other
+// properties their block is copied in one go.
+bool LoadPly(const std::string& filename, PlyMesh& mesh, bool loadColors, bool loadLabels);
+
+#endif
@@ -0,0 +1,138 @@
+#include "pch.h"
+#include <math.h>
+#include <stdio.h>
+
+#include "objparser.hpp"
+#include "poses.hpp"
+
+static bool isSeparator(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Parses up to count numbers, skipping whitespace and lines starting with #. Tokens that are
+// not numbers, such as "nan", become NaN so they are caught with the infinite values.
+// numParsed receives the number of values found before the end of the text.
+static const char* parseValues(const char* p, const char* end, float* values, int count, int& numParsed) {
+	numParsed = 0;
+	for (int i = 0; i < count; i++) {
+		while (p != end && (isSeparator(*p) || *p == '#')) {
+			if (*p == '#') {
+				while (p != end && *p != '\n') {
+					p++;
+				}
+			}
+			else {
+				p++;
+			}
+		}
+		if (p == end) {
+			break;
+		}
+		const char* next = parseFloat(p, end, values[i]);
+		if (next == p || (next != end && !isSeparator(*next))) {
+			values[i] = NAN;
+			while (next != end && !isSeparator(*next)) {
+				next++;
+			}
+		}
+		p = next;
+		numParsed++;
+	}
+	return p;
+}
+
+static bool isFiniteMatrix(const float* matrix) {
+	for (int i = 0; i < 16; i++) {
+		if (!isfinite(matrix[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool readMatrixFile(const std::string& path, float matrix[16]) {
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp) {
+		return false;
+	}
+	// Matrix files are a few hundred bytes, a larger one is read in pieces.
+	std::vector<char> contents(1024);
+	size_t length = 0;
+	size_t n;
+	while ((n = fread(&contents[length], 1, contents.size() - length, fp)) > 0) {
+		length += n;
+		if (length == contents.size()) {
+			contents.resize(2 * contents.size());
+		}
+	}
+	fclose(fp);
+	int numParsed;
+	parseValues(contents.data(), contents.data() + length, matrix, 16, numParsed);
+	return numParsed == 16 && isFiniteMatrix(matrix);
+}
+
+bool PoseSet::loadPoseFiles(const std::vector<std::string>& files, TaskPool& pool) {
+	parsed.resize(16 * files.size());
+	valid.assign(files.size(), 0);
+	poses = parsed.data();
+	pool.parallelFor(files.size(), [&](size_t f, int) {
+		valid[f] = readMatrixFile(files[f], &parsed[16 * f]);
+	});
+	return true;
+}
+
+bool PoseSet::loadTrajectory(const std::string& path, size_t numFrames) {
+	if (!mapped.open(path)) {
+		fprintf(stderr, "Unable to read the trajectory %s\n", path.c_str());
+		return false;
+	}
+	const size_t length = path.size();
+	if (length >= 4 && path.compare(length - 4, 4, ".bin") == 0) {
+		if (mapped.size() != numFrames * 16 * sizeof(float)) {
+			fprintf(stderr, "%s has %d poses for %d frames\n", path.c_str(), int(mapped.size() / (16 * sizeof(float))), int(numFrames));
+			return false;
+		}
+		// The mapping is page aligned, the floats are used in place.
+		poses = (const float*)mapped.data();
+		validate(numFrames);
+		return true;
+	}
+
+	parsed.resize(16 * numFrames);
+	const char* p = mapped.data();
+	const char* end = p + mapped.size();
+	for (size_t f = 0; f < numFrames; f++) {
+		int numParsed;
+		p = parseValues(p, end, &parsed[16 * f], 16, numParsed);
+		if (numParsed < 16) {
+			fprintf(stderr, "%s has %d poses for %d frames\n", path.c_str(), int(f), int(numFrames));
+			return false;
+		}
+	}
+	float extra;
+	int numExtra;
+	parseValues(p, end, &extra, 1, numExtra);
+	if (numExtra > 0) {
+		fprintf(stderr, "%s has more poses than the %d frames\n", path.c_str(), int(numFrames));
+		return false;
+	}
+	mapped.close();
+	poses = parsed.data();
+	validate(numFrames);
+	return true;
+}
+
+void PoseSet::validate(size_t numFrames) {
+	valid.resize(numFrames);
+	for (size_t f = 0; f < valid.size(); f++) {
+		valid[f] = isFiniteMatrix(poses + 16 * f);
+	}
+}
+
+size_t PoseSet::getNumInvalid() const {
+	size_t numInvalid = 0;
+	for (size_t f = 0; f < valid.size(); f++) {
+		numInvalid += valid[f] == 0;
+	}
+	return numInvalid;
+}
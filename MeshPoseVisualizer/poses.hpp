@@ -0,0 +1,46 @@
+#ifndef POSES_HPP
+#define POSES_HPP
+
+#include <string>
+#include <vector>
+
+#include "mappedfile.hpp"
+#include "parallel.hpp"
+
+// Reads a 4x4 row-major matrix of 16 whitespace separated numbers, such as
+// camera\intrinsic_color.txt or a .pose.txt file. Returns false if the file can not be read,
+// has fewer than 16 numbers or one of them is not finite.
+bool readMatrixFile(const std::string& path, float matrix[16]);
+
+// Camera to world matrices of all frames of a scene, read before rendering starts so the
+// render loop never waits for small file opens. The poses come either from one .pose.txt per
+// frame, read in parallel, or from a single trajectory file in the order of the sorted frames:
+//   .txt   16 numbers per frame (4x4 row-major), lines starting with # are skipped
+//   .bin   numFrames * 16 little-endian floats, row-major; mapped instead of read
+// Frames whose pose is missing or has values that are not finite numbers are flagged as
+// invalid instead of failing the scene.
+class PoseSet {
+public:
+	PoseSet() : poses(nullptr) {}
+
+	bool loadPoseFiles(const std::vector<std::string>& files, TaskPool& pool);
+	bool loadTrajectory(const std::string& path, size_t numFrames);
+
+	size_t size() const { return valid.size(); }
+	const float* get(size_t frame) const { return poses + 16 * frame; }
+	bool isValid(size_t frame) const { return valid[frame] != 0; }
+	size_t getNumInvalid() const;
+
+private:
+	PoseSet(const PoseSet&);
+	PoseSet& operator=(const PoseSet&);
+
+	void validate(size_t numFrames);
+
+	std::vector<float> parsed;
+	MappedFile mapped;
+	const float* poses; // points into parsed or mapped
+	std::vector<char> valid;
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "pch.h"
+#include <algorithm>
+#include <math.h>
+
+#include "rasterizer.hpp"
+#include "trace.hpp"
+
+// Screen tiles are TILE_SIZE x TILE_SIZE pixels, vertices are snapped to 1/256 pixel.
+static const int TILE_SIZE = 64;
+static const int SUBPIXEL_BITS = 8;
+static const int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+static const int HALF_PIXEL = SUBPIXEL_SCALE / 2;
+// Number of triangles one setup task handles.
+static const size_t CHUNK_TRIANGLES = 4096;
+// Polygons clipped against the 6 frustum planes have at most 3 + 6 vertices.
+static const int MAX_CLIP_VERTICES = 9;
+
+static inline int floorDiv(int a, int b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Signed distance of a clip space vertex to one of the frustum planes, >= 0 is inside.
+static inline float planeDistance(const glm::vec4& v, int plane) {
+	switch (plane) {
+	case 0: return v.w + v.x;
+	case 1: return v.w - v.x;
+	case 2: return v.w + v.y;
+	case 3: return v.w - v.y;
+	case 4: return v.w + v.z;
+	default: return v.w - v.z;
+	}
+}
+
+static inline int outcode(const glm::vec4& v) {
+	int code = 0;
+	for (int plane = 0; plane < 6; plane++) {
+		if (planeDistance(v, plane) < 0.0f) {
+			code |= 1 << plane;
+		}
+	}
+	return code;
+}
+
+// Sutherland-Hodgman clipping of a convex polygon against one plane.
+static int clipPolygon(const glm::vec4* in, int count, glm::vec4* out, int plane) {
+	int outCount = 0;
+	for (int i = 0; i < count; i++) {
+		const glm::vec4& a = in[i];
+		const glm::vec4& b = in[(i + 1) % count];
+		float da = planeDistance(a, plane);
+		float db = planeDistance(b, plane);
+		if (da >= 0.0f) {
+			out[outCount++] = a;
+		}
+		if ((da >= 0.0f) != (db >= 0.0f)) {
+			float t = da / (da - db);
+			out[outCount++] = a + (b - a) * t;
+		}
+	}
+	return outCount;
+}
+
+SoftwareRasterizer::SoftwareRasterizer(int width, int height, int numThreads) : width(width), height(height),
+	tilesX((width + TILE_SIZE - 1) / TILE_SIZE), tilesY((height + TILE_SIZE - 1) / TILE_SIZE), pool(numThreads),
+	depthBuffer(size_t(width) * height) {
+	// A few chunks per thread keep the setup phase balanced without making batches too large.
+	chunks.resize(4 * pool.size());
+	for (size_t i = 0; i < chunks.size(); i++) {
+		chunks[i].bins.resize(tilesX * tilesY);
+		chunks[i].triangles.reserve(CHUNK_TRIANGLES);
+	}
+}
+
+void SoftwareRasterizer::render(const DrawObject& object, const glm::mat4& MVP, unsigned int* faceIds) {
+	render(object.vertices, object.indices, NULL, MVP, faceIds);
+}
+
+void SoftwareRasterizer::render(const std::vector<float>& meshVertices, const std::vector<unsigned int>& meshIndices, const unsigned int* triangleFaceIds,
+	const glm::mat4& MVP, unsigned int* faceIds) {
+	TRACE_SCOPE("rasterize");
+	std::fill(depthBuffer.begin(), depthBuffer.end(), 1.0f);
+	std::fill(faceIds, faceIds + size_t(width) * height, 0u);
+
+	// Shared vertices are transformed once, then the triangles look up their corners by index.
+	const size_t numVertices = meshVertices.size() / 3;
+	const float* vertices = meshVertices.data();
+	clipVertices.resize(numVertices);
+	pool.parallelFor((numVertices + CHUNK_TRIANGLES - 1) / CHUNK_TRIANGLES, [&](size_t block, int) {
+		size_t end = std::min(numVertices, (block + 1) * CHUNK_TRIANGLES);
+		for (size_t i = block * CHUNK_TRIANGLES; i < end; i++) {
+			clipVertices[i] = MVP * glm::vec4(vertices[3 * i + 0], vertices[3 * i + 1], vertices[3 * i + 2], 1.0f);
+		}
+	});
+
+	const size_t numTriangles = meshIndices.size() / 3;
+	const unsigned int* indices = meshIndices.data();
+	const size_t batchTriangles = CHUNK_TRIANGLES * chunks.size();
+
+	for (size_t batchStart = 0; batchStart < numTriangles; batchStart += batchTriangles) {
+		size_t batchEnd = std::min(numTriangles, batchStart + batchTriangles);
+		size_t numChunks = (batchEnd - batchStart + CHUNK_TRIANGLES - 1) / CHUNK_TRIANGLES;
+
+		pool.parallelFor(numChunks, [&](size_t c, int) {
+			size_t first = batchStart + c * CHUNK_TRIANGLES;
+			setupChunk(chunks[c], indices, triangleFaceIds, first, std::min(batchEnd, first + CHUNK_TRIANGLES));
+		});
+		pool.parallelFor(size_t(tilesX) * tilesY, [&](size_t tile, int) {
+			rasterizeTile(int(tile), numChunks, faceIds);
+		});
+	}
+}
+
+void SoftwareRasterizer::setupChunk(Chunk& chunk, const unsigned int* indices, const unsigned int* triangleFaceIds, size_t firstTriangle, size_t endTriangle) {
+	chunk.triangles.clear();
+	for (size_t i = 0; i < chunk.bins.size(); i++) {
+		chunk.bins[i].clear();
+	}
+
+	glm::vec4 polygon[MAX_CLIP_VERTICES];
+	glm::vec4 clipped[MAX_CLIP_VERTICES];
+	for (size_t t = firstTriangle; t < endTriangle; t++) {
+		glm::vec4 c[3];
+		for (int k = 0; k < 3; k++) {
+			c[k] = clipVertices[indices[3 * t + k]];
+		}
+		unsigned int faceId = triangleFaceIds ? triangleFaceIds[t] : (unsigned int)(t + 1);
+
+		int code0 = outcode(c[0]);
+		int code1 = outcode(c[1]);
+		int code2 = outcode(c[2]);
+		if (code0 & code1 & code2) {
+			// All vertices are outside of the same plane.
+			continue;
+		}
+		int crossed = code0 | code1 | code2;
+		if (crossed == 0) {
+			setupTriangle(chunk, c[0], c[1], c[2], faceId);
+			continue;
+		}
+
+		int count = 3;
+		polygon[0] = c[0];
+		polygon[1] = c[1];
+		polygon[2] = c[2];
+		for (int plane = 0; plane < 6 && count >= 3; plane++) {
+			if (crossed & (1 << plane)) {
+				count = clipPolygon(polygon, count, clipped, plane);
+				std::copy(clipped, clipped + count, polygon);
+			}
+		}
+		for (int k = 1; k + 1 < count; k++) {
+			setupTriangle(chunk, polygon[0], polygon[k], polygon[k + 1], faceId);
+		}
+	}
+}
+
+void SoftwareRasterizer::setupTriangle(Chunk& chunk, const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2, unsigned int faceId) {
+	const glm::vec4* c[3] = { &c0, &c1, &c2 };
+	int X[3], Y[3];
+	float z[3];
+	for (int k = 0; k < 3; k++) {
+		float w = c[k]->w;
+		if (!(w > 0.0f)) {
+			return;
+		}
+		// Viewport transform, y points up like in the OpenGL window coordinates.
+		float sx = (c[k]->x / w * 0.5f + 0.5f) * width;
+		float sy = (c[k]->y / w * 0.5f + 0.5f) * height;
+		X[k] = int(floorf(sx * SUBPIXEL_SCALE + 0.5f));
+		Y[k] = int(floorf(sy * SUBPIXEL_SCALE + 0.5f));
+		z[k] = c[k]->z / w * 0.5f + 0.5f;
+	}
+
+	// Twice the signed area, counter-clockwise triangles are front facing.
+	long long area = (long long)(X[1] - X[0]) * (Y[2] - Y[0]) - (long long)(X[2] - X[0]) * (Y[1] - Y[0]);
+	if (area <= 0) {
+		return;
+	}
+
+	Triangle tri;
+	int minX = std::min(X[0], std::min(X[1], X[2]));
+	int maxX = std::max(X[0], std::max(X[1], X[2]));
+	int minY = std::min(Y[0], std::min(Y[1], Y[2]));
+	int maxY = std::max(Y[0], std::max(Y[1], Y[2]));
+	// Pixels whose centers lie inside the bounding box.
+	tri.minX = std::max(0, floorDiv(minX - HALF_PIXEL + SUBPIXEL_SCALE - 1, SUBPIXEL_SCALE));
+	tri.maxX = std::min(width - 1, floorDiv(maxX - HALF_PIXEL, SUBPIXEL_SCALE));
+	tri.minY = std::max(0, floorDiv(minY - HALF_PIXEL + SUBPIXEL_SCALE - 1, SUBPIXEL_SCALE));
+	tri.maxY = std::min(height - 1, floorDiv(maxY - HALF_PIXEL, SUBPIXEL_SCALE));
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY) {
+		return;
+	}
+
+	for (int e = 0; e < 3; e++) {
+		int a = e;
+		int b = (e + 1) % 3;
+		long long A = (long long)Y[a] - Y[b];
+		long long B = (long long)X[b] - X[a];
+		long long C = (long long)X[a] * Y[b] - (long long)X[b] * Y[a];
+		// Top-left fill rule: samples exactly on an edge only belong to left and top edges,
+		// so pixels on shared edges are drawn exactly once.
+		bool topLeft = A > 0 || (A == 0 && B < 0);
+		tri.edgeA[e] = A;
+		tri.edgeB[e] = B;
+		tri.edgeC[e] = topLeft ? C : C - 1;
+	}
+
+	// Depth is linear in screen space, interpolate it as a plane.
+	float x1 = float(X[1] - X[0]) / SUBPIXEL_SCALE, y1 = float(Y[1] - Y[0]) / SUBPIXEL_SCALE;
+	float x2 = float(X[2] - X[0]) / SUBPIXEL_SCALE, y2 = float(Y[2] - Y[0]) / SUBPIXEL_SCALE;
+	float det = x1 * y2 - x2 * y1;
+	tri.dzdx = ((z[1] - z[0]) * y2 - (z[2] - z[0]) * y1) / det;
+	tri.dzdy = ((z[2] - z[0]) * x1 - (z[1] - z[0]) * x2) / det;
+	float px = tri.minX + 0.5f - float(X[0]) / SUBPIXEL_SCALE;
+	float py = tri.minY + 0.5f - float(Y[0]) / SUBPIXEL_SCALE;
+	tri.z = z[0] + tri.dzdx * px + tri.dzdy * py;
+	tri.faceId = faceId;
+
+	unsigned int index = (unsigned int)chunk.triangles.size();
+	chunk.triangles.push_back(tri);
+
+	int tx0 = tri.minX / TILE_SIZE, tx1 = tri.maxX / TILE_SIZE;
+	int ty0 = tri.minY / TILE_SIZE, ty1 = tri.maxY / TILE_SIZE;
+	if (tx0 == tx1 && ty0 == ty1) {
+		chunk.bins[ty0 * tilesX + tx0].push_back(index);
+		return;
+	}
+	for (int ty = ty0; ty <= ty1; ty++) {
+		for (int tx = tx0; tx <= tx1; tx++) {
+			// Skip tiles that the triangle's bounding box overlaps but no edge reaches:
+			// test every edge at the pixel center of the tile corner where it is largest.
+			int x0 = std::max(tri.minX, tx * TILE_SIZE), x1 = std::min(tri.maxX, tx * TILE_SIZE + TILE_SIZE - 1);
+			int y0 = std::max(tri.minY, ty * TILE_SIZE), y1 = std::min(tri.maxY, ty * TILE_SIZE + TILE_SIZE - 1);
+			bool covered = true;
+			for (int e = 0; e < 3 && covered; e++) {
+				long long sx = (long long)(tri.edgeA[e] > 0 ? x1 : x0) * SUBPIXEL_SCALE + HALF_PIXEL;
+				long long sy = (long long)(tri.edgeB[e] > 0 ? y1 : y0) * SUBPIXEL_SCALE + HALF_PIXEL;
+				covered = tri.edgeA[e] * sx + tri.edgeB[e] * sy + tri.edgeC[e] >= 0;
+			}
+			if (covered) {
+				chunk.bins[ty * tilesX + tx].push_back(index);
+			}
+		}
+	}
+}
+
+void SoftwareRasterizer::rasterizeTile(int tile, size_t numChunks, unsigned int* faceIds) {
+	const int tileX0 = (tile % tilesX) * TILE_SIZE;
+	const int tileY0 = (tile / tilesX) * TILE_SIZE;
+	const int tileX1 = std::min(width, tileX0 + TILE_SIZE) - 1;
+	const int tileY1 = std::min(height, tileY0 + TILE_SIZE) - 1;
+
+	for (size_t c = 0; c < numChunks; c++) {
+		const Chunk& chunk = chunks[c];
+		const std::vector<unsigned int>& bin = chunk.bins[tile];
+		for (size_t i = 0; i < bin.size(); i++) {
+			const Triangle& tri = chunk.triangles[bin[i]];
+			const int x0 = std::max(tri.minX, tileX0), x1 = std::min(tri.maxX, tileX1);
+			const int y0 = std::max(tri.minY, tileY0), y1 = std::min(tri.maxY, tileY1);
+			const long long sx0 = (long long)x0 * SUBPIXEL_SCALE + HALF_PIXEL;
+			const long long stepX0 = tri.edgeA[0] * SUBPIXEL_SCALE;
+			const long long stepX1 = tri.edgeA[1] * SUBPIXEL_SCALE;
+			const long long stepX2 = tri.edgeA[2] * SUBPIXEL_SCALE;
+			const unsigned int faceId = tri.faceId;
+
+			for (int y = y0; y <= y1; y++) {
+				const long long sy = (long long)y * SUBPIXEL_SCALE + HALF_PIXEL;
+				const long long e0 = tri.edgeA[0] * sx0 + tri.edgeB[0] * sy + tri.edgeC[0];
+				const long long e1 = tri.edgeA[1] * sx0 + tri.edgeB[1] * sy + tri.edgeC[1];
+				const long long e2 = tri.edgeA[2] * sx0 + tri.edgeB[2] * sy + tri.edgeC[2];
+				const float zRow = tri.z + tri.dzdx * (x0 - tri.minX) + tri.dzdy * (y - tri.minY);
+				float* depthRow = &depthBuffer[size_t(y) * width];
+				// The OpenGL image is read bottom-up and flipped, write the flipped row directly.
+				unsigned int* idRow = faceIds + size_t(height - 1 - y) * width;
+
+				// Branch free inner loop so the compiler can vectorize it.
+				const int n = x1 - x0 + 1;
+				for (int k = 0; k < n; k++) {
+					const long long inside = (e0 + stepX0 * k) | (e1 + stepX1 * k) | (e2 + stepX2 * k);
+					const float z = zRow + tri.dzdx * k;
+					const bool pass = inside >= 0 && z < depthRow[x0 + k];
+					depthRow[x0 + k] = pass ? z : depthRow[x0 + k];
+					idRow[x0 + k] = pass ? faceId : idRow[x0 + k];
+				}
+			}
+		}
+	}
+}
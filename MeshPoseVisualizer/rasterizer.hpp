@@ -0,0 +1,65 @@
+#ifndef RASTERIZER_HPP
+#define RASTERIZER_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "parallel.hpp"
+
+// Tile based software rasterizer for the face map pass, used on nodes without a GPU.
+// It follows the OpenGL path of main(): clipping against the view frustum, culling of
+// triangles that are not counter-clockwise on screen and a GL_LESS depth test.
+// Triangles are processed in batches: chunks of a batch are set up and binned into
+// screen tiles in parallel, then the tiles are rasterized in parallel. Bins are walked
+// in submission order so depth ties resolve like on the GPU.
+class SoftwareRasterizer {
+public:
+	// numThreads <= 0 uses all hardware threads.
+	SoftwareRasterizer(int width, int height, int numThreads);
+
+	// Renders the triangles of object and writes the 1-based index of the visible face for
+	// every pixel into faceIds, 0 where no face was hit. faceIds holds width * height values,
+	// rows are written top to bottom like in the face map images.
+	void render(const DrawObject& object, const glm::mat4& MVP, unsigned int* faceIds);
+
+	// Renders the triangles of indices in their order, triangle t has the face id
+	// triangleFaceIds[t]. Used for the reordered triangles of meshorder.hpp.
+	void render(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, const unsigned int* triangleFaceIds,
+		const glm::mat4& MVP, unsigned int* faceIds);
+
+private:
+	struct Triangle {
+		long long edgeA[3];
+		long long edgeB[3];
+		long long edgeC[3];
+		// Depth at the center of pixel (minX, minY) and its screen space gradients.
+		float z;
+		float dzdx;
+		float dzdy;
+		int minX, minY, maxX, maxY;
+		unsigned int faceId;
+	};
+
+	struct Chunk {
+		std::vector<Triangle> triangles;
+		std::vector<std::vector<unsigned int> > bins;
+	};
+
+	void setupChunk(Chunk& chunk, const unsigned int* indices, const unsigned int* triangleFaceIds, size_t firstTriangle, size_t endTriangle);
+	void setupTriangle(Chunk& chunk, const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2, unsigned int faceId);
+	void rasterizeTile(int tile, size_t numChunks, unsigned int* faceIds);
+
+	int width;
+	int height;
+	int tilesX;
+	int tilesY;
+	TaskPool pool;
+	std::vector<float> depthBuffer;
+	// Clip space positions of the vertices of the object being rendered.
+	std::vector<glm::vec4> clipVertices;
+	std::vector<Chunk> chunks;
+};
+
+#endif
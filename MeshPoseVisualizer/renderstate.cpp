@@ -0,0 +1,312 @@
+#include "pch.h"
+#include <algorithm>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <system_error>
+
+#include "facemap.hpp"
+#include "renderstate.hpp"
+#include "trace.hpp"
+
+static const int RENDER_STATE_VERSION = 1;
+
+// Size and modification time, as text. Empty if the file does not exist.
+static std::string getFileStamp(const std::string& path) {
+	namespace fs = std::experimental::filesystem;
+	std::error_code ec;
+	uintmax_t fileSize = fs::file_size(path, ec);
+	if (ec) {
+		return "";
+	}
+	fs::file_time_type writeTime = fs::last_write_time(path, ec);
+	if (ec) {
+		return "";
+	}
+	return std::to_string((unsigned long long)fileSize) + " " + std::to_string((long long)writeTime.time_since_epoch().count());
+}
+
+// FNV-1a of a block of bytes, as hex text.
+static std::string hashBytes(const void* data, size_t size) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned long long hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	char text[17];
+	snprintf(text, sizeof(text), "%016llx", hash);
+	return text;
+}
+
+// Hash of the contents of a small file. Empty if the file can not be read.
+static std::string hashFile(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return "";
+	}
+	std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	return hashBytes(contents.data(), contents.size());
+}
+
+SceneRenderState::SceneRenderState()
+	: numFaces(0), faceAttributesOutdated(true), visibilityCurrent(false), journal(NULL) {
+}
+
+SceneRenderState::~SceneRenderState() {
+	if (journal) {
+		fclose(journal);
+	}
+}
+
+void SceneRenderState::plan(const ScenePaths& scene, const PoseSet& poses, const RunOptions& options) {
+	TRACE_SCOPE("plan frames");
+	namespace fs = std::experimental::filesystem;
+	stateFile = scene.renderStateFile;
+	visibilityFile = scene.visibilityFile;
+	const std::string& idFormat = options.idFormat;
+	settings = options.backend + " " + idFormat;
+	// Only added when enabled, so states written without these maps stay valid.
+	if (options.depthFormat != "none") {
+		settings += " depth " + options.depthFormat;
+	}
+	if (options.normalFormat != "none") {
+		settings += " normals " + options.normalFormat;
+	}
+	if (options.barycentricFormat != "none") {
+		settings += " barycentrics " + options.barycentricFormat;
+	}
+	meshStamp = getFileStamp(scene.meshFile) + " " + scene.meshFile;
+	intrinsicsHash = hashFile(scene.camIntrinsicsFile);
+	frameNames = scene.frameNames;
+	poseHashes.resize(frameNames.size());
+	// The parsed values are hashed, so it does not matter whether they came from a trajectory.
+	for (size_t f = 0; f < frameNames.size(); f++) {
+		poseHashes[f] = poses.isValid(f) ? hashBytes(poses.get(f), 16 * sizeof(float)) : "";
+	}
+	faceAttributesOutdated = true;
+	renderAllFrames();
+	// Fusing colors needs every frame, and archives are written as a whole.
+	if (!options.incremental || options.fuseColors || options.archive) {
+		return;
+	}
+
+	// Read the previous state, later frame lines replace earlier ones.
+	std::ifstream stateStream(stateFile);
+	std::string line;
+	if (!std::getline(stateStream, line) || line != "MPVSTATE " + std::to_string(RENDER_STATE_VERSION)) {
+		return;
+	}
+	std::string oldSettings, oldMesh, oldIntrinsics, oldVisibility;
+	size_t oldFaces = 0;
+	size_t oldRows = 0;
+	std::map<std::string, std::pair<std::string, long long> > oldFrames;
+	while (std::getline(stateStream, line)) {
+		std::istringstream fields(line);
+		std::string key;
+		fields >> key;
+		if (key == "frame") {
+			std::string name, hash;
+			long long row = -1;
+			if (fields >> name >> hash >> row) {
+				oldFrames[name] = std::make_pair(hash, row);
+			}
+		}
+		else if (key == "visibility") {
+			std::string size, time;
+			fields >> size >> time >> oldRows;
+			oldVisibility = size + " " + time;
+		}
+		else if (key == "faces") {
+			fields >> oldFaces;
+		}
+		else {
+			std::string value;
+			std::getline(fields >> std::ws, value);
+			if (key == "settings") {
+				oldSettings = value;
+			}
+			else if (key == "mesh") {
+				oldMesh = value;
+			}
+			else if (key == "intrinsics") {
+				oldIntrinsics = value;
+			}
+		}
+	}
+	if (oldMesh != meshStamp || oldFaces == 0 || meshStamp[0] == ' ') {
+		printf("%s has changed, rendering all frames of %s\n", scene.meshFile.c_str(), scene.rootDir.c_str());
+		return;
+	}
+	faceAttributesOutdated = (options.faceAttributes != "binary" && !fs::exists(scene.faceAreasFile)) ||
+		(options.faceAttributes != "text" && !fs::exists(scene.faceAttributesFile)) || !fs::exists(scene.shapesFile);
+	if (oldSettings != settings || oldIntrinsics != intrinsicsHash || intrinsicsHash.empty()) {
+		printf("Settings or intrinsics have changed, rendering all frames of %s\n", scene.rootDir.c_str());
+		return;
+	}
+
+	// A frame is up to date if its pose is unchanged and all of its face maps and the other maps
+	// it was asked for exist. Rows of visibility.bin are only used if the file is the one written
+	// with the state.
+	const bool rowsValid = !oldVisibility.empty() && oldVisibility == getFileStamp(visibilityFile);
+	std::vector<std::pair<const std::vector<std::string>*, std::string> > outputs;
+	const char* idFormats[3] = { "raw", "rle", "png" };
+	const char* idExtensions[3] = { ".bin", ".rle", ".png" };
+	for (int i = 0; i < 3; i++) {
+		if (hasIdFormat(idFormat, idFormats[i])) {
+			outputs.push_back(std::make_pair(&scene.faceMapFiles, std::string(idExtensions[i])));
+		}
+	}
+	const std::pair<const std::vector<std::string>*, std::string> maps[3] = {
+		std::make_pair(&scene.depthMapFiles, options.depthFormat),
+		std::make_pair(&scene.normalMapFiles, options.normalFormat),
+		std::make_pair(&scene.barycentricMapFiles, options.barycentricFormat) };
+	for (int m = 0; m < 3; m++) {
+		if (maps[m].second != "none") {
+			outputs.push_back(std::make_pair(maps[m].first, std::string(maps[m].second == "raw" ? ".bin" : ".png")));
+		}
+	}
+	numFaces = oldFaces;
+	visibility.reset(new VisibilityCollector(frameNames.size(), numFaces));
+	std::vector<size_t> rows, rowFrames, readbackFrames;
+	visibilityCurrent = rowsValid && oldRows == frameNames.size();
+	for (size_t f = 0; f < frameNames.size(); f++) {
+		std::map<std::string, std::pair<std::string, long long> >::const_iterator old = oldFrames.find(frameNames[f]);
+		bool upToDate = old != oldFrames.end() && !poseHashes[f].empty() && old->second.first == poseHashes[f];
+		for (size_t o = 0; o < outputs.size() && upToDate; o++) {
+			upToDate = fs::exists((*outputs[o].first)[f] + outputs[o].second);
+		}
+		if (!upToDate) {
+			visibilityCurrent = false;
+		}
+		else if (rowsValid && old->second.second >= 0) {
+			rows.push_back(size_t(old->second.second));
+			rowFrames.push_back(f);
+			visibilityCurrent = visibilityCurrent && old->second.second == (long long)f;
+		}
+		else {
+			readbackFrames.push_back(f);
+			visibilityCurrent = false;
+		}
+	}
+	if (visibility->restoreFrames(visibilityFile, rows, rowFrames)) {
+		for (size_t k = 0; k < rowFrames.size(); k++) {
+			frameValid[rowFrames[k]] = 1;
+		}
+	}
+	else {
+		readbackFrames.insert(readbackFrames.end(), rowFrames.begin(), rowFrames.end());
+		visibilityCurrent = false;
+	}
+
+	// Frames finished by an interrupted run are not in visibility.bin, their face maps are
+	// counted again, which is still much cheaper than rendering them.
+	std::vector<unsigned int> faceIds;
+	for (size_t k = 0; k < readbackFrames.size(); k++) {
+		const size_t f = readbackFrames[k];
+		int width, height;
+		// The face map that is fastest to read, outputs starts with it.
+		const std::string& extension = outputs[0].second;
+		bool ok = extension == ".bin" ? readFaceMapRaw(scene.faceMapFiles[f] + extension, faceIds, width, height) :
+			extension == ".rle" ? readFaceMapRLE(scene.faceMapFiles[f] + extension, faceIds, width, height) :
+			readFaceMapPNG(scene.faceMapFiles[f] + extension, faceIds, width, height);
+		if (ok) {
+			visibility->addFrame(f, faceIds.data(), faceIds.size());
+			frameValid[f] = 1;
+		}
+	}
+
+	renderFrames.clear();
+	for (size_t f = 0; f < frameNames.size(); f++) {
+		if (!frameValid[f] && !poseHashes[f].empty()) {
+			renderFrames.push_back(f);
+		}
+	}
+	const size_t numUpToDate = std::count(frameValid.begin(), frameValid.end(), 1);
+	if (numUpToDate > 0) {
+		printf("Skipping %d of %d frames of %s, their face maps are up to date\n", int(numUpToDate), int(frameNames.size()), scene.rootDir.c_str());
+	}
+}
+
+void SceneRenderState::renderAllFrames() {
+	visibility.reset();
+	visibilityCurrent = false;
+	frameValid.assign(frameNames.size(), 0);
+	renderFrames.clear();
+	for (size_t f = 0; f < frameNames.size(); f++) {
+		if (!poseHashes[f].empty()) {
+			renderFrames.push_back(f);
+		}
+	}
+}
+
+VisibilityCollector& SceneRenderState::prepareVisibility(size_t meshFaces) {
+	if (visibility && visibility->getNumFaces() != meshFaces) {
+		printf("The mesh has %d faces instead of %d, rendering all frames\n", int(meshFaces), int(visibility->getNumFaces()));
+		renderAllFrames();
+	}
+	if (!visibility) {
+		visibility.reset(new VisibilityCollector(frameNames.size(), meshFaces));
+	}
+	numFaces = meshFaces;
+	return *visibility;
+}
+
+bool SceneRenderState::begin() {
+	if (!writeState(false)) {
+		return false;
+	}
+	journal = fopen(stateFile.c_str(), "a");
+	return journal != NULL;
+}
+
+void SceneRenderState::frameDone(size_t frame) {
+	std::lock_guard<std::mutex> lock(mutex);
+	frameValid[frame] = 1;
+	if (journal) {
+		fprintf(journal, "frame %s %s -1\n", frameNames[frame].c_str(), poseHashes[frame].c_str());
+		fflush(journal);
+	}
+}
+
+bool SceneRenderState::finish() {
+	if (journal) {
+		fclose(journal);
+		journal = NULL;
+	}
+	return writeState(true);
+}
+
+bool SceneRenderState::writeState(bool withVisibility) {
+	std::string tempFile = stateFile + ".tmp";
+	FILE* fp = fopen(tempFile.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", tempFile.c_str());
+		return false;
+	}
+	fprintf(fp, "MPVSTATE %d\n", RENDER_STATE_VERSION);
+	fprintf(fp, "settings %s\n", settings.c_str());
+	fprintf(fp, "mesh %s\n", meshStamp.c_str());
+	fprintf(fp, "faces %llu\n", (unsigned long long)numFaces);
+	fprintf(fp, "intrinsics %s\n", intrinsicsHash.c_str());
+	if (withVisibility) {
+		fprintf(fp, "visibility %s %llu\n", getFileStamp(visibilityFile).c_str(), (unsigned long long)frameNames.size());
+	}
+	for (size_t f = 0; f < frameNames.size(); f++) {
+		if (frameValid[f]) {
+			fprintf(fp, "frame %s %s %lld\n", frameNames[f].c_str(), poseHashes[f].c_str(), withVisibility ? (long long)f : -1ll);
+		}
+	}
+	bool ok = fclose(fp) == 0;
+	if (ok) {
+		// rename does not replace existing files on Windows.
+		remove(stateFile.c_str());
+		ok = rename(tempFile.c_str(), stateFile.c_str()) == 0;
+	}
+	if (!ok) {
+		remove(tempFile.c_str());
+		fprintf(stderr, "Unable to write %s\n", stateFile.c_str());
+	}
+	return ok;
+}
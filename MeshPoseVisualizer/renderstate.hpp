@@ -0,0 +1,85 @@
+#ifndef RENDERSTATE_HPP
+#define RENDERSTATE_HPP
+
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "poses.hpp"
+#include "scene.hpp"
+#include "visibility.hpp"
+
+// Inputs of the last run of a scene (face_maps\render_state.txt), so a re-run only renders
+// the frames whose outputs are out of date. Text file, one record per line:
+//   MPVSTATE 1
+//   settings <backend> <id format> [depth <format>] [normals <format>] [barycentrics <format>]
+//   mesh <size> <modification time> <path>
+//   faces <number of faces>
+//   intrinsics <hash>
+//   visibility <size> <modification time>   of visibility.bin, written after it
+//   frame <name> <pose hash> <row>           row of the frame in visibility.bin, -1 if it is not in it
+// Poses and intrinsics are small and hashed, the mesh is identified by size and modification
+// time like the mesh cache. A frame line is appended as soon as the face maps of the frame are
+// written, so a run that dies halfway through a scene keeps the frames it finished. Frames
+// with invalid poses are neither rendered nor recorded.
+class SceneRenderState {
+public:
+	SceneRenderState();
+	~SceneRenderState();
+
+	// Compares the inputs of scene with its state file. Without --incremental, with --fuse-colors,
+	// or when the mesh, the intrinsics or the settings changed, every frame is rendered. Otherwise frames are
+	// skipped if their pose is unchanged and their face maps exist; their visibility rows are
+	// taken from visibility.bin, or from the face maps for frames of an interrupted run.
+	void plan(const ScenePaths& scene, const PoseSet& poses, const RunOptions& options);
+
+	// Frames to render, ascending.
+	const std::vector<size_t>& getRenderFrames() const { return renderFrames; }
+	// areas.txt, face_attributes.bin and shapes.txt are only written again when the mesh changed.
+	bool needsFaceAttributes() const { return faceAttributesOutdated; }
+	// The mesh is only loaded when there is something to render.
+	bool needsMesh() const { return faceAttributesOutdated || !renderFrames.empty(); }
+	// Nothing to render and visibility.bin already has exactly the frames of the scene.
+	bool isUpToDate() const { return !needsMesh() && visibilityCurrent; }
+	// Number of faces recorded for the unchanged mesh, 0 if it is not known.
+	size_t getNumFaces() const { return numFaces; }
+
+	// Returns the visibility matrix with the rows of the skipped frames filled in. If the mesh
+	// turns out to have another number of faces than recorded, every frame is rendered again.
+	VisibilityCollector& prepareVisibility(size_t meshFaces);
+
+	// Rewrites the state file with the skipped frames before rendering starts.
+	bool begin();
+	// Records that the face maps of frame were written. Called on the encoder threads.
+	void frameDone(size_t frame);
+	// Rewrites the state file after visibility.bin was written, the frames become its rows.
+	bool finish();
+
+private:
+	SceneRenderState(const SceneRenderState&);
+	SceneRenderState& operator=(const SceneRenderState&);
+
+	bool writeState(bool withVisibility);
+	void renderAllFrames();
+
+	std::string stateFile;
+	std::string visibilityFile;
+	std::string settings;
+	std::string meshStamp;
+	std::string intrinsicsHash;
+	size_t numFaces;
+	std::vector<std::string> frameNames;
+	std::vector<std::string> poseHashes;
+	std::vector<char> frameValid; // face maps and visibility row are up to date
+	std::vector<size_t> renderFrames;
+	bool faceAttributesOutdated;
+	bool visibilityCurrent;
+	std::unique_ptr<VisibilityCollector> visibility;
+
+	std::mutex mutex;
+	FILE* journal;
+};
+
+#endif
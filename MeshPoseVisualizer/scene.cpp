@@ -0,0 +1,222 @@
+#include "pch.h"
+#include <algorithm>
+#include <chrono>
+#include <experimental/filesystem>
+#include <fstream>
+#include <stdio.h>
+#include <system_error>
+
+#include "meshorder.hpp"
+#include "scene.hpp"
+#include "trace.hpp"
+
+std::string getBasename(std::string filename) {
+	const size_t last_slash_idx = filename.find_last_of("\\/");
+	if (std::string::npos != last_slash_idx)
+	{
+		filename.erase(0, last_slash_idx + 1);
+	}
+	const size_t period_idx = filename.find('.');
+	if (std::string::npos != period_idx)
+	{
+		filename.erase(period_idx);
+	}
+	return filename;
+}
+
+bool hasIdFormat(const std::string& idFormat, const std::string& format) {
+	size_t start = 0;
+	for (;;) {
+		const size_t end = std::min(idFormat.find(',', start), idFormat.size());
+		const std::string item = idFormat.substr(start, end - start);
+		if (item == format || (item == "both" && (format == "raw" || format == "png"))) {
+			return true;
+		}
+		if (end == idFormat.size()) {
+			return false;
+		}
+		start = end + 1;
+	}
+}
+
+bool isValidIdFormat(const std::string& idFormat) {
+	size_t start = 0;
+	for (;;) {
+		const size_t end = std::min(idFormat.find(',', start), idFormat.size());
+		const std::string item = idFormat.substr(start, end - start);
+		if (item != "raw" && item != "png" && item != "rle" && item != "both") {
+			return false;
+		}
+		if (end == idFormat.size()) {
+			return true;
+		}
+		start = end + 1;
+	}
+}
+
+bool collectScenePaths(const std::string& rootDir, const std::string& meshFile, ScenePaths& paths) {
+	namespace fs = std::experimental::filesystem;
+	paths.rootDir = rootDir;
+	paths.meshFile = meshFile;
+	if (paths.meshFile.empty()) {
+		paths.meshFile = rootDir + PATH_SEPARATOR "mesh" PATH_SEPARATOR "mesh.refined.obj";
+		std::string plyFile = rootDir + PATH_SEPARATOR "mesh" PATH_SEPARATOR "mesh.refined.ply";
+		if (!fs::exists(paths.meshFile) && fs::exists(plyFile)) {
+			paths.meshFile = plyFile;
+		}
+	}
+	paths.camIntrinsicsFile = rootDir + PATH_SEPARATOR "camera" PATH_SEPARATOR "intrinsic_color.txt";
+	paths.faceAreasFile = rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR "areas.txt";
+	paths.faceAttributesFile = rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR "face_attributes.bin";
+	paths.shapesFile = rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR "shapes.txt";
+	paths.visibilityFile = rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR "visibility.bin";
+	paths.renderStateFile = rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR "render_state.txt";
+	paths.coloredMeshFile = rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR "mesh.colored.ply";
+	paths.faceMapArchiveFile = rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR "facemaps.fmar";
+	paths.trajectoryFile.clear();
+	const char* trajectoryFiles[] = { PATH_SEPARATOR "pose" PATH_SEPARATOR "trajectory.bin", PATH_SEPARATOR "pose" PATH_SEPARATOR "trajectory.txt" };
+	for (int t = 0; t < 2 && paths.trajectoryFile.empty(); t++) {
+		if (fs::exists(rootDir + trajectoryFiles[t])) {
+			paths.trajectoryFile = rootDir + trajectoryFiles[t];
+		}
+	}
+
+	// Frames are sorted by name, their index is the row of the visibility matrix.
+	std::error_code ec;
+	std::vector<std::pair<std::string, std::string> > colorFiles;
+	for (fs::directory_iterator it(rootDir + PATH_SEPARATOR "color" PATH_SEPARATOR, ec), end; !ec && it != end; it.increment(ec)) {
+		colorFiles.push_back(std::make_pair(getBasename(it->path().string()), it->path().string()));
+	}
+	if (ec) {
+		fprintf(stderr, "Unable to list the frames of %s: %s\n", rootDir.c_str(), ec.message().c_str());
+		return false;
+	}
+	std::sort(colorFiles.begin(), colorFiles.end());
+	paths.frameNames.clear();
+	paths.colorFiles.clear();
+	for (size_t f = 0; f < colorFiles.size(); f++) {
+		paths.frameNames.push_back(colorFiles[f].first);
+		paths.colorFiles.push_back(colorFiles[f].second);
+	}
+	paths.cam2WorldMatrixFiles.clear();
+	paths.faceMapFiles.clear();
+	paths.depthMapFiles.clear();
+	paths.normalMapFiles.clear();
+	paths.barycentricMapFiles.clear();
+	for (const std::string& basename : paths.frameNames) {
+		paths.cam2WorldMatrixFiles.push_back(rootDir + PATH_SEPARATOR "pose" PATH_SEPARATOR + basename + ".pose.txt");
+		paths.faceMapFiles.push_back(rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR + basename + ".facemap");
+		paths.depthMapFiles.push_back(rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR + basename + ".depth");
+		paths.normalMapFiles.push_back(rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR + basename + ".normals");
+		paths.barycentricMapFiles.push_back(rootDir + PATH_SEPARATOR "face_maps" PATH_SEPARATOR + basename + ".barycentrics");
+	}
+	return true;
+}
+
+bool loadScenePoses(const ScenePaths& paths, PoseSet& poses) {
+	TRACE_SCOPE("load poses");
+	if (!paths.trajectoryFile.empty()) {
+		if (!poses.loadTrajectory(paths.trajectoryFile, paths.frameNames.size())) {
+			return false;
+		}
+	}
+	else {
+		TaskPool pool(0);
+		poses.loadPoseFiles(paths.cam2WorldMatrixFiles, pool);
+	}
+	const size_t numInvalid = poses.getNumInvalid();
+	if (numInvalid > 0) {
+		// Only the first few are listed, a broken trajectory can have thousands.
+		std::string names;
+		int listed = 0;
+		for (size_t f = 0; f < poses.size() && listed < 5; f++) {
+			if (!poses.isValid(f)) {
+				names += (listed++ > 0 ? ", " : "") + paths.frameNames[f];
+			}
+		}
+		fprintf(stderr, "Skipping %d frames of %s with missing or invalid poses: %s%s\n", int(numInvalid), paths.rootDir.c_str(),
+			names.c_str(), numInvalid > size_t(listed) ? ", ..." : "");
+	}
+	return true;
+}
+
+bool readSceneManifest(const std::string& manifestFile, std::vector<std::string>& rootDirs) {
+	std::ifstream manifest(manifestFile);
+	if (!manifest) {
+		fprintf(stderr, "Unable to open the manifest %s\n", manifestFile.c_str());
+		return false;
+	}
+	std::string line;
+	while (std::getline(manifest, line)) {
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#') {
+			continue;
+		}
+		size_t last = line.find_last_not_of(" \t\r");
+		rootDirs.push_back(line.substr(first, last - first + 1));
+	}
+	return true;
+}
+
+bool loadSceneMesh(const std::string& meshFile, bool buildClusters, bool reorderTriangles, SceneMesh& mesh) {
+	TRACE_SCOPE("load mesh");
+	auto startTime = std::chrono::steady_clock::now();
+	// The face maps do not need textures or per corner attributes, which lets the mesh come from the cache.
+	std::map<std::string, GLuint> textures;
+	if (!LoadObjAndConvert(mesh.bmin, mesh.bmax, &mesh.drawObjects, mesh.shapes, mesh.materials, textures, meshFile.c_str(), false, false) ||
+		mesh.drawObjects.empty()) {
+		return false;
+	}
+	auto loadedTime = std::chrono::steady_clock::now();
+	mesh.loadSeconds = std::chrono::duration<double>(loadedTime - startTime).count();
+
+	// Sort the triangles into clusters, so every frame only draws the clusters in its view.
+	mesh.clusterSeconds = 0.0;
+	if (buildClusters || reorderTriangles) {
+		TRACE_SCOPE("build clusters");
+		mesh.bvh.build(mesh.drawObjects[0].vertices, mesh.drawObjects[0].indices, mesh.sortedIndices, mesh.clusterFaceIds);
+		mesh.clusterSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadedTime).count();
+	}
+
+	mesh.reordered = false;
+	mesh.reorderSeconds = 0.0;
+	if (reorderTriangles) {
+		TRACE_SCOPE("reorder triangles");
+		auto reorderTime = std::chrono::steady_clock::now();
+		const DrawObject& object = mesh.drawObjects[0];
+		const size_t numFaces = object.indices.size() / 3;
+		const size_t numVertices = object.vertices.size() / 3;
+		mesh.acmrFileOrder = computeACMR(object.indices.data(), numFaces, numVertices);
+		mesh.acmrClusterOrder = computeACMR(mesh.sortedIndices.data(), numFaces, numVertices);
+		optimizeClusterOrder(object.vertices, mesh.bvh, mesh.sortedIndices, mesh.clusterFaceIds);
+		reorderVertices(object.vertices, mesh.sortedIndices, mesh.orderedVertices);
+		mesh.acmrReordered = computeACMR(mesh.sortedIndices.data(), numFaces, mesh.orderedVertices.size() / 3);
+		mesh.reordered = true;
+		mesh.reorderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - reorderTime).count();
+	}
+	return true;
+}
+
+bool writeShapesText(const std::string& path, const std::vector<ShapeRange>& shapes) {
+	FILE* fp = fopen(path.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	bool ok = true;
+	for (size_t s = 0; s < shapes.size() && ok; s++) {
+		ok = fprintf(fp, "%u %u %d\n", shapes[s].firstFace + 1, shapes[s].numFaces, shapes[s].material_id) > 0;
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+	}
+	return ok;
+}
+
+void printMeshOrder(const SceneMesh& mesh) {
+	if (mesh.reordered) {
+		printf("Reordered the triangles in %.1f ms, ACMR %.3f in file order, %.3f in cluster order, %.3f reordered\n",
+			1000.0 * mesh.reorderSeconds, mesh.acmrFileOrder, mesh.acmrClusterOrder, mesh.acmrReordered);
+	}
+}
@@ -0,0 +1,120 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <string>
+#include <vector>
+
+#include "mesh.hpp"
+#include "bvh.hpp"
+#include "poses.hpp"
+
+// Separator of the paths inside a scene directory. The Windows build keeps its backslashes.
+#ifdef _WIN32
+#define PATH_SEPARATOR "\\"
+#else
+#define PATH_SEPARATOR "/"
+#endif
+
+std::string getBasename(std::string filename);
+
+// Settings from the command line that are shared by both backends.
+struct RunOptions {
+	std::string backend;
+	int numThreads;
+	int renderThreads;
+	int encodeThreads;
+	std::string idFormat; // raw, png, rle or both, or a list like png,rle
+	bool incremental;
+	std::string faceAttributes; // text, binary or both
+	std::string depthFormat;    // none or raw
+	std::string normalFormat;   // none, png or raw
+	std::string barycentricFormat; // none or raw
+	bool fuseColors;            // fuse the color frames into mesh.colored.ply instead of writing maps
+	bool archive;               // append the face maps to facemaps.fmar instead of one file per frame
+	bool reorderTriangles;      // draw the triangles in cache friendly order, see meshorder.hpp
+};
+
+// Whether idFormat asks for face maps in format (raw, png or rle); both stands for raw,png.
+bool hasIdFormat(const std::string& idFormat, const std::string& format);
+
+// Checks that idFormat is a comma-separated list of raw, png, rle and both.
+bool isValidIdFormat(const std::string& idFormat);
+
+// Input and output files of one scene directory.
+struct ScenePaths {
+	std::string rootDir;
+	std::string meshFile;
+	std::string camIntrinsicsFile;
+	std::string faceAreasFile;
+	std::string faceAttributesFile;
+	std::string shapesFile;
+	std::string visibilityFile;
+	std::string renderStateFile;
+	std::string coloredMeshFile;
+	std::string faceMapArchiveFile;
+	// rootDir\pose\trajectory.bin or .txt with the poses of all frames, empty if every frame
+	// has its own .pose.txt file.
+	std::string trajectoryFile;
+	// One entry per frame, sorted by name; the index is the row of the visibility matrix.
+	std::vector<std::string> frameNames;
+	std::vector<std::string> colorFiles;
+	std::vector<std::string> cam2WorldMatrixFiles;
+	std::vector<std::string> faceMapFiles; // base paths, the id format adds the extension
+	std::vector<std::string> depthMapFiles; // base paths like faceMapFiles
+	std::vector<std::string> normalMapFiles;
+	std::vector<std::string> barycentricMapFiles;
+};
+
+// Lists the frames of rootDir. The mesh is rootDir\mesh\mesh.refined.obj, or mesh.refined.ply
+// if there is no OBJ file, unless meshFile is given. Returns false if there is no color folder.
+bool collectScenePaths(const std::string& rootDir, const std::string& meshFile, ScenePaths& paths);
+
+// Reads the poses of all frames from the trajectory file or the .pose.txt files and reports
+// the frames whose pose is invalid. Returns false if the trajectory does not match the frames.
+bool loadScenePoses(const ScenePaths& paths, PoseSet& poses);
+
+// Reads a batch manifest: one scene directory per line, empty lines and lines starting with
+// # are skipped.
+bool readSceneManifest(const std::string& manifestFile, std::vector<std::string>& rootDirs);
+
+// Mesh of a scene, prepared without an OpenGL context so the next scene of a batch can be
+// loaded on a background thread while the current one renders.
+struct SceneMesh {
+	// All shapes merged into drawObjects[0], shapes has their face and vertex ranges.
+	std::vector<DrawObject> drawObjects;
+	std::vector<ShapeRange> shapes;
+	std::vector<tinyobj::material_t> materials;
+	float bmin[3];
+	float bmax[3];
+	// Triangles sorted into the clusters of bvh, only built for the OpenGL backend.
+	ClusterBVH bvh;
+	std::vector<unsigned int> sortedIndices;
+	std::vector<unsigned int> clusterFaceIds;
+	// Only with reordered triangles: the vertices in the order sortedIndices first uses them,
+	// sortedIndices refers to these then. The ACMR of the file order, the cluster order and
+	// the reordered triangles, see meshorder.hpp.
+	std::vector<float> orderedVertices;
+	bool reordered;
+	double acmrFileOrder;
+	double acmrClusterOrder;
+	double acmrReordered;
+	double loadSeconds;
+	double clusterSeconds;
+	double reorderSeconds;
+};
+
+// Loads the mesh, merges its shapes into one DrawObject with global face ids and sorts its
+// triangles into clusters if buildClusters is set. With reorderTriangles the clusters are
+// always built and their triangles reordered for cache locality.
+bool loadSceneMesh(const std::string& meshFile, bool buildClusters, bool reorderTriangles, SceneMesh& mesh);
+
+// Writes the shapes of a merged mesh, one line per shape: the 1-based id of its first face, its
+// number of faces and its material id: the index of the material of its first face in the MTL
+// files of the mesh, -1 if the face has none.
+// A face id belongs to the last shape whose first face id is not larger.
+bool writeShapesText(const std::string& path, const std::vector<ShapeRange>& shapes);
+
+// Prints the cache miss ratios of a reordered mesh.
+void printMeshOrder(const SceneMesh& mesh);
+
+#endif
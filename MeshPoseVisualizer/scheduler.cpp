@@ -0,0 +1,88 @@
+#include "pch.h"
+#include <thread>
+
+#include "scheduler.hpp"
+
+FrameScheduler::FrameScheduler(int numWorkers) : stealCount(0) {
+	for (int i = 0; i < (numWorkers > 0 ? numWorkers : 1); i++) {
+		queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+}
+
+void FrameScheduler::run(size_t numFrames, const std::function<void(int)>& workerStart,
+	const std::function<void(size_t, int)>& renderFrame, const std::function<void(int)>& workerStop) {
+	const size_t numWorkers = queues.size();
+	stealCount = 0;
+
+	// Contiguous blocks keep neighbouring poses, which usually see the same geometry, on one worker.
+	for (size_t w = 0; w < numWorkers; w++) {
+		size_t begin = numFrames * w / numWorkers;
+		size_t end = numFrames * (w + 1) / numWorkers;
+		queues[w]->frames.clear();
+		for (size_t f = begin; f < end; f++) {
+			queues[w]->frames.push_back(f);
+		}
+	}
+
+	std::vector<std::thread> threads;
+	for (size_t w = 0; w < numWorkers; w++) {
+		threads.push_back(std::thread([&, w]() {
+			int worker = int(w);
+			workerStart(worker);
+			size_t frame;
+			for (;;) {
+				if (!popFrame(worker, frame) && !(stealFrames(worker) && popFrame(worker, frame))) {
+					// Frames are never added during a run, so nothing left to steal means we are done.
+					break;
+				}
+				renderFrame(frame, worker);
+			}
+			workerStop(worker);
+		}));
+	}
+	for (size_t w = 0; w < threads.size(); w++) {
+		threads[w].join();
+	}
+}
+
+bool FrameScheduler::popFrame(int worker, size_t& frame) {
+	WorkQueue& queue = *queues[worker];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.frames.empty()) {
+		return false;
+	}
+	frame = queue.frames.front();
+	queue.frames.pop_front();
+	return true;
+}
+
+bool FrameScheduler::stealFrames(int worker) {
+	const int numWorkers = int(queues.size());
+	for (int i = 1; i < numWorkers; i++) {
+		WorkQueue& victim = *queues[(worker + i) % numWorkers];
+		std::vector<size_t> stolen;
+		{
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			size_t count = (victim.frames.size() + 1) / 2;
+			for (size_t k = 0; k < count; k++) {
+				stolen.push_back(victim.frames.back());
+				victim.frames.pop_back();
+			}
+		}
+		if (stolen.empty()) {
+			continue;
+		}
+		{
+			WorkQueue& own = *queues[worker];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			// Stolen frames were taken from the back, restore their order.
+			for (size_t k = stolen.size(); k > 0; k--) {
+				own.frames.push_back(stolen[k - 1]);
+			}
+		}
+		std::lock_guard<std::mutex> lock(statsMutex);
+		stealCount++;
+		return true;
+	}
+	return false;
+}
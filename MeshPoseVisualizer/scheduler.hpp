@@ -0,0 +1,43 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Spreads the frames of a run over a pool of worker threads.
+// Every worker starts with a contiguous block of frames in its own queue and takes frames
+// from the front of it. A worker whose queue runs dry steals half of the remaining frames
+// from the back of another worker's queue, so slow frames do not leave threads idle.
+class FrameScheduler {
+public:
+	explicit FrameScheduler(int numWorkers);
+
+	int size() const { return int(queues.size()); }
+
+	// Runs renderFrame(frame, worker) for every frame in [0, numFrames) and returns when all
+	// frames are done. workerStart and workerStop are called on each worker thread before its
+	// first and after its last frame, e.g. to make a rendering context current.
+	void run(size_t numFrames, const std::function<void(int)>& workerStart,
+		const std::function<void(size_t, int)>& renderFrame, const std::function<void(int)>& workerStop);
+
+	// Number of steal operations of the last run.
+	size_t getStealCount() const { return stealCount; }
+
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<size_t> frames;
+	};
+
+	bool popFrame(int worker, size_t& frame);
+	bool stealFrames(int worker);
+
+	std::vector<std::unique_ptr<WorkQueue> > queues;
+	std::mutex statsMutex;
+	size_t stealCount;
+};
+
+#endif
@@ -14,80 +14,78 @@ using namespace std;
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path) {
-
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if (VertexShaderStream.is_open()) {
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}
-	else {
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
-		return 0;
+// Reads a shader file, returns false if it can not be opened.
+static bool ReadShaderFile(const char * file_path, std::string& code) {
+	std::ifstream stream(file_path, std::ios::in);
+	if (!stream.is_open()) {
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", file_path);
+		return false;
 	}
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	code = sstr.str();
+	return true;
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if (FragmentShaderStream.is_open()) {
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+// Compiles a shader and prints its info log. The defines are inserted after the #version line,
+// which has to come first.
+static GLuint CompileShader(GLenum type, const char * file_path, const std::string& code, const char * defines) {
+	std::string source = code;
+	if (defines && defines[0]) {
+		size_t lineEnd = source.find('\n');
+		source.insert(lineEnd == std::string::npos ? source.size() : lineEnd + 1, std::string(defines) + "\n");
 	}
 
+	printf("Compiling shader : %s\n", file_path);
+	GLuint ShaderID = glCreateShader(type);
+	char const * SourcePointer = source.c_str();
+	glShaderSource(ShaderID, 1, &SourcePointer, NULL);
+	glCompileShader(ShaderID);
+
+	// Check the shader
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
-
-
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if (InfoLogLength > 0) {
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+		std::vector<char> ShaderErrorMessage(InfoLogLength + 1);
+		glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+		printf("%s\n", &ShaderErrorMessage[0]);
 	}
+	return ShaderID;
+}
 
+GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path) {
+	return LoadShaders(vertex_file_path, NULL, fragment_file_path, NULL);
+}
 
+GLuint LoadShaders(const char * vertex_file_path, const char * geometry_file_path, const char * fragment_file_path, const char * defines) {
 
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if (InfoLogLength > 0) {
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
+	// Read the shader code from the files
+	std::string VertexShaderCode, GeometryShaderCode, FragmentShaderCode;
+	if (!ReadShaderFile(vertex_file_path, VertexShaderCode) ||
+		(geometry_file_path && !ReadShaderFile(geometry_file_path, GeometryShaderCode)) ||
+		!ReadShaderFile(fragment_file_path, FragmentShaderCode)) {
+		return 0;
 	}
 
+	// Compile the shaders
+	std::vector<GLuint> ShaderIDs;
+	ShaderIDs.push_back(CompileShader(GL_VERTEX_SHADER, vertex_file_path, VertexShaderCode, defines));
+	if (geometry_file_path) {
+		ShaderIDs.push_back(CompileShader(GL_GEOMETRY_SHADER, geometry_file_path, GeometryShaderCode, defines));
+	}
+	ShaderIDs.push_back(CompileShader(GL_FRAGMENT_SHADER, fragment_file_path, FragmentShaderCode, defines));
 
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
 
 	// Link the program
 	printf("Linking program\n");
 	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
+	for (size_t s = 0; s < ShaderIDs.size(); s++) {
+		glAttachShader(ProgramID, ShaderIDs[s]);
+	}
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -99,14 +97,10 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
 
-
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	for (size_t s = 0; s < ShaderIDs.size(); s++) {
+		glDetachShader(ProgramID, ShaderIDs[s]);
+		glDeleteShader(ShaderIDs[s]);
+	}
 
 	return ProgramID;
 }
-
-
@@ -4,5 +4,8 @@
 #include <GL/glew.h>
 
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path);
+// With an optional geometry shader between the two. defines, such as "#define NAME", are added
+// to every stage after its #version line; both may be null.
+GLuint LoadShaders(const char * vertex_file_path, const char * geometry_file_path, const char * fragment_file_path, const char * defines);
 
 #endif
@@ -0,0 +1,13 @@
+#include "pch.h"
+#include <algorithm>
+
+#include "stats.hpp"
+
+double percentile(std::vector<double> values, double p) {
+	if (values.empty()) {
+		return 0.0;
+	}
+	size_t k = std::min(values.size() - 1, size_t(p * (values.size() - 1) + 0.5));
+	std::nth_element(values.begin(), values.begin() + k, values.end());
+	return values[k];
+}
@@ -0,0 +1,9 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <vector>
+
+// Value at fraction p of the sorted values, 0 if there are none.
+double percentile(std::vector<double> values, double p);
+
+#endif
@@ -0,0 +1,148 @@
+#include "pch.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+#include "stats.hpp"
+#include "trace.hpp"
+
+bool traceEnabled = false;
+
+namespace {
+
+struct TraceEvent {
+	const char* name;
+	long long start;
+	long long end; // -1 for counters
+	long long value;
+};
+
+// Events of one thread. Only the thread itself appends to it, the buffers are owned by the
+// list below so they outlive their threads.
+struct TraceThread {
+	int id;
+	std::string name;
+	std::vector<TraceEvent> events;
+};
+
+std::chrono::steady_clock::time_point traceStart;
+std::mutex threadsMutex;
+std::vector<std::unique_ptr<TraceThread> > traceThreads;
+thread_local TraceThread* currentThread = nullptr;
+
+TraceThread& getTraceThread() {
+	if (!currentThread) {
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		traceThreads.push_back(std::unique_ptr<TraceThread>(new TraceThread()));
+		currentThread = traceThreads.back().get();
+		currentThread->id = int(traceThreads.size());
+		currentThread->events.reserve(4096);
+	}
+	return *currentThread;
+}
+
+}
+
+void enableTracing() {
+	traceStart = std::chrono::steady_clock::now();
+	traceEnabled = true;
+}
+
+long long getTraceTime() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+void recordTraceScope(const char* name, long long start, long long end) {
+	TraceEvent event = { name, start, end, 0 };
+	getTraceThread().events.push_back(event);
+}
+
+void recordTraceCounter(const char* name, long long value) {
+	TraceEvent event = { name, getTraceTime(), -1, value };
+	getTraceThread().events.push_back(event);
+}
+
+void setTraceThreadName(const std::string& name) {
+	if (isTracingEnabled()) {
+		getTraceThread().name = name;
+	}
+}
+
+bool writeTrace(const std::string& path) {
+	FILE* fp = fopen(path.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to write %s\n", path.c_str());
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(threadsMutex);
+	// Timestamps are in microseconds.
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MeshPoseVisualizer\"}}");
+	for (size_t t = 0; t < traceThreads.size(); t++) {
+		const TraceThread& thread = *traceThreads[t];
+		if (!thread.name.empty()) {
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", thread.id, thread.name.c_str());
+		}
+		for (size_t e = 0; e < thread.events.size(); e++) {
+			const TraceEvent& event = thread.events[e];
+			if (event.end < 0) {
+				fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%lld}}",
+					event.name, event.start / 1000.0, thread.id, event.value);
+			}
+			else {
+				fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+					event.name, event.start / 1000.0, (event.end - event.start) / 1000.0, thread.id);
+			}
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void printTraceSummary() {
+	// Names are compared as text, the same literal can have different addresses in different files.
+	std::map<std::string, std::vector<double> > scopes;
+	std::map<std::string, std::vector<double> > counters;
+	std::lock_guard<std::mutex> lock(threadsMutex);
+	for (size_t t = 0; t < traceThreads.size(); t++) {
+		const std::vector<TraceEvent>& events = traceThreads[t]->events;
+		for (size_t e = 0; e < events.size(); e++) {
+			if (events[e].end < 0) {
+				counters[events[e].name].push_back(double(events[e].value));
+			}
+			else {
+				scopes[events[e].name].push_back((events[e].end - events[e].start) * 1e-6);
+			}
+		}
+	}
+	std::vector<std::pair<double, std::string> > order;
+	for (std::map<std::string, std::vector<double> >::const_iterator it = scopes.begin(); it != scopes.end(); ++it) {
+		double total = 0.0;
+		for (size_t i = 0; i < it->second.size(); i++) {
+			total += it->second[i];
+		}
+		order.push_back(std::make_pair(total, it->first));
+	}
+	std::sort(order.rbegin(), order.rend());
+	printf("%-26s %8s %12s %10s %10s %10s\n", "scope", "calls", "total ms", "mean ms", "p95 ms", "max ms");
+	for (size_t i = 0; i < order.size(); i++) {
+		const std::vector<double>& times = scopes[order[i].second];
+		printf("%-26s %8d %12.1f %10.3f %10.3f %10.3f\n", order[i].second.c_str(), int(times.size()), order[i].first,
+			order[i].first / times.size(), percentile(times, 0.95), percentile(times, 1.0));
+	}
+	for (std::map<std::string, std::vector<double> >::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+		double sum = 0.0;
+		for (size_t i = 0; i < it->second.size(); i++) {
+			sum += it->second[i];
+		}
+		printf("%-26s %8d samples, mean %.2f, max %.0f\n", it->first.c_str(), int(it->second.size()), sum / it->second.size(), percentile(it->second, 1.0));
+	}
+}
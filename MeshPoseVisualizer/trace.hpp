@@ -0,0 +1,71 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+
+// Timeline of what every thread of a run does (--trace), to see whether a node is bound by
+// I/O, rendering or encoding. Scopes and counters are appended to a buffer per thread and
+// written as a Chrome trace, which chrome://tracing and ui.perfetto.dev open. While tracing is
+// off a scope only checks a flag.
+//
+// Tracing is switched on once at startup, before any other thread runs, so the flag needs no
+// synchronization. Names must be string literals, only the pointers are recorded.
+
+extern bool traceEnabled;
+
+inline bool isTracingEnabled() { return traceEnabled; }
+
+void enableTracing();
+
+// Nanoseconds since tracing was enabled.
+long long getTraceTime();
+
+void recordTraceScope(const char* name, long long start, long long end);
+
+// Records a value that changes over time, such as a queue depth.
+void recordTraceCounter(const char* name, long long value);
+
+// Name of the calling thread in the trace, threads that set none are listed by number.
+void setTraceThreadName(const std::string& name);
+
+// Writes all events as Chrome trace JSON. Must be called after the traced threads finished.
+bool writeTrace(const std::string& path);
+
+// Prints calls, total, mean, p95 and max time per scope name, largest total first, and the
+// mean and maximum of every counter.
+void printTraceSummary();
+
+// Records the time from construction to destruction as one event on the calling thread.
+class TraceScope {
+public:
+	explicit TraceScope(const char* name) : name(isTracingEnabled() ? name : nullptr), start(0) {
+		if (this->name) {
+			start = getTraceTime();
+		}
+	}
+	~TraceScope() {
+		if (name) {
+			recordTraceScope(name, start, getTraceTime());
+		}
+	}
+
+private:
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+
+	const char* name;
+	long long start;
+};
+
+inline void traceCounter(const char* name, long long value) {
+	if (isTracingEnabled()) {
+		recordTraceCounter(name, value);
+	}
+}
+
+#define TRACE_SCOPE_NAME2(line) traceScope##line
+#define TRACE_SCOPE_NAME(line) TRACE_SCOPE_NAME2(line)
+// Times the rest of the enclosing block.
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_NAME(__LINE__)(name)
+
+#endif
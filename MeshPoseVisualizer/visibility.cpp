@@ -0,0 +1,166 @@
+#include "pch.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "mappedfile.hpp"
+#include "trace.hpp"
+#include "visibility.hpp"
+
+VisibilityCollector::VisibilityCollector(size_t numFrames, size_t numFaces)
+	: numFaces(numFaces), frameFaces(numFrames), framePixels(numFrames) {
+}
+
+void VisibilityCollector::addFrame(size_t frame, const unsigned int* faceIds, size_t numPixels) {
+	TRACE_SCOPE("count visibility");
+	std::unique_ptr<Histogram> histogram;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!freeHistograms.empty()) {
+			histogram = std::move(freeHistograms.back());
+			freeHistograms.pop_back();
+		}
+	}
+	if (!histogram) {
+		histogram.reset(new Histogram());
+		histogram->counts.resize(numFaces + 1);
+	}
+	unsigned int* counts = &histogram->counts[0];
+	std::vector<unsigned int>& faces = histogram->faces;
+
+	// Faces cover runs of neighbouring pixels, so the counter is only touched once per run.
+	size_t p = 0;
+	while (p < numPixels) {
+		const unsigned int id = faceIds[p];
+		size_t end = p + 1;
+		while (end < numPixels && faceIds[end] == id) {
+			end++;
+		}
+		if (id != 0 && id <= numFaces) {
+			if (counts[id] == 0) {
+				faces.push_back(id);
+			}
+			counts[id] += (unsigned int)(end - p);
+		}
+		p = end;
+	}
+
+	std::sort(faces.begin(), faces.end());
+	std::vector<unsigned int>& rowFaces = frameFaces[frame];
+	std::vector<unsigned int>& rowPixels = framePixels[frame];
+	rowFaces.resize(faces.size());
+	rowPixels.resize(faces.size());
+	for (size_t i = 0; i < faces.size(); i++) {
+		rowFaces[i] = faces[i] - 1;
+		rowPixels[i] = counts[faces[i]];
+		counts[faces[i]] = 0;
+	}
+	faces.clear();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	freeHistograms.push_back(std::move(histogram));
+}
+
+bool VisibilityCollector::restoreFrames(const std::string& path, const std::vector<size_t>& rows, const std::vector<size_t>& frames) {
+	MappedFile file;
+	if (!file.open(path) || file.size() < sizeof(VisibilityHeader)) {
+		return false;
+	}
+	VisibilityHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, "FVIS", 4) != 0 || header.version != VISIBILITY_VERSION || header.numFaces != numFaces) {
+		return false;
+	}
+	// Only the rows by frame are read, the transpose is rebuilt by write().
+	const size_t offsetsStart = sizeof(VisibilityHeader);
+	const size_t facesStart = offsetsStart + (size_t(header.numFrames) + 1) * sizeof(unsigned long long);
+	const size_t pixelsStart = facesStart + size_t(header.numEntries) * sizeof(unsigned int);
+	if (file.size() < pixelsStart + size_t(header.numEntries) * sizeof(unsigned int)) {
+		return false;
+	}
+	std::vector<unsigned long long> frameOffsets(size_t(header.numFrames) + 1);
+	memcpy(&frameOffsets[0], file.data() + offsetsStart, frameOffsets.size() * sizeof(unsigned long long));
+	for (size_t k = 0; k < rows.size(); k++) {
+		const size_t row = rows[k];
+		if (row >= header.numFrames || frameOffsets[row] > frameOffsets[row + 1] || frameOffsets[row + 1] > header.numEntries) {
+			return false;
+		}
+		const unsigned int* faces = (const unsigned int*)(file.data() + facesStart) + frameOffsets[row];
+		const unsigned int* pixels = (const unsigned int*)(file.data() + pixelsStart) + frameOffsets[row];
+		const size_t count = size_t(frameOffsets[row + 1] - frameOffsets[row]);
+		// write() indexes the transpose with the faces, so a damaged row is counted again instead.
+		for (size_t i = 0; i < count; i++) {
+			if (faces[i] >= numFaces || (i > 0 && faces[i] <= faces[i - 1]) || pixels[i] == 0) {
+				return false;
+			}
+		}
+		frameFaces[frames[k]].assign(faces, faces + count);
+		framePixels[frames[k]].assign(pixels, pixels + count);
+	}
+	return true;
+}
+
+template <typename T>
+static bool writeArray(FILE* fp, const std::vector<T>& values) {
+	return values.empty() || fwrite(&values[0], sizeof(T), values.size(), fp) == values.size();
+}
+
+bool VisibilityCollector::write(const std::string& path) const {
+	TRACE_SCOPE("write visibility");
+	const size_t numFrames = frameFaces.size();
+	std::vector<unsigned long long> frameOffsets(numFrames + 1, 0);
+	for (size_t f = 0; f < numFrames; f++) {
+		frameOffsets[f + 1] = frameOffsets[f] + frameFaces[f].size();
+	}
+	const size_t numEntries = size_t(frameOffsets[numFrames]);
+
+	// Transpose with a counting sort over the faces, walking the frames in order keeps the
+	// frames of every face sorted.
+	std::vector<unsigned long long> faceOffsets(numFaces + 1, 0);
+	for (size_t f = 0; f < numFrames; f++) {
+		for (size_t i = 0; i < frameFaces[f].size(); i++) {
+			faceOffsets[frameFaces[f][i] + 1]++;
+		}
+	}
+	for (size_t face = 0; face < numFaces; face++) {
+		faceOffsets[face + 1] += faceOffsets[face];
+	}
+	std::vector<unsigned int> frames(numEntries);
+	std::vector<unsigned int> facePixels(numEntries);
+	std::vector<unsigned long long> next(faceOffsets.begin(), faceOffsets.end() - 1);
+	for (size_t f = 0; f < numFrames; f++) {
+		for (size_t i = 0; i < frameFaces[f].size(); i++) {
+			size_t entry = size_t(next[frameFaces[f][i]]++);
+			frames[entry] = (unsigned int)f;
+			facePixels[entry] = framePixels[f][i];
+		}
+	}
+
+	VisibilityHeader header;
+	memcpy(header.magic, "FVIS", 4);
+	header.version = VISIBILITY_VERSION;
+	header.numFrames = (unsigned int)numFrames;
+	header.numFaces = (unsigned int)numFaces;
+	header.numEntries = numEntries;
+
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s\n", path.c_str());
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && writeArray(fp, frameOffsets);
+	for (size_t f = 0; f < numFrames && ok; f++) {
+		ok = writeArray(fp, frameFaces[f]);
+	}
+	for (size_t f = 0; f < numFrames && ok; f++) {
+		ok = writeArray(fp, framePixels[f]);
+	}
+	ok = ok && writeArray(fp, faceOffsets) && writeArray(fp, frames) && writeArray(fp, facePixels);
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		return false;
+	}
+	printf("Wrote visibility of %d faces in %d frames, %llu nonzero entries\n", int(numFaces), int(numFrames), (unsigned long long)numEntries);
+	return true;
+}
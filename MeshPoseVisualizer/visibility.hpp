@@ -0,0 +1,62 @@
+#ifndef VISIBILITY_HPP
+#define VISIBILITY_HPP
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Sparse frame x face matrix of pixel counts (.visibility.bin), little-endian:
+//   VisibilityHeader
+//   unsigned long long frameOffsets[numFrames + 1]   CSR by frame, entries of frame f are
+//   unsigned int faces[numEntries]                   frameOffsets[f] .. frameOffsets[f + 1]
+//   unsigned int framePixels[numEntries]             with ascending face indices
+//   unsigned long long faceOffsets[numFaces + 1]     the transpose, CSR by face
+//   unsigned int frames[numEntries]                  with ascending frame indices
+//   unsigned int facePixels[numEntries]
+// Faces are 0-based like the lines of areas.txt (face id - 1), frames are in the order of the
+// face maps. Background pixels are not counted.
+struct VisibilityHeader {
+	char magic[4]; // "FVIS"
+	unsigned int version;
+	unsigned int numFrames;
+	unsigned int numFaces;
+	unsigned long long numEntries;
+};
+
+static const unsigned int VISIBILITY_VERSION = 1;
+
+// Counts how many pixels of every frame each face covers, while the face maps are written,
+// so coverage can be analysed without decoding the images again.
+class VisibilityCollector {
+public:
+	VisibilityCollector(size_t numFrames, size_t numFaces);
+
+	// Adds the histogram of one face map. Different frames can be added concurrently.
+	void addFrame(size_t frame, const unsigned int* faceIds, size_t numPixels);
+
+	// Copies row rows[k] of an existing visibility file into frame frames[k], for frames that
+	// were not rendered again. Returns false if the file is missing, truncated, was written
+	// for another number of faces or a row holds faces out of range, unsorted or without pixels.
+	bool restoreFrames(const std::string& path, const std::vector<size_t>& rows, const std::vector<size_t>& frames);
+
+	size_t getNumFaces() const { return numFaces; }
+
+	// Writes the matrix and its transpose, see VisibilityHeader.
+	bool write(const std::string& path) const;
+
+private:
+	// Dense counters reused between frames, only the touched entries are cleared.
+	struct Histogram {
+		std::vector<unsigned int> counts;
+		std::vector<unsigned int> faces;
+	};
+
+	size_t numFaces;
+	std::vector<std::vector<unsigned int> > frameFaces;
+	std::vector<std::vector<unsigned int> > framePixels;
+	std::mutex mutex;
+	std::vector<std::unique_ptr<Histogram> > freeHistograms;
+};
+
+#endif